@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <kernels.h>
+
+// Below this many multiply-adds per elimination step the pool costs more
+// than it saves, so the step runs on the calling thread
+#define BAREISS_PARALLEL_WORK 16384
+
+typedef struct bareiss_step_st {
+    long long *a;
+    int n;
+    int k;
+    long long prev;
+    divisor_t div;
+} bareiss_step_t;
+
+typedef struct bareiss_big_step_st {
+    bigint_t *a;
+    int n;
+    int k;
+    const bigint_t *prev;
+} bareiss_big_step_t;
+
+
+// One fraction-free update of rows [begin, end), every division is exact
+// (Sylvester's identity) so the entries stay integer minors of the input
+// and the kernel divides by multiplying with the inverse of prev
+static void bareiss_rows(long begin, long end, void *arg) {
+    bareiss_step_t *step = (bareiss_step_t *)arg;
+    int n = step->n;
+    int k = step->k;
+    long long *pivot_row = step->a + (long)k * n;
+
+    for (long i = begin; i < end; i++) {
+        long long *row = step->a + i * n;
+        kernels->bareiss_update(row + k + 1, pivot_row + k + 1, n - k - 1, row[k], pivot_row[k], step->div);
+        row[k] = 0;
+    }
+}
+
+// Same update with big integer entries, each chunk keeps its own
+// temporaries so workers never share scratch space
+static void bareiss_rows_big(long begin, long end, void *arg) {
+    bareiss_big_step_t *step = (bareiss_big_step_t *)arg;
+    int n = step->n;
+    int k = step->k;
+    bigint_t *pivot_row = step->a + (long)k * n;
+    bigint_t t1;
+    bigint_t t2;
+
+    bigint_init(&t1);
+    bigint_init(&t2);
+    for (long i = begin; i < end; i++) {
+        bigint_t *row = step->a + i * n;
+        for (int j = k + 1; j < n; j++) {
+            bigint_mul(&t1, &row[j], &pivot_row[k]);
+            bigint_mul(&t2, &row[k], &pivot_row[j]);
+            bigint_sub(&t1, &t1, &t2);
+            bigint_divexact(&row[j], &t1, step->prev);
+        }
+        bigint_set_i64(&row[k], 0);
+    }
+    bigint_free(&t1);
+    bigint_free(&t2);
+}
+
+// Index of the first row at or below k with a nonzero entry in column k
+static int find_pivot_row(int k, int n, int (*is_zero)(const void *, long), const void *a) {
+    int p = k;
+    while (p < n && is_zero(a, (long)p * n + k)) {
+        p++;
+    }
+    return p;
+}
+
+static int is_zero_64(const void *a, long index) {
+    return ((const long long *)a)[index] == 0;
+}
+
+static int is_zero_big(const void *a, long index) {
+    return bigint_is_zero(&((const bigint_t *)a)[index]);
+}
+
+// Fraction-free Gaussian elimination (Bareiss), O(n^3) and exact. Entries
+// after step k are minors of the input, so while Hadamard's bound fits in
+// 62 bits they are stored in 64 bits with products taken in 128 bits;
+// above that the whole elimination runs on big integers
+static long long bareiss_64(const matrix_t *matrix) {
+    int n = matrix->n;
+    long long *a = (long long *)malloc((long)n * n * sizeof(long long));
+    long long det;
+    pool_count_minor_bytes(pool, (long)n * n * sizeof(long long));
+    int sign = 1;
+    bareiss_step_t step = { .a = a, .n = n, .prev = 1, .div = kernel_divisor(1) };
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[(long)i * n + j] = MAT(matrix, i, j);
+        }
+    }
+
+    for (int k = 0; k < n - 1; k++) {
+        int p = find_pivot_row(k, n, is_zero_64, a);
+        if (p == n) {
+            free(a);
+            return 0;
+        }
+        if (p != k) {
+            // Pivot with a row below, every swap flips the sign
+            for (int j = 0; j < n; j++) {
+                long long tmp = a[(long)k * n + j];
+                a[(long)k * n + j] = a[(long)p * n + j];
+                a[(long)p * n + j] = tmp;
+            }
+            sign = -sign;
+        }
+        step.k = k;
+        long grain = BAREISS_PARALLEL_WORK / (n - k) + 1;
+        pool_parallel_for(pool, k + 1, n, grain, bareiss_rows, &step);
+        step.prev = a[(long)k * n + k];
+        step.div = kernel_divisor(step.prev);
+    }
+
+    det = n > 0 ? sign * a[(long)n * n - 1] : 1;
+    free(a);
+    return det;
+}
+
+static void bareiss_big(const matrix_t *matrix, bigint_t *det) {
+    int n = matrix->n;
+    bigint_t *a = (bigint_t *)malloc((long)n * n * sizeof(bigint_t));
+    bigint_t one;
+    pool_count_minor_bytes(pool, (long)n * n * sizeof(bigint_t));
+    int sign = 1;
+    bareiss_big_step_t step = { .a = a, .n = n };
+
+    bigint_init(&one);
+    bigint_set_i64(&one, 1);
+    step.prev = &one;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            bigint_init(&a[(long)i * n + j]);
+            bigint_set_i64(&a[(long)i * n + j], MAT(matrix, i, j));
+        }
+    }
+
+    bigint_set_i64(det, 0);
+    for (int k = 0; k < n - 1; k++) {
+        int p = find_pivot_row(k, n, is_zero_big, a);
+        if (p == n) {
+            goto done;
+        }
+        if (p != k) {
+            for (int j = 0; j < n; j++) {
+                bigint_t tmp = a[(long)k * n + j];
+                a[(long)k * n + j] = a[(long)p * n + j];
+                a[(long)p * n + j] = tmp;
+            }
+            sign = -sign;
+        }
+        step.k = k;
+        long grain = BAREISS_PARALLEL_WORK / 16 / (n - k) + 1;
+        pool_parallel_for(pool, k + 1, n, grain, bareiss_rows_big, &step);
+        // Row k is never touched again, its pivot can be used in place
+        step.prev = &a[(long)k * n + k];
+    }
+    if (n > 0) {
+        bigint_copy(det, &a[(long)n * n - 1]);
+        if (sign < 0) {
+            bigint_neg(det);
+        }
+    }
+    else {
+        bigint_set_i64(det, 1);
+    }
+
+done:
+    for (long i = 0; i < (long)n * n; i++) {
+        bigint_free(&a[i]);
+    }
+    free(a);
+    bigint_free(&one);
+}
+
+void bareiss_determinant(const matrix_t *matrix, det_t *det) {
+    if (width_for_bits(hadamard_bits(matrix, matrix->n)) == DET_INT64) {
+        det_set_i128(det, bareiss_64(matrix), DET_INT64);
+    }
+    else {
+        bigint_t value;
+        bigint_init(&value);
+        bareiss_big(matrix, &value);
+        det_set_big(det, &value);
+        bigint_free(&value);
+    }
+}
@@ -0,0 +1,515 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <determinant.h>
+#include <binfmt.h>
+#include <kernels.h>
+#include <cache.h>
+
+// Matrices parsed ahead of the writer, per worker thread
+#define BATCH_WINDOW_PER_THREAD 64
+#define BATCH_READ_CHUNK (1 << 16)
+// Batch matrices are small, 1MB arena blocks per matrix would be a waste
+#define BATCH_ARENA_BLOCK 4096
+// Matrices of up to SMALL_MAX_N gathered into one lane group, a group is
+// one task and one slot of the window
+#define BATCH_LANE_GROUP 1024
+
+typedef struct batch_item_st batch_item_t;
+typedef struct batch_st batch_t;
+typedef struct reader_st reader_t;
+
+// One matrix, or with lanes.count > 0 a lane group of consecutive small
+// matrices of one size whose records start at index
+struct batch_item_st {
+    long index;
+    int algo;
+    int done;
+    matrix_t *matrix;
+    arena_t arena;
+    det_t det;
+    small_lanes_t lanes;
+    long long *dets;
+    task_t task;
+    batch_t *batch;
+    batch_item_t *next;
+};
+
+// Items are queued in input order, the writer only ever looks at the head
+struct batch_st {
+    pthread_mutex_t lock;
+    pthread_cond_t item_done;
+    pthread_cond_t slot_free;
+    batch_item_t *head;
+    batch_item_t *tail;
+    int in_flight;
+    int window;
+    int finished;
+    long count;
+    long errors;
+};
+
+// Input as a mapped file or a buffer refilled from a pipe. Offsets are
+// kept relative to pos because refilling may move the buffer
+struct reader_st {
+    int fd;
+    int mapped;
+    int eof;
+    char *buf;
+    size_t cap;
+    size_t pos;
+    size_t len;
+};
+
+
+static void reader_open(reader_t *reader, const char *filename) {
+    struct stat st;
+    memset(reader, 0, sizeof(reader_t));
+    if (strcmp(filename, "-") == 0) {
+        reader->fd = STDIN_FILENO;
+    }
+    else if ((reader->fd = open(filename, O_RDONLY)) < 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        reader->buf = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (reader->buf != MAP_FAILED) {
+            madvise(reader->buf, st.st_size, MADV_SEQUENTIAL);
+            reader->mapped = 1;
+            reader->eof = 1;
+            reader->len = st.st_size;
+            return;
+        }
+    }
+    reader->cap = BATCH_READ_CHUNK;
+    reader->buf = (char *)malloc(reader->cap);
+}
+
+static void reader_close(reader_t *reader) {
+    if (reader->mapped) {
+        munmap(reader->buf, reader->len);
+    }
+    else {
+        free(reader->buf);
+    }
+    if (reader->fd != STDIN_FILENO) {
+        close(reader->fd);
+    }
+}
+
+// Read another chunk, returns 0 at end of input
+static int reader_fill(reader_t *reader) {
+    ssize_t nread;
+    if (reader->eof) {
+        return 0;
+    }
+    if (reader->pos > reader->cap / 2) {
+        memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+        reader->len -= reader->pos;
+        reader->pos = 0;
+    }
+    if (reader->cap - reader->len < BATCH_READ_CHUNK) {
+        reader->cap *= 2;
+        reader->buf = (char *)realloc(reader->buf, reader->cap);
+    }
+    if ((nread = read(reader->fd, reader->buf + reader->len, reader->cap - reader->len)) < 0) {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+    if (nread == 0) {
+        reader->eof = 1;
+        return 0;
+    }
+    reader->len += nread;
+    return 1;
+}
+
+static int reader_ensure(reader_t *reader, size_t need) {
+    while (reader->len - reader->pos < need && reader_fill(reader)) {
+    }
+    return reader->len - reader->pos >= need;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Length of the binary record at pos, as far as its header tells. A
+// broken or cut off record is returned whole so the loader reports it
+static size_t binary_record_length(reader_t *reader) {
+    binary_header_t header;
+    size_t size;
+    if (!reader_ensure(reader, BINARY_HEADER_SIZE)) {
+        return reader->len - reader->pos;
+    }
+    memcpy(&header, reader->buf + reader->pos, sizeof(header));
+    if (header.stride < header.n) {
+        return BINARY_HEADER_SIZE;
+    }
+    size = BINARY_HEADER_SIZE + (size_t)header.n * header.stride * sizeof(int32_t);
+    if (!reader_ensure(reader, size)) {
+        return reader->len - reader->pos;
+    }
+    return size;
+}
+
+// Length of the text record at pos: everything up to the first line
+// holding only whitespace, or the end of input
+static size_t text_record_length(reader_t *reader) {
+    size_t line = 0;
+    size_t off = 0;
+    for (;;) {
+        char *start = reader->buf + reader->pos;
+        size_t avail = reader->len - reader->pos;
+        while (off < avail && start[off] != '\n') {
+            off++;
+        }
+        if (off == avail && reader_fill(reader)) {
+            continue;
+        }
+        // Whole line [line, off) is in the buffer
+        int blank = 1;
+        for (size_t i = line; i < off && blank; i++) {
+            blank = is_space(start[i]);
+        }
+        if (blank && line > 0) {
+            return line;
+        }
+        if (off >= avail) {
+            return avail;
+        }
+        off += 1;
+        line = off;
+    }
+}
+
+// Find the next record, returns 0 when the input is exhausted
+static int next_record(reader_t *reader, size_t *length, int *binary) {
+    for (;;) {
+        while (reader->pos < reader->len && is_space(reader->buf[reader->pos])) {
+            reader->pos++;
+        }
+        if (reader->pos < reader->len) {
+            break;
+        }
+        if (!reader_fill(reader)) {
+            return 0;
+        }
+    }
+    reader_ensure(reader, 4);
+    *binary = is_binary_matrix(reader->buf + reader->pos, reader->len - reader->pos);
+    *length = *binary ? binary_record_length(reader) : text_record_length(reader);
+    return 1;
+}
+
+static void item_finished(batch_item_t *item) {
+    batch_t *batch = item->batch;
+    pthread_mutex_lock(&batch->lock);
+    item->done = 1;
+    pthread_cond_broadcast(&batch->item_done);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void item_run(task_t *task) {
+    batch_item_t *item = (batch_item_t *) task->arg;
+    if (item->lanes.count > 0) {
+        small_lanes_det(&item->lanes, item->dets);
+    }
+    else {
+        compute_determinant(item->algo, item->matrix, &item->arena, &item->det);
+    }
+    item_finished(item);
+}
+
+// Output stage: print results strictly in input order as they complete
+static void *writer_main(void *arg) {
+    batch_t *batch = (batch_t *)arg;
+    batch_item_t *item;
+
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        while ((batch->head == NULL && !batch->finished) || (batch->head != NULL && !batch->head->done)) {
+            pthread_cond_wait(&batch->item_done, &batch->lock);
+        }
+        if (batch->head == NULL) {
+            break;
+        }
+        item = batch->head;
+        batch->head = item->next;
+        if (batch->head == NULL) {
+            batch->tail = NULL;
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        if (item->lanes.count > 0) {
+            for (long k = 0; k < item->lanes.count; k++) {
+                printf("%li %lli\n", item->index + k, item->dets[k]);
+            }
+        }
+        else if (item->matrix == NULL) {
+            printf("%li error\n", item->index);
+        }
+        else {
+            char *det = det_to_string(&item->det);
+            printf("%li %s\n", item->index, det);
+            free(det);
+        }
+        det_free(&item->det);
+        arena_release(&item->arena);
+        small_lanes_free(&item->lanes);
+        free(item->dets);
+        free(item);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->in_flight -= 1;
+        pthread_cond_signal(&batch->slot_free);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+// Queue an item behind the others, waiting while the window is full
+static void enqueue(batch_t *batch, batch_item_t *item) {
+    pthread_mutex_lock(&batch->lock);
+    while (batch->in_flight >= batch->window) {
+        pthread_cond_wait(&batch->slot_free, &batch->lock);
+    }
+    if (batch->tail == NULL) {
+        batch->head = item;
+    }
+    else {
+        batch->tail->next = item;
+    }
+    batch->tail = item;
+    batch->in_flight += 1;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static batch_item_t *item_create(batch_t *batch, int algo) {
+    batch_item_t *item = (batch_item_t *)calloc(1, sizeof(batch_item_t));
+    item->algo = algo;
+    item->batch = batch;
+    arena_init_sized(&item->arena, BATCH_ARENA_BLOCK);
+    det_init(&item->det);
+    small_lanes_init(&item->lanes, 0);
+    return item;
+}
+
+// Queue the item and hand it to the pool, failed ones are done already
+static void item_submit(batch_t *batch, batch_item_t *item) {
+    enqueue(batch, item);
+    if (item->matrix == NULL && item->lanes.count == 0) {
+        batch->errors += 1;
+        item_finished(item);
+    }
+    else {
+        item->task.run = item_run;
+        item->task.arg = item;
+        item->task.pending = NULL;
+        pool_spawn(pool, &item->task);
+    }
+}
+
+static batch_item_t *group_create(batch_t *batch, int algo) {
+    batch_item_t *group = item_create(batch, algo);
+    small_lanes_init(&group->lanes, BATCH_LANE_GROUP);
+    group->dets = (long long *)malloc(BATCH_LANE_GROUP * sizeof(long long));
+    return group;
+}
+
+// Load the record straight into the next lane of the group, see
+// parse_text_lanes for the result
+static int group_add(batch_item_t *group, char *record, size_t length, int binary, const char *name) {
+    if (binary) {
+        return load_binary_lanes(record, length, name, &group->lanes);
+    }
+    return parse_text_lanes(record, length, name, &group->lanes);
+}
+
+static void batch_usage(char *program) {
+    fprintf(stderr, "Usage: %s batch [--algo=NAME] [--threads N] [--cutoff N] [--scalar]\n", program);
+    fprintf(stderr, "       [--cache] [--cache-file PATH] [--cache-minors] [<file>|-]\n");
+    fprintf(stderr, "  Reads text matrices separated by blank lines and/or binary records from\n");
+    fprintf(stderr, "  file or stdin and prints one \"<record> <det>\" line per matrix in order\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant batch: this thread parses, the pool computes and a writer
+// thread prints, so parsing the next matrices overlaps with computing
+int batch_main(int argc, char **argv) {
+    int threads = default_thread_count();
+    int algo = ALGO_LAPLACE;
+    const char *filename = "-";
+    double start = now_ms();
+    batch_t batch;
+    reader_t reader;
+    pthread_t writer;
+    size_t length;
+    int binary;
+    batch_item_t *group = NULL;
+    int scalar = 0;
+    int cache = 0;
+    int cache_minors = 0;
+    const char *cache_file = NULL;
+    int opt;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"cutoff", required_argument, 0, 'c'},
+        {"algo", required_argument, 0, 'a'},
+        {"scalar", no_argument, 0, 's'},
+        {"cache", no_argument, 0, 'C'},
+        {"cache-file", required_argument, 0, 'F'},
+        {"cache-minors", no_argument, 0, 'M'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "t:c:a:sCF:M", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                if ((threads = atoi(optarg)) < 1) {
+                    batch_usage(argv[0]);
+                }
+                break;
+            case 'c':
+                inline_cutoff = atoi(optarg);
+                break;
+            case 'a':
+                if ((algo = parse_algo(optarg)) < 0) {
+                    fprintf(stderr, "Unknown algorithm: %s\n", optarg);
+                    batch_usage(argv[0]);
+                }
+                break;
+            case 's':
+                scalar = 1;
+                break;
+            case 'C':
+                cache = 1;
+                break;
+            case 'F':
+                cache = 1;
+                cache_file = optarg;
+                break;
+            case 'M':
+                cache = 1;
+                cache_minors = 1;
+                break;
+            default:
+                batch_usage(argv[0]);
+        }
+    }
+    if (optind < argc - 1) {
+        batch_usage(argv[0]);
+    }
+    if (optind == argc - 1) {
+        filename = argv[optind];
+    }
+
+    kernels_select(scalar);
+    if (cache) {
+        result_cache = cache_create(cache_file, cache_minors);
+    }
+    memset(&batch, 0, sizeof(batch));
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.item_done, NULL);
+    pthread_cond_init(&batch.slot_free, NULL);
+    batch.window = BATCH_WINDOW_PER_THREAD * threads;
+    pool = pool_create(threads);
+    reader_open(&reader, filename);
+    pthread_create(&writer, NULL, writer_main, &batch);
+
+    while (next_record(&reader, &length, &binary)) {
+        batch_item_t *item;
+        char *record = reader.buf + reader.pos;
+        char name[64];
+        int added = 0;
+
+        snprintf(name, sizeof(name), "record %li", batch.count + 1);
+        // Small matrices of one size go to the open lane group, computed
+        // a vector register of them at a time. Cached results are per
+        // matrix, so the cache turns this off
+        if (result_cache == NULL) {
+            if (group == NULL) {
+                group = group_create(&batch, algo);
+            }
+            if ((added = group_add(group, record, length, binary, name)) == 0 && group->lanes.count > 0) {
+                item_submit(&batch, group);
+                group = group_create(&batch, algo);
+                added = group_add(group, record, length, binary, name);
+            }
+            if (added == 1) {
+                if (group->lanes.count == 1) {
+                    group->index = batch.count + 1;
+                }
+                batch.count += 1;
+                reader.pos += length;
+                if (group->lanes.count == BATCH_LANE_GROUP) {
+                    item_submit(&batch, group);
+                    group = NULL;
+                }
+                continue;
+            }
+            // Anything else ends the group, results stay in input order
+            if (group->lanes.count > 0) {
+                item_submit(&batch, group);
+                group = NULL;
+            }
+        }
+
+        item = item_create(&batch, algo);
+        item->index = ++batch.count;
+        if (added < 0) {
+            // Already reported by the lane loader
+            item->matrix = NULL;
+        }
+        else if (binary) {
+            // Binary rows are used in place, a refillable buffer may move
+            // so such records are copied into the item's arena first
+            if (!reader.mapped) {
+                char *copy = (char *)arena_alloc(&item->arena, length);
+                memcpy(copy, record, length);
+                record = copy;
+            }
+            item->matrix = load_binary_matrix(record, length, name, &item->arena, NULL);
+        }
+        else {
+            item->matrix = parse_text_matrix(record, length, name, &item->arena, NULL);
+        }
+        reader.pos += length;
+        item_submit(&batch, item);
+    }
+    if (group != NULL && group->lanes.count > 0) {
+        item_submit(&batch, group);
+    }
+    else if (group != NULL) {
+        arena_release(&group->arena);
+        small_lanes_free(&group->lanes);
+        free(group->dets);
+        free(group);
+    }
+
+    pthread_mutex_lock(&batch.lock);
+    batch.finished = 1;
+    pthread_cond_broadcast(&batch.item_done);
+    pthread_mutex_unlock(&batch.lock);
+    pthread_join(writer, NULL);
+    fflush(stdout);
+
+    reader_close(&reader);
+    pool_destroy(pool);
+    fprintf(stderr, "Batch: %li matrices, %li errors, %.3f ms\n", batch.count, batch.errors, now_ms() - start);
+    if (result_cache != NULL) {
+        cache_print_counters(result_cache, stderr);
+        cache_destroy(result_cache);
+    }
+    return batch.errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <matrix.h>
+
+#define DEFAULT_MAX_N 10
+#define DEFAULT_REPS 5
+#define DEFAULT_SEED 1
+#define MAX_LIST 16
+// Generated entries, large-entry matrices use the full width instead
+#define SMALL_ENTRY 9
+#define LARGE_ENTRY 1000000000
+#define BAND_WIDTH 2
+
+#define KIND_RANDOM 0
+#define KIND_BANDED 1
+#define KIND_SINGULAR 2
+#define KIND_LARGE 3
+
+typedef struct engine_st {
+    const char *name;
+    // Largest n worth running, the expansions grow as n! and n * 2^n
+    int max_n;
+} engine_t;
+
+typedef struct sample_st {
+    double ms;
+    long rss_kb;
+    int threads;
+    char det[1024];
+} sample_t;
+
+static const char *kind_names[] = { "random", "banded", "singular", "large" };
+
+static const engine_t engines[] = {
+    { "laplace", 10 },
+    { "subset", 20 },
+    { "bareiss", 1 << 20 },
+    { "modular", 1 << 20 },
+};
+
+static uint64_t rng_state;
+
+
+// xorshift64*, the same seed gives the same matrices on every machine
+static uint64_t next_random() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static int random_entry(int bound) {
+    return (int)(next_random() % (2 * (uint64_t)bound + 1)) - bound;
+}
+
+static matrix_t *generate(arena_t *arena, int kind, int n) {
+    matrix_t *matrix = matrix_alloc(arena, n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (kind == KIND_BANDED && abs(i - j) > BAND_WIDTH) {
+                MAT(matrix, i, j) = 0;
+            }
+            else {
+                MAT(matrix, i, j) = random_entry(kind == KIND_LARGE ? LARGE_ENTRY : SMALL_ENTRY);
+            }
+        }
+    }
+    // Last row is the sum of the first two, or zero when there are none
+    if (kind == KIND_SINGULAR) {
+        for (int j = 0; j < n; j++) {
+            MAT(matrix, n - 1, j) = n > 2 ? MAT(matrix, 0, j) + MAT(matrix, 1, j) : 0;
+        }
+    }
+    return matrix;
+}
+
+// Value of "<key>: " in the solver output, NULL when it is missing
+static const char *find_field(const char *output, const char *key) {
+    const char *p = strstr(output, key);
+    return p == NULL ? NULL : p + strlen(key);
+}
+
+static double clock_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// One solver run in a child process. The wall time is taken from fork to
+// wait4, so it includes start up, parsing and output like a user would
+// see; the peak RSS comes from wait4 and the thread count from the output
+static int run_once(const char *solver, const char *algo, int threads, const char *file, sample_t *sample) {
+    char threads_arg[16];
+    char algo_arg[32];
+    char output[8192];
+    size_t len = 0;
+    ssize_t nread;
+    struct rusage usage;
+    int status;
+    int fds[2];
+    pid_t pid;
+    const char *field;
+    double start_ms;
+
+    snprintf(threads_arg, sizeof(threads_arg), "%i", threads);
+    snprintf(algo_arg, sizeof(algo_arg), "--algo=%s", algo);
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    start_ms = clock_ms();
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(solver, solver, "--quiet", algo_arg, "--threads", threads_arg, file, (char *)NULL);
+        perror(solver);
+        _exit(127);
+    }
+    close(fds[1]);
+    while (len < sizeof(output) - 1 && (nread = read(fds[0], output + len, sizeof(output) - 1 - len)) > 0) {
+        len += nread;
+    }
+    output[len] = '\0';
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    sample->ms = clock_ms() - start_ms;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || find_field(output, "Det: ") == NULL) {
+        return -1;
+    }
+    sample->rss_kb = usage.ru_maxrss;
+    sample->threads = (field = find_field(output, "Threads created: ")) != NULL ? atoi(field) : 0;
+    sample->det[0] = '\0';
+    if ((field = find_field(output, "Det: ")) != NULL) {
+        sscanf(field, "%1023s", sample->det);
+    }
+    return 0;
+}
+
+static int compare_ms(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Comma separated list into items, returns how many there were
+static int split_list(char *list, char **items) {
+    int count = 0;
+    for (char *item = strtok(list, ","); item != NULL && count < MAX_LIST; item = strtok(NULL, ",")) {
+        items[count++] = item;
+    }
+    return count;
+}
+
+static void bench_usage(char *program) {
+    fprintf(stderr, "Usage: %s [--max-n N] [--reps N] [--seed N] [--algos LIST] [--threads LIST]\n", program);
+    fprintf(stderr, "          [--kinds LIST] [--format=csv|json] [--solver PATH]\n");
+    fprintf(stderr, "  Generates random, banded, singular and large-entry matrices of size 3..N\n");
+    fprintf(stderr, "  and reports median and p95 wall time, peak RSS and threads created\n");
+    fprintf(stderr, "  for every algorithm and thread count (defaults: N = %i, %i repetitions,\n",
+            DEFAULT_MAX_N, DEFAULT_REPS);
+    fprintf(stderr, "  all algorithms and kinds, threads 1 and the number of online cores).\n");
+    fprintf(stderr, "  Exits with failure when two algorithms disagree on a determinant\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    int max_n = DEFAULT_MAX_N;
+    int reps = DEFAULT_REPS;
+    int json = 0;
+    uint64_t seed = DEFAULT_SEED;
+    const char *solver = "./determinant";
+    char default_threads[32];
+    char default_algos[] = "laplace,subset,bareiss,modular";
+    char default_kinds[] = "random,banded,singular,large";
+    char *algo_list = default_algos;
+    char *thread_list = default_threads;
+    char *kind_list = default_kinds;
+    char *algos[MAX_LIST];
+    char *thread_items[MAX_LIST];
+    char *kinds[MAX_LIST];
+    int nalgos, nthreads, nkinds;
+    char dir[] = "/tmp/detbench.XXXXXX";
+    int first = 1;
+    int mismatches = 0;
+    int opt;
+
+    static struct option long_options[] = {
+        {"max-n", required_argument, 0, 'n'},
+        {"reps", required_argument, 0, 'r'},
+        {"seed", required_argument, 0, 's'},
+        {"algos", required_argument, 0, 'a'},
+        {"threads", required_argument, 0, 't'},
+        {"kinds", required_argument, 0, 'k'},
+        {"format", required_argument, 0, 'f'},
+        {"solver", required_argument, 0, 'b'},
+        {0, 0, 0, 0}
+    };
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    snprintf(default_threads, sizeof(default_threads), cores > 1 ? "1,%li" : "1", cores);
+    while ((opt = getopt_long(argc, argv, "n:r:s:a:t:k:f:b:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                max_n = atoi(optarg);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                algo_list = optarg;
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'k':
+                kind_list = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0) {
+                    bench_usage(argv[0]);
+                }
+                json = strcmp(optarg, "json") == 0;
+                break;
+            case 'b':
+                solver = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if (optind != argc || max_n < 3 || reps < 1) {
+        bench_usage(argv[0]);
+    }
+    nalgos = split_list(algo_list, algos);
+    nthreads = split_list(thread_list, thread_items);
+    nkinds = split_list(kind_list, kinds);
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+
+    if (json) {
+        printf("[\n");
+    }
+    else {
+        printf("kind,n,algo,threads,reps,median_ms,p95_ms,peak_rss_kb,threads_created\n");
+    }
+    for (int k = 0; k < nkinds; k++) {
+        int kind = -1;
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(kinds[k], kind_names[i]) == 0) {
+                kind = i;
+            }
+        }
+        if (kind < 0) {
+            fprintf(stderr, "Unknown matrix kind: %s\n", kinds[k]);
+            bench_usage(argv[0]);
+        }
+        // Each kind restarts the generator so its matrices do not depend
+        // on which other kinds were selected
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + kind + 1;
+
+        for (int n = 3; n <= max_n; n++) {
+            char file[64];
+            char reference[1024] = "";
+            arena_t arena;
+            FILE *stream;
+
+            arena_init(&arena);
+            snprintf(file, sizeof(file), "%s/%s-%i.txt", dir, kind_names[kind], n);
+            if ((stream = fopen(file, "w")) == NULL) {
+                perror(file);
+                exit(EXIT_FAILURE);
+            }
+            matrix_t *matrix = generate(&arena, kind, n);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    fprintf(stream, j == n - 1 ? "%i\n" : "%i ", MAT(matrix, i, j));
+                }
+            }
+            fclose(stream);
+            arena_release(&arena);
+
+            for (int a = 0; a < nalgos; a++) {
+                const engine_t *engine = NULL;
+                for (int i = 0; i < (int)(sizeof(engines) / sizeof(engines[0])); i++) {
+                    if (strcmp(algos[a], engines[i].name) == 0) {
+                        engine = &engines[i];
+                    }
+                }
+                if (engine == NULL) {
+                    fprintf(stderr, "Unknown algorithm: %s\n", algos[a]);
+                    bench_usage(argv[0]);
+                }
+                if (n > engine->max_n) {
+                    continue;
+                }
+                for (int t = 0; t < nthreads; t++) {
+                    int threads = atoi(thread_items[t]);
+                    double times[reps];
+                    sample_t sample;
+                    long rss = 0;
+                    int created = 0;
+
+                    for (int r = 0; r < reps; r++) {
+                        if (run_once(solver, engine->name, threads, file, &sample) != 0) {
+                            fprintf(stderr, "%s failed on %s\n", engine->name, file);
+                            exit(EXIT_FAILURE);
+                        }
+                        times[r] = sample.ms;
+                        rss = sample.rss_kb > rss ? sample.rss_kb : rss;
+                        created = sample.threads;
+                    }
+                    // Every engine has to agree with the first one that ran
+                    if (reference[0] == '\0') {
+                        strcpy(reference, sample.det);
+                    }
+                    else if (strcmp(reference, sample.det) != 0) {
+                        fprintf(stderr, "Determinant mismatch on %s: %s gives %s, expected %s\n",
+                                file, engine->name, sample.det, reference);
+                        mismatches += 1;
+                    }
+
+                    qsort(times, reps, sizeof(double), compare_ms);
+                    double median = reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+                    // Nearest rank percentile
+                    double p95 = times[(95 * reps + 99) / 100 - 1];
+                    if (json) {
+                        printf("%s  {\"kind\": \"%s\", \"n\": %i, \"algo\": \"%s\", \"threads\": %i, \"reps\": %i, "
+                               "\"median_ms\": %.3f, \"p95_ms\": %.3f, \"peak_rss_kb\": %li, \"threads_created\": %i}",
+                               first ? "" : ",\n", kind_names[kind], n, engine->name, threads, reps,
+                               median, p95, rss, created);
+                    }
+                    else {
+                        printf("%s,%i,%s,%i,%i,%.3f,%.3f,%li,%i\n", kind_names[kind], n, engine->name, threads,
+                               reps, median, p95, rss, created);
+                    }
+                    first = 0;
+                    fflush(stdout);
+                }
+            }
+            unlink(file);
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    rmdir(dir);
+    if (mismatches > 0) {
+        fprintf(stderr, "Determinant mismatches: %i\n", mismatches);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bigint.h>
+
+// Scratch of products and divisions up to this many limbs lives on the
+// stack, only larger operands pay for a malloc
+#define STACK_LIMBS 256
+
+
+void bigint_init(bigint_t *b) {
+    b->neg = 0;
+    b->len = 0;
+    b->cap = 0;
+    b->limb = NULL;
+}
+
+void bigint_free(bigint_t *b) {
+    free(b->limb);
+    bigint_init(b);
+}
+
+static void reserve(bigint_t *b, int cap) {
+    if (cap > b->cap) {
+        b->limb = (uint32_t *)realloc(b->limb, cap * sizeof(uint32_t));
+        b->cap = cap;
+    }
+}
+
+// Drop leading zero limbs, zero is never negative
+static void normalize(bigint_t *b) {
+    while (b->len > 0 && b->limb[b->len - 1] == 0) {
+        b->len -= 1;
+    }
+    if (b->len == 0) {
+        b->neg = 0;
+    }
+}
+
+void bigint_set_i128(bigint_t *b, __int128 value) {
+    unsigned __int128 mag = value < 0 ? -(unsigned __int128)value : (unsigned __int128)value;
+    reserve(b, 4);
+    b->neg = value < 0;
+    b->len = 0;
+    while (mag != 0) {
+        b->limb[b->len++] = (uint32_t)mag;
+        mag >>= 32;
+    }
+    normalize(b);
+}
+
+void bigint_set_i64(bigint_t *b, long long value) {
+    bigint_set_i128(b, value);
+}
+
+void bigint_copy(bigint_t *dst, const bigint_t *src) {
+    if (dst == src) {
+        return;
+    }
+    reserve(dst, src->len);
+    if (src->len > 0) {
+        memcpy(dst->limb, src->limb, src->len * sizeof(uint32_t));
+    }
+    dst->len = src->len;
+    dst->neg = src->neg;
+}
+
+int bigint_is_zero(const bigint_t *b) {
+    return b->len == 0;
+}
+
+void bigint_neg(bigint_t *b) {
+    if (b->len > 0) {
+        b->neg = !b->neg;
+    }
+}
+
+static int mag_cmp(const bigint_t *a, const bigint_t *b) {
+    if (a->len != b->len) {
+        return a->len < b->len ? -1 : 1;
+    }
+    for (int i = a->len - 1; i >= 0; i--) {
+        if (a->limb[i] != b->limb[i]) {
+            return a->limb[i] < b->limb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// |r| = |a| + |b|, r may be a or b since each limb is read before written
+static void mag_add(bigint_t *r, const bigint_t *a, const bigint_t *b) {
+    int len = a->len > b->len ? a->len : b->len;
+    int alen = a->len;
+    int blen = b->len;
+    uint64_t carry = 0;
+    reserve(r, len + 1);
+    for (int i = 0; i < len; i++) {
+        uint64_t sum = carry;
+        if (i < alen) sum += a->limb[i];
+        if (i < blen) sum += b->limb[i];
+        r->limb[i] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+    r->limb[len] = (uint32_t)carry;
+    r->len = len + 1;
+}
+
+// |r| = |a| - |b| where |a| >= |b|, same aliasing rules as mag_add
+static void mag_sub(bigint_t *r, const bigint_t *a, const bigint_t *b) {
+    int alen = a->len;
+    int blen = b->len;
+    int64_t borrow = 0;
+    reserve(r, alen);
+    for (int i = 0; i < alen; i++) {
+        int64_t diff = (int64_t)a->limb[i] - borrow - (i < blen ? b->limb[i] : 0);
+        borrow = diff < 0;
+        r->limb[i] = (uint32_t)(diff + (borrow << 32));
+    }
+    r->len = alen;
+}
+
+static void add_signed(bigint_t *r, const bigint_t *a, const bigint_t *b, int bneg) {
+    int aneg = a->neg;
+    if (aneg == bneg) {
+        mag_add(r, a, b);
+        r->neg = aneg;
+    }
+    else if (mag_cmp(a, b) >= 0) {
+        mag_sub(r, a, b);
+        r->neg = aneg;
+    }
+    else {
+        mag_sub(r, b, a);
+        r->neg = bneg;
+    }
+    normalize(r);
+}
+
+void bigint_add(bigint_t *r, const bigint_t *a, const bigint_t *b) {
+    add_signed(r, a, b, b->neg);
+}
+
+void bigint_sub(bigint_t *r, const bigint_t *a, const bigint_t *b) {
+    add_signed(r, a, b, b->len > 0 ? !b->neg : 0);
+}
+
+// Schoolbook product written straight into r. When r aliases a or b the
+// product goes to scratch first and is copied over
+void bigint_mul(bigint_t *r, const bigint_t *a, const bigint_t *b) {
+    int len = a->len + b->len;
+    int neg = a->neg != b->neg;
+    int alias = r == a || r == b;
+    uint32_t stack[STACK_LIMBS];
+    uint32_t *out;
+
+    if (a->len == 0 || b->len == 0) {
+        r->len = 0;
+        r->neg = 0;
+        return;
+    }
+    if (alias) {
+        out = len <= STACK_LIMBS ? stack : (uint32_t *)malloc(len * sizeof(uint32_t));
+    }
+    else {
+        reserve(r, len);
+        out = r->limb;
+    }
+    memset(out, 0, b->len * sizeof(uint32_t));
+    for (int i = 0; i < a->len; i++) {
+        uint64_t carry = 0;
+        uint64_t ai = a->limb[i];
+        for (int j = 0; j < b->len; j++) {
+            uint64_t t = ai * b->limb[j] + out[i + j] + carry;
+            out[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        out[i + b->len] = (uint32_t)carry;
+    }
+    if (alias) {
+        reserve(r, len);
+        memcpy(r->limb, out, len * sizeof(uint32_t));
+        if (out != stack) {
+            free(out);
+        }
+    }
+    r->len = len;
+    r->neg = neg;
+    normalize(r);
+}
+
+// Single pass over a, each limb is read before it is written so r may
+// be a
+void bigint_mul_i64(bigint_t *r, const bigint_t *a, long long value) {
+    uint64_t mag = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    uint64_t lo = (uint32_t)mag;
+    uint64_t hi = mag >> 32;
+    int neg = a->neg != (value < 0);
+    int len = a->len;
+    uint64_t carry = 0;
+    uint32_t prev = 0;
+
+    if (len == 0 || mag == 0) {
+        r->len = 0;
+        r->neg = 0;
+        return;
+    }
+    reserve(r, len + 2);
+    // Limb i of the product is a[i] * lo + a[i - 1] * hi plus the carry,
+    // below 2^66 so it fits the 128 bit sum
+    for (int i = 0; i < len; i++) {
+        uint32_t ai = a->limb[i];
+        unsigned __int128 t = (unsigned __int128)ai * lo + (unsigned __int128)prev * hi + carry;
+        r->limb[i] = (uint32_t)t;
+        carry = (uint64_t)(t >> 32);
+        prev = ai;
+    }
+    carry += (uint64_t)prev * hi;
+    r->limb[len] = (uint32_t)carry;
+    r->limb[len + 1] = (uint32_t)(carry >> 32);
+    r->len = len + 2;
+    r->neg = neg;
+    normalize(r);
+}
+
+// Quotient of magnitudes, Knuth's algorithm D (TAOCP 4.3.1) on 32 bit
+// digits. q receives ulen - vlen + 1 limbs, the remainder is dropped
+static void mag_div(uint32_t *q, const uint32_t *u, int ulen, const uint32_t *v, int vlen) {
+    const uint64_t base = 1ULL << 32;
+
+    if (vlen == 1) {
+        uint64_t d = v[0];
+        uint64_t rem = 0;
+        for (int i = ulen - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | u[i];
+            q[i] = (uint32_t)(cur / d);
+            rem = cur % d;
+        }
+        return;
+    }
+
+    // Normalize so the top divisor digit has its high bit set. Both
+    // normalized copies are taken before q is written, so q may be u or v
+    int s = __builtin_clz(v[vlen - 1]);
+    uint32_t stack[STACK_LIMBS];
+    uint32_t *vn = ulen + vlen + 1 <= STACK_LIMBS ? stack : (uint32_t *)malloc((ulen + vlen + 1) * sizeof(uint32_t));
+    uint32_t *un = vn + vlen;
+    for (int i = vlen - 1; i > 0; i--) {
+        vn[i] = (v[i] << s) | (s ? (uint32_t)((uint64_t)v[i - 1] >> (32 - s)) : 0);
+    }
+    vn[0] = v[0] << s;
+    un[ulen] = s ? (uint32_t)((uint64_t)u[ulen - 1] >> (32 - s)) : 0;
+    for (int i = ulen - 1; i > 0; i--) {
+        un[i] = (u[i] << s) | (s ? (uint32_t)((uint64_t)u[i - 1] >> (32 - s)) : 0);
+    }
+    un[0] = u[0] << s;
+
+    for (int j = ulen - vlen; j >= 0; j--) {
+        uint64_t num = ((uint64_t)un[j + vlen] << 32) | un[j + vlen - 1];
+        uint64_t qhat = num / vn[vlen - 1];
+        uint64_t rhat = num % vn[vlen - 1];
+        while (qhat >= base || qhat * vn[vlen - 2] > ((rhat << 32) | un[j + vlen - 2])) {
+            qhat -= 1;
+            rhat += vn[vlen - 1];
+            if (rhat >= base) {
+                break;
+            }
+        }
+
+        // Multiply and subtract qhat * vn from the current window of un
+        int64_t borrow = 0;
+        int64_t t;
+        for (int i = 0; i < vlen; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - borrow - (int64_t)(p & 0xFFFFFFFFULL);
+            un[i + j] = (uint32_t)t;
+            borrow = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + vlen] - borrow;
+        un[j + vlen] = (uint32_t)t;
+
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            // qhat was one too big, add the divisor back
+            uint64_t carry = 0;
+            q[j] -= 1;
+            for (int i = 0; i < vlen; i++) {
+                uint64_t sum = (uint64_t)un[i + j] + vn[i] + carry;
+                un[i + j] = (uint32_t)sum;
+                carry = sum >> 32;
+            }
+            un[j + vlen] += (uint32_t)carry;
+        }
+    }
+    if (vn != stack) {
+        free(vn);
+    }
+}
+
+// Truncated quotient a / b, meant for divisions known to be exact. The
+// quotient is written into q's own limbs, q may alias a or b
+void bigint_divexact(bigint_t *q, const bigint_t *a, const bigint_t *b) {
+    int neg = a->neg != b->neg;
+    int len;
+
+    if (b->len == 0) {
+        fprintf(stderr, "bigint_divexact: division by zero\n");
+        exit(EXIT_FAILURE);
+    }
+    if (mag_cmp(a, b) < 0) {
+        q->len = 0;
+        q->neg = 0;
+        return;
+    }
+    len = a->len - b->len + 1;
+    reserve(q, len);
+    mag_div(q->limb, a->limb, a->len, b->limb, b->len);
+    q->len = len;
+    q->neg = neg;
+    normalize(q);
+}
+
+// Decimal representation, caller frees
+char *bigint_to_string(const bigint_t *b) {
+    // Every limb adds less than 10 decimal digits
+    int max_digits = b->len * 10 + 2;
+    char *str = (char *)malloc(max_digits + 1);
+    char *p = str + max_digits;
+    uint32_t *tmp = (uint32_t *)malloc((b->len + 1) * sizeof(uint32_t));
+    int len = b->len;
+
+    *p = '\0';
+    memcpy(tmp, b->limb, len * sizeof(uint32_t));
+    if (len == 0) {
+        *--p = '0';
+    }
+    while (len > 0) {
+        // Peel off nine decimal digits at a time
+        uint64_t rem = 0;
+        for (int i = len - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | tmp[i];
+            tmp[i] = (uint32_t)(cur / 1000000000u);
+            rem = cur % 1000000000u;
+        }
+        while (len > 0 && tmp[len - 1] == 0) {
+            len -= 1;
+        }
+        for (int d = 0; d < 9 && (len > 0 || rem > 0); d++) {
+            *--p = (char)('0' + rem % 10);
+            rem /= 10;
+        }
+    }
+    if (b->neg) {
+        *--p = '-';
+    }
+    memmove(str, p, strlen(p) + 1);
+    free(tmp);
+    return str;
+}
@@ -0,0 +1,31 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <stdint.h>
+
+typedef struct bigint_st bigint_t;
+
+// Arbitrary precision integer, sign and magnitude. Limbs are 32 bits,
+// least significant first, without leading zero limbs (zero has len 0)
+struct bigint_st {
+    int neg;
+    int len;
+    int cap;
+    uint32_t *limb;
+};
+
+void bigint_init(bigint_t *b);
+void bigint_free(bigint_t *b);
+void bigint_set_i64(bigint_t *b, long long value);
+void bigint_set_i128(bigint_t *b, __int128 value);
+void bigint_copy(bigint_t *dst, const bigint_t *src);
+int bigint_is_zero(const bigint_t *b);
+void bigint_neg(bigint_t *b);
+void bigint_add(bigint_t *r, const bigint_t *a, const bigint_t *b);
+void bigint_sub(bigint_t *r, const bigint_t *a, const bigint_t *b);
+void bigint_mul(bigint_t *r, const bigint_t *a, const bigint_t *b);
+void bigint_mul_i64(bigint_t *r, const bigint_t *a, long long value);
+void bigint_divexact(bigint_t *q, const bigint_t *a, const bigint_t *b);
+char *bigint_to_string(const bigint_t *b);
+
+#endif
@@ -0,0 +1,244 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <binfmt.h>
+
+_Static_assert(sizeof(binary_header_t) == BINARY_HEADER_SIZE, "binary header must be 64 bytes");
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_ENDIAN BINARY_LITTLE_ENDIAN
+#define TO_LE32(x) (x)
+#define TO_LE64(x) (x)
+#else
+#define HOST_ENDIAN BINARY_BIG_ENDIAN
+#define TO_LE32(x) __builtin_bswap32(x)
+#define TO_LE64(x) __builtin_bswap64(x)
+#endif
+
+
+static int stride_for(int n) {
+    return (n + BINARY_ROW_ALIGN - 1) / BINARY_ROW_ALIGN * BINARY_ROW_ALIGN;
+}
+
+int is_binary_matrix(const void *buf, size_t len) {
+    return len >= 4 && memcmp(buf, BINARY_MAGIC, 4) == 0;
+}
+
+int is_binary_file(const char *filename) {
+    char magic[4];
+    FILE *stream = fopen(filename, "rb");
+    int binary = 0;
+    if (stream != NULL) {
+        binary = fread(magic, 1, 4, stream) == 4 && is_binary_matrix(magic, 4);
+        fclose(stream);
+    }
+    return binary;
+}
+
+// Bytes taken by one matrix record, header included
+size_t binary_matrix_size(int n) {
+    return BINARY_HEADER_SIZE + (size_t)n * stride_for(n) * sizeof(int32_t);
+}
+
+static void binary_error(const char *name, const char *msg) {
+    fprintf(stderr, "%s: %s\n", name, msg);
+}
+
+// Checks the record in buf and returns its rows, header receives the
+// fields in host order. Errors are reported, NULL is returned
+static int32_t *binary_data(void *buf, size_t len, const char *name, binary_header_t *out) {
+    binary_header_t header;
+    size_t data_len;
+    int32_t *data;
+
+    if (len < BINARY_HEADER_SIZE || !is_binary_matrix(buf, len)) {
+        binary_error(name, "not a binary matrix");
+        return NULL;
+    }
+    memcpy(&header, buf, sizeof(header));
+    header.n = TO_LE32(header.n);
+    header.stride = TO_LE32(header.stride);
+    header.checksum = TO_LE64(header.checksum);
+    if (header.version != BINARY_VERSION) {
+        binary_error(name, "unsupported binary format version");
+        return NULL;
+    }
+    if (header.endian != BINARY_LITTLE_ENDIAN || header.elem_size != sizeof(int32_t)) {
+        binary_error(name, "only little endian 32 bit entries are supported");
+        return NULL;
+    }
+    if (header.n == 0 || header.n > INT32_MAX / BINARY_ROW_ALIGN || header.stride < header.n ||
+            header.stride % BINARY_ROW_ALIGN != 0) {
+        binary_error(name, "corrupt header");
+        return NULL;
+    }
+    data_len = (size_t)header.n * header.stride * sizeof(int32_t);
+    if (len - BINARY_HEADER_SIZE < data_len) {
+        binary_error(name, "truncated matrix data");
+        return NULL;
+    }
+    data = (int32_t *)((char *)buf + BINARY_HEADER_SIZE);
+    if ((header.flags & BINARY_CHECKSUM) && hash_bytes(data, data_len, 0) != header.checksum) {
+        binary_error(name, "checksum mismatch");
+        return NULL;
+    }
+    *out = header;
+    return data;
+}
+
+// Matrix whose rows live in buf right after the header. On little endian
+// hosts nothing is copied and buf has to stay mapped as long as the
+// matrix is used; big endian hosts get a swapped copy in the arena
+matrix_t *load_binary_matrix(void *buf, size_t len, const char *name, arena_t *arena, size_t *consumed) {
+    binary_header_t header;
+    matrix_t *matrix;
+    size_t data_len;
+    int32_t *data;
+
+    if ((data = binary_data(buf, len, name, &header)) == NULL) {
+        return NULL;
+    }
+    data_len = (size_t)header.n * header.stride * sizeof(int32_t);
+    matrix = (matrix_t *)arena_alloc(arena, sizeof(matrix_t));
+    matrix->n = header.n;
+    matrix->stride = header.stride;
+    if (HOST_ENDIAN == BINARY_LITTLE_ENDIAN) {
+        matrix->data = data;
+    }
+    else {
+        matrix->data = (int *)arena_alloc(arena, data_len);
+        for (size_t i = 0; i < data_len / sizeof(int32_t); i++) {
+            matrix->data[i] = (int)TO_LE32((uint32_t)data[i]);
+        }
+    }
+    if (consumed != NULL) {
+        *consumed = BINARY_HEADER_SIZE + data_len;
+    }
+    return matrix;
+}
+
+// Scatter the record straight into the next slot of lanes, swapping bytes
+// on the way on big endian hosts. Returns 1 when it was added, 0 when it
+// does not fit lanes (size, room or bound) and -1 after reporting an error
+int load_binary_lanes(void *buf, size_t len, const char *name, small_lanes_t *lanes) {
+    binary_header_t header;
+    int32_t *data;
+    int32_t *slot;
+
+    if ((data = binary_data(buf, len, name, &header)) == NULL) {
+        return -1;
+    }
+    if ((slot = small_lanes_start(lanes, (int)header.n)) == NULL) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < header.n; i++) {
+        for (uint32_t j = 0; j < header.n; j++) {
+            slot[(i * header.n + j) * SMALL_LANES] = (int32_t)TO_LE32((uint32_t)data[(size_t)i * header.stride + j]);
+        }
+    }
+    return small_lanes_commit(lanes);
+}
+
+void write_binary_matrix(const matrix_t *matrix, FILE *stream, int checksum) {
+    binary_header_t header;
+    int n = matrix->n;
+    int stride = stride_for(n);
+    size_t data_len = (size_t)n * stride * sizeof(int32_t);
+    int32_t *data = (int32_t *)calloc((size_t)n * stride, sizeof(int32_t));
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            data[(long)i * stride + j] = (int32_t)TO_LE32((uint32_t)MAT(matrix, i, j));
+        }
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, 4);
+    header.version = BINARY_VERSION;
+    header.endian = BINARY_LITTLE_ENDIAN;
+    header.elem_size = sizeof(int32_t);
+    header.flags = checksum ? BINARY_CHECKSUM : 0;
+    header.n = TO_LE32((uint32_t)n);
+    header.stride = TO_LE32((uint32_t)stride);
+    header.checksum = checksum ? TO_LE64(hash_bytes(data, data_len, 0)) : 0;
+
+    if (fwrite(&header, sizeof(header), 1, stream) != 1 || fwrite(data, 1, data_len, stream) != data_len) {
+        perror("fwrite");
+        exit(EXIT_FAILURE);
+    }
+    free(data);
+}
+
+// Same layout form__square_matrix reads, one row per line
+void write_text_matrix(const matrix_t *matrix, FILE *stream) {
+    for (int i = 0; i < matrix->n; i++) {
+        for (int j = 0; j < matrix->n; j++) {
+            fprintf(stream, j == 0 ? "%i" : " %i", MAT(matrix, i, j));
+        }
+        fputc('\n', stream);
+    }
+}
+
+static void convert_usage(char *program) {
+    fprintf(stderr, "Usage: %s convert [--to-text|--to-binary] [--no-checksum] <input> <output>\n", program);
+    fprintf(stderr, "  Text input is written as binary and binary input as text unless a\n");
+    fprintf(stderr, "  direction is given, output - means stdout\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant convert: translate between the text and binary formats
+int convert_main(int argc, char **argv) {
+    int to_binary = -1;
+    int checksum = 1;
+    int opt;
+    arena_t arena;
+    matrix_t *matrix;
+    FILE *out;
+
+    static struct option long_options[] = {
+        {"to-text", no_argument, 0, 'T'},
+        {"to-binary", no_argument, 0, 'B'},
+        {"no-checksum", no_argument, 0, 'N'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'T':
+                to_binary = 0;
+                break;
+            case 'B':
+                to_binary = 1;
+                break;
+            case 'N':
+                checksum = 0;
+                break;
+            default:
+                convert_usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2) {
+        convert_usage(argv[0]);
+    }
+
+    if (to_binary < 0) {
+        to_binary = !is_binary_file(argv[optind]);
+    }
+    arena_init(&arena);
+    matrix = form__square_matrix(argv[optind], &arena);
+    out = strcmp(argv[optind + 1], "-") == 0 ? stdout : open_file(argv[optind + 1], to_binary ? "wb" : "w");
+    if (to_binary) {
+        write_binary_matrix(matrix, out, checksum);
+    }
+    else {
+        write_text_matrix(matrix, out);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    arena_release(&arena);
+    return EXIT_SUCCESS;
+}
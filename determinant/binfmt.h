@@ -0,0 +1,45 @@
+#ifndef BINFMT_H
+#define BINFMT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <matrix.h>
+#include <small.h>
+
+#define BINARY_MAGIC "DETM"
+#define BINARY_VERSION 1
+#define BINARY_LITTLE_ENDIAN 1
+#define BINARY_BIG_ENDIAN 2
+#define BINARY_CHECKSUM 1
+#define BINARY_HEADER_SIZE 64
+// Rows are padded to whole 64 byte lines
+#define BINARY_ROW_ALIGN 16
+
+typedef struct binary_header_st binary_header_t;
+
+// Fixed 64 byte header in front of n rows of stride little endian int32,
+// so a mapped file starts its data on a cache line (pages are aligned)
+struct binary_header_st {
+    char magic[4];
+    uint8_t version;
+    uint8_t endian;
+    uint8_t elem_size;
+    uint8_t flags;
+    uint32_t n;
+    uint32_t stride;
+    // hash_bytes of the whole data area, valid with BINARY_CHECKSUM
+    uint64_t checksum;
+    uint8_t reserved[40];
+};
+
+int is_binary_matrix(const void *buf, size_t len);
+int is_binary_file(const char *filename);
+size_t binary_matrix_size(int n);
+matrix_t *load_binary_matrix(void *buf, size_t len, const char *name, arena_t *arena, size_t *consumed);
+int load_binary_lanes(void *buf, size_t len, const char *name, small_lanes_t *lanes);
+void write_binary_matrix(const matrix_t *matrix, FILE *stream, int checksum);
+void write_text_matrix(const matrix_t *matrix, FILE *stream);
+int convert_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,387 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cache.h>
+
+#define CACHE_BUCKETS (1 << 16)
+#define CACHE_STRIPES 64
+// A cache file grows by this much whenever its value area is full
+#define CACHE_FILE_GROWTH (1 << 20)
+#define CACHE_SEED_HI 0x243F6A8885A308D3ULL
+#define CACHE_SEED_LO 0x13198A2E03707344ULL
+
+typedef struct cache_entry_st cache_entry_t;
+typedef struct cache_file_header_st cache_file_header_t;
+typedef struct cache_slot_st cache_slot_t;
+typedef struct cache_blob_st cache_blob_t;
+
+// A stored determinant: the width it was computed in, then sign and
+// magnitude limbs as in bigint_t. Entries in memory and values in the
+// file both hold exactly this
+struct cache_blob_st {
+    uint8_t width;
+    uint8_t neg;
+    uint16_t reserved;
+    uint32_t len;
+    uint32_t limb[];
+};
+
+struct cache_entry_st {
+    cache_entry_t *next;
+    cache_key_t key;
+    cache_blob_t blob;
+};
+
+// Cache file: this header, an open addressing table of slots, then the
+// values the slots point to. It is shared between processes, flock
+// guards every access and the mapping follows the file as it grows
+struct cache_file_header_st {
+    char magic[4];
+    uint32_t version;
+    uint64_t slots;
+    uint64_t used;
+    uint64_t size;
+};
+
+// offset is 0 for a free slot
+struct cache_slot_st {
+    cache_key_t key;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct cache_st {
+    int minors;
+    cache_entry_t **buckets;
+    pthread_mutex_t stripes[CACHE_STRIPES];
+    atomic_long bytes;
+    atomic_long hits[2];
+    atomic_long misses[2];
+    int fd;
+    char *map;
+    size_t map_len;
+    pthread_mutex_t file_lock;
+};
+
+cache_t *result_cache = NULL;
+
+
+static size_t blob_size(uint32_t len) {
+    return sizeof(cache_blob_t) + len * sizeof(uint32_t);
+}
+
+// Encoded det, caller frees
+static cache_blob_t *blob_encode(const det_t *det, size_t *size) {
+    cache_blob_t *blob;
+    bigint_t value;
+
+    bigint_init(&value);
+    det_to_bigint(det, &value);
+    *size = blob_size(value.len);
+    blob = (cache_blob_t *)malloc(*size);
+    blob->width = det->width;
+    blob->neg = value.neg;
+    blob->reserved = 0;
+    blob->len = value.len;
+    if (value.len > 0) {
+        memcpy(blob->limb, value.limb, value.len * sizeof(uint32_t));
+    }
+    bigint_free(&value);
+    return blob;
+}
+
+// Stored value in the requested width. A value stored as a big integer
+// fits any narrower width a caller asks for, since the caller's bound
+// holds for the same determinant
+static void blob_decode(const cache_blob_t *blob, int width, det_t *det) {
+    if (width == CACHE_ANY_WIDTH) {
+        width = blob->width;
+    }
+    if (width == DET_BIG || blob->len > 4) {
+        bigint_t value = { .neg = blob->neg, .len = blob->len, .cap = blob->len, .limb = (uint32_t *)blob->limb };
+        det_set_big(det, &value);
+    }
+    else {
+        unsigned __int128 mag = 0;
+        for (int i = blob->len - 1; i >= 0; i--) {
+            mag = mag << 32 | blob->limb[i];
+        }
+        det_set_i128(det, blob->neg ? -(__int128)mag : (__int128)mag, width);
+    }
+}
+
+// Map the file as it is now, after another process may have grown it
+static void file_remap(cache_t *cache) {
+    struct stat st;
+    if (fstat(cache->fd, &st) < 0) {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size == cache->map_len) {
+        return;
+    }
+    if (cache->map != NULL) {
+        munmap(cache->map, cache->map_len);
+    }
+    cache->map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (cache->map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    cache->map_len = st.st_size;
+}
+
+static cache_slot_t *file_slots(const cache_t *cache) {
+    return (cache_slot_t *)(cache->map + sizeof(cache_file_header_t));
+}
+
+// Slot holding key, or the free slot where it would go
+static cache_slot_t *file_probe(const cache_t *cache, cache_key_t key) {
+    cache_file_header_t *header = (cache_file_header_t *)cache->map;
+    cache_slot_t *slots = file_slots(cache);
+    uint64_t mask = header->slots - 1;
+    for (uint64_t i = key.lo & mask;; i = (i + 1) & mask) {
+        cache_slot_t *slot = &slots[i];
+        if (slot->offset == 0 || (slot->key.hi == key.hi && slot->key.lo == key.lo)) {
+            return slot;
+        }
+    }
+}
+
+static void file_open(cache_t *cache, const char *filename) {
+    cache_file_header_t *header;
+    struct stat st;
+
+    if ((cache->fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0 || fstat(cache->fd, &st) < 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    flock(cache->fd, LOCK_EX);
+    if (fstat(cache->fd, &st) == 0 && st.st_size == 0) {
+        size_t size = sizeof(cache_file_header_t) + CACHE_FILE_SLOTS * sizeof(cache_slot_t);
+        if (ftruncate(cache->fd, size + CACHE_FILE_GROWTH) < 0) {
+            perror(filename);
+            exit(EXIT_FAILURE);
+        }
+        file_remap(cache);
+        header = (cache_file_header_t *)cache->map;
+        memcpy(header->magic, CACHE_FILE_MAGIC, 4);
+        header->version = CACHE_FILE_VERSION;
+        header->slots = CACHE_FILE_SLOTS;
+        header->used = 0;
+        header->size = size;
+    }
+    else {
+        file_remap(cache);
+        header = (cache_file_header_t *)cache->map;
+        if (cache->map_len < sizeof(cache_file_header_t) || memcmp(header->magic, CACHE_FILE_MAGIC, 4) != 0 ||
+            header->version != CACHE_FILE_VERSION) {
+            fprintf(stderr, "%s: not a cache file\n", filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    flock(cache->fd, LOCK_UN);
+}
+
+static int file_get(cache_t *cache, cache_key_t key, int width, det_t *det) {
+    cache_slot_t *slot;
+    int found = 0;
+
+    pthread_mutex_lock(&cache->file_lock);
+    flock(cache->fd, LOCK_SH);
+    file_remap(cache);
+    slot = file_probe(cache, key);
+    if (slot->offset != 0) {
+        blob_decode((const cache_blob_t *)(cache->map + slot->offset), width, det);
+        found = 1;
+    }
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->file_lock);
+    return found;
+}
+
+static void file_put(cache_t *cache, cache_key_t key, const cache_blob_t *blob, size_t size) {
+    cache_file_header_t *header;
+    cache_slot_t *slot;
+    size_t length = (size + 7) & ~(size_t)7;
+
+    pthread_mutex_lock(&cache->file_lock);
+    flock(cache->fd, LOCK_EX);
+    file_remap(cache);
+    header = (cache_file_header_t *)cache->map;
+    slot = file_probe(cache, key);
+    if (slot->offset == 0 && header->used * 2 < header->slots) {
+        if (header->size + length > cache->map_len) {
+            size_t grow = length > CACHE_FILE_GROWTH ? length : CACHE_FILE_GROWTH;
+            if (ftruncate(cache->fd, cache->map_len + grow) < 0) {
+                perror("ftruncate");
+                exit(EXIT_FAILURE);
+            }
+            file_remap(cache);
+            header = (cache_file_header_t *)cache->map;
+            slot = file_probe(cache, key);
+        }
+        memcpy(cache->map + header->size, blob, size);
+        slot->key = key;
+        slot->length = size;
+        slot->offset = header->size;
+        header->size += length;
+        header->used += 1;
+    }
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->file_lock);
+}
+
+// In-memory table only, a key already there is left as it is
+static void memory_put(cache_t *cache, cache_key_t key, const cache_blob_t *blob, size_t size) {
+    long bucket = (key.lo >> 16) & (CACHE_BUCKETS - 1);
+    pthread_mutex_t *lock = &cache->stripes[bucket % CACHE_STRIPES];
+    cache_entry_t *entry;
+
+    if (atomic_load(&cache->bytes) + (long)size > CACHE_MAX_BYTES) {
+        return;
+    }
+    pthread_mutex_lock(lock);
+    for (entry = cache->buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (entry->key.hi == key.hi && entry->key.lo == key.lo) {
+            pthread_mutex_unlock(lock);
+            return;
+        }
+    }
+    entry = (cache_entry_t *)malloc(sizeof(cache_entry_t) - sizeof(cache_blob_t) + size);
+    entry->key = key;
+    memcpy(&entry->blob, blob, size);
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    atomic_fetch_add(&cache->bytes, size);
+    pthread_mutex_unlock(lock);
+}
+
+// filename is NULL for a cache that lives in memory only. Minors are
+// never written to the file, they are cheap next to the input they came
+// from and would crowd out whole results
+cache_t *cache_create(const char *filename, int minors) {
+    cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
+    cache->minors = minors;
+    cache->fd = -1;
+    cache->buckets = (cache_entry_t **)calloc(CACHE_BUCKETS, sizeof(cache_entry_t *));
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        pthread_mutex_init(&cache->stripes[i], NULL);
+    }
+    pthread_mutex_init(&cache->file_lock, NULL);
+    if (filename != NULL) {
+        file_open(cache, filename);
+    }
+    return cache;
+}
+
+void cache_destroy(cache_t *cache) {
+    for (long b = 0; b < CACHE_BUCKETS; b++) {
+        cache_entry_t *entry = cache->buckets[b];
+        while (entry != NULL) {
+            cache_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    for (int i = 0; i < CACHE_STRIPES; i++) {
+        pthread_mutex_destroy(&cache->stripes[i]);
+    }
+    if (cache->fd >= 0) {
+        munmap(cache->map, cache->map_len);
+        close(cache->fd);
+    }
+    pthread_mutex_destroy(&cache->file_lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+int cache_wants_minor(const cache_t *cache, int n) {
+    return cache != NULL && cache->minors && n >= CACHE_MIN_MINOR;
+}
+
+cache_key_t cache_key_view(const view_t *view) {
+    int n = view->n;
+    int row[n > 0 ? n : 1];
+    cache_key_t key;
+
+    key.hi = hash_bytes(&n, sizeof(n), CACHE_SEED_HI);
+    key.lo = hash_bytes(&n, sizeof(n), CACHE_SEED_LO);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            row[j] = VIEW(view, i, j);
+        }
+        key.hi = hash_bytes(row, n * sizeof(int), key.hi);
+        key.lo = hash_bytes(row, n * sizeof(int), key.lo);
+    }
+    return key;
+}
+
+// Same key as the identity view, without copying the rows
+cache_key_t cache_key_matrix(const matrix_t *matrix) {
+    int n = matrix->n;
+    cache_key_t key;
+
+    key.hi = hash_bytes(&n, sizeof(n), CACHE_SEED_HI);
+    key.lo = hash_bytes(&n, sizeof(n), CACHE_SEED_LO);
+    for (int i = 0; i < n; i++) {
+        key.hi = hash_bytes(&MAT(matrix, i, 0), n * sizeof(int), key.hi);
+        key.lo = hash_bytes(&MAT(matrix, i, 0), n * sizeof(int), key.lo);
+    }
+    return key;
+}
+
+// Look key up in memory, then in the file. A file hit is copied into
+// memory so the next lookup does not touch the file
+int cache_get(cache_t *cache, cache_key_t key, int width, det_t *det, int minor) {
+    long bucket = (key.lo >> 16) & (CACHE_BUCKETS - 1);
+    pthread_mutex_t *lock = &cache->stripes[bucket % CACHE_STRIPES];
+
+    pthread_mutex_lock(lock);
+    for (cache_entry_t *entry = cache->buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (entry->key.hi == key.hi && entry->key.lo == key.lo) {
+            blob_decode(&entry->blob, width, det);
+            pthread_mutex_unlock(lock);
+            atomic_fetch_add(&cache->hits[minor], 1);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(lock);
+
+    if (!minor && cache->fd >= 0 && file_get(cache, key, width, det)) {
+        size_t size;
+        cache_blob_t *blob = blob_encode(det, &size);
+        memory_put(cache, key, blob, size);
+        free(blob);
+        atomic_fetch_add(&cache->hits[minor], 1);
+        return 1;
+    }
+    atomic_fetch_add(&cache->misses[minor], 1);
+    return 0;
+}
+
+void cache_put(cache_t *cache, cache_key_t key, const det_t *det, int minor) {
+    size_t size;
+    cache_blob_t *blob = blob_encode(det, &size);
+    memory_put(cache, key, blob, size);
+    if (!minor && cache->fd >= 0) {
+        file_put(cache, key, blob, size);
+    }
+    free(blob);
+}
+
+void cache_print_counters(const cache_t *cache, FILE *stream) {
+    fprintf(stream, "Cache: %li hits, %li misses\n", atomic_load(&cache->hits[0]), atomic_load(&cache->misses[0]));
+    if (cache->minors) {
+        fprintf(stream, "Minor cache: %li hits, %li misses\n", atomic_load(&cache->hits[1]),
+                atomic_load(&cache->misses[1]));
+    }
+}
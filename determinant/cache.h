@@ -0,0 +1,46 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <matrix.h>
+#include <result.h>
+
+// Result caching is keyed by content: two 64 bit hashes of n and the
+// entries row by row, the same for a matrix and for any view with equal
+// entries. Keys are compared, entries never are, so a hit trusts the
+// 128 bit hash
+#define CACHE_FILE_MAGIC "DETC"
+#define CACHE_FILE_VERSION 1
+// Slots of a new cache file, it stops taking entries at half of them
+#define CACHE_FILE_SLOTS (1 << 16)
+// Memory the in-memory table may hold, later entries are not kept
+#define CACHE_MAX_BYTES (256L << 20)
+// Smallest minor worth a lookup, below this hashing costs more than
+// the expansion it would save
+#define CACHE_MIN_MINOR 6
+// Width argument of cache_get taking the result as it was stored
+#define CACHE_ANY_WIDTH -1
+
+typedef struct cache_st cache_t;
+typedef struct cache_key_st cache_key_t;
+
+struct cache_key_st {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+// Cache in use by compute_determinant and laplace_expansion, NULL when off
+extern cache_t *result_cache;
+
+cache_t *cache_create(const char *filename, int minors);
+void cache_destroy(cache_t *cache);
+int cache_wants_minor(const cache_t *cache, int n);
+cache_key_t cache_key_view(const view_t *view);
+cache_key_t cache_key_matrix(const matrix_t *matrix);
+int cache_get(cache_t *cache, cache_key_t key, int width, det_t *det, int minor);
+void cache_put(cache_t *cache, cache_key_t key, const det_t *det, int minor);
+void cache_print_counters(const cache_t *cache, FILE *stream);
+
+#endif
@@ -1,81 +1,398 @@
 #define _REENTRANT
+#define _GNU_SOURCE
 
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#include <determinant.h>
+#include <binfmt.h>
+#include <kernels.h>
+#include <serve.h>
+#include <cache.h>
+#include <small.h>
+#include <shard.h>
+#include <session.h>
+#include <factor.h>
 
 #define TRUE 1
 
-typedef struct arg_struct {
-    int **matrix;
-    int n;
-    int det;
-} arguments;
+// Minors of this size or smaller are expanded inline by the task
+// that reached them instead of being handed to the pool
+#define DEFAULT_INLINE_CUTOFF 6
+// Largest matrix --check recomputes with the O(n!) Laplace expansion
+#define CHECK_MAX_N 10
+
+void usage(char *);
+int check_determinant(const job_t *);
+void print_stats(const pool_stats_t *, double, double, double, double, double, int);
+static void numa_replicate(const matrix_t *);
+static void numa_release();
 
-FILE *open_file(char *, char *);
-int get_matrix_size(FILE *);
-int **form__square_matrix(FILE *, int);
-void print_matrix(int **, int);
-void print_pointer_matrix(int ***, int);
-int rule_of_sarrus(int **, int, int);
-int **form_minor(int **, int, int, int);
-void *laplace_expansion(void *);
+pool_t *pool;
+int inline_cutoff = DEFAULT_INLINE_CUTOFF;
+
+// --numa on more than one node: a copy of the input matrix per node, see
+// local_matrix
+static const matrix_t *numa_source;
+static matrix_t *numa_copies;
+static int numa_nodes;
 
 
 int main(int argc, char **argv) {
 
-    FILE *stream;
     int n;
-    int **matrix;
-    int **minor;
+    int quiet = 0;
+    int check = 0;
+    int scalar = 0;
+    int stats = 0;
+    int real = 0;
+    int logdet = 0;
+    int cache = 0;
+    int cache_minors = 0;
+    int processes = 0;
+    int threads_set = 0;
+    int perm = 0;
+    int placement = 0;
+    const char *cache_file = NULL;
+    double parse_start;
+    double compute_start;
+    double parse_ms;
+    double compute_ms;
+    double output_ms;
+    double create_ms;
+    double join_ms;
+    pool_stats_t totals;
+    matrix_t *matrix = NULL;
+    csr_t *sparse = NULL;
+    rmatrix_t *real_matrix = NULL;
+    arena_t arena;
+    int threads = default_thread_count();
+    int algo = ALGO_LAPLACE;
+    int opt;
+
+    if (argc > 1 && strcmp(argv[1], "convert") == 0) {
+        return convert_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return batch_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "client") == 0) {
+        return client_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "session") == 0) {
+        return session_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "factor") == 0) {
+        return factor_main(argc - 1, argv + 1);
+    }
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"cutoff", required_argument, 0, 'c'},
+        {"algo", required_argument, 0, 'a'},
+        {"quiet", no_argument, 0, 'q'},
+        {"check", no_argument, 0, 'k'},
+        {"scalar", no_argument, 0, 's'},
+        {"stats", no_argument, 0, 'S'},
+        {"real", no_argument, 0, 'r'},
+        {"logdet", no_argument, 0, 'l'},
+        {"cache", no_argument, 0, 'C'},
+        {"cache-file", required_argument, 0, 'F'},
+        {"cache-minors", no_argument, 0, 'M'},
+        {"processes", required_argument, 0, 'P'},
+        {"permanent", no_argument, 0, 'p'},
+        {"pin", no_argument, 0, 'A'},
+        {"numa", no_argument, 0, 'N'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "t:c:a:qksSrlCF:MP:pANh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    fprintf(stderr, "Number of threads must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                threads_set = 1;
+                break;
+            case 'c':
+                inline_cutoff = atoi(optarg);
+                break;
+            case 'a':
+                if ((algo = parse_algo(optarg)) < 0) {
+                    fprintf(stderr, "Unknown algorithm: %s\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'k':
+                check = 1;
+                break;
+            case 's':
+                scalar = 1;
+                break;
+            case 'S':
+                stats = 1;
+                break;
+            case 'r':
+                real = 1;
+                break;
+            case 'l':
+                // A log-determinant only makes sense in floating point
+                real = 1;
+                logdet = 1;
+                break;
+            case 'C':
+                cache = 1;
+                break;
+            case 'F':
+                cache = 1;
+                cache_file = optarg;
+                break;
+            case 'M':
+                cache = 1;
+                cache_minors = 1;
+                break;
+            case 'p':
+                perm = 1;
+                break;
+            case 'A':
+                placement |= POOL_PIN;
+                break;
+            case 'N':
+                placement |= POOL_NUMA;
+                break;
+            case 'P':
+                processes = atoi(optarg);
+                if (processes < 1) {
+                    fprintf(stderr, "Number of processes must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    if (processes > 0 && real) {
+        fprintf(stderr, "--processes does not apply to --real\n");
+        exit(EXIT_FAILURE);
+    }
+    if (placement != 0 && processes > 0) {
+        fprintf(stderr, "--pin and --numa do not apply to --processes\n");
+        exit(EXIT_FAILURE);
+    }
+    if (perm && (real || processes > 0 || algo != ALGO_LAPLACE)) {
+        fprintf(stderr, "--permanent takes no --real, --processes or --algo\n");
         exit(EXIT_FAILURE);
     }
-    stream = open_file(argv[1], "r");
-    n = get_matrix_size(stream);
-    fclose(stream);
-    stream = open_file(argv[1], "r");
-    matrix = form__square_matrix(stream, n);
-    fclose(stream);
-    print_matrix(matrix, n);
-
-    printf("LAPLACE EXPANSION\n");
-    arguments *args = malloc(sizeof(arguments));
-    args->n = n;
-    args->matrix = matrix;
-    int det;
-    pthread_t tid;
-    pthread_create(&tid, NULL, laplace_expansion, (void *) args);
-    pthread_join(tid, &det);
-    printf("Det: %i\n", det);
+    // Cores are split between the worker processes unless told otherwise
+    if (processes > 0 && !threads_set) {
+        threads = threads > processes ? threads / processes : 1;
+    }
+
+    kernels_select(scalar);
+    if (cache) {
+        result_cache = cache_create(cache_file, cache_minors);
+    }
+    arena_init(&arena);
+    parse_start = now_ms();
+    // The sparse engines never see a dense copy of the matrix, except
+    // through the shared segment of --processes
+    if (real) {
+        real_matrix = form_real_matrix(argv[optind], &arena);
+        n = real_matrix->n;
+    }
+    else if (is_sparse_algo(algo) && processes == 0) {
+        sparse = form_sparse_matrix(argv[optind], &arena);
+        n = sparse->n;
+    }
+    else {
+        matrix = form__square_matrix(argv[optind], &arena);
+        n = matrix->n;
+    }
+    parse_ms = now_ms() - parse_start;
+    printf("Matrix size: %i\n", n);
+    if (sparse != NULL) {
+        printf("Nonzeros: %li\n", sparse->nnz);
+    }
+    printf("Parse time: %.3f ms\n", parse_ms);
+    output_ms = now_ms();
+    if (!quiet && real_matrix != NULL) {
+        print_real_matrix(real_matrix);
+    }
+    else if (!quiet && sparse != NULL) {
+        print_sparse_matrix(sparse);
+    }
+    else if (!quiet) {
+        print_matrix(matrix);
+    }
+    output_ms = now_ms() - output_ms;
+
+    create_ms = now_ms();
+    pool = pool_create_placed(threads, placement);
+    if ((placement & POOL_NUMA) && matrix != NULL && processes == 0) {
+        numa_replicate(matrix);
+    }
+    create_ms = now_ms() - create_ms;
+    if (stats) {
+        pool_enable_stats(pool);
+    }
+    job_t job = { .algo = algo, .matrix = matrix, .sparse = sparse, .arena = &arena };
+    lu_job_t lu = { .matrix = real_matrix };
+    task_t task = { .run = job_task, .arg = &job, .pending = NULL };
+    if (real) {
+        task.run = lu_task;
+        task.arg = &lu;
+        printf("BLOCKED LU FACTORIZATION\n");
+    }
+    else if (perm) {
+        task.run = permanent_task;
+        printf("RYSER PERMANENT\n");
+    }
+    else if (algo == ALGO_BAREISS) {
+        printf("BAREISS ELIMINATION\n");
+    }
+    else if (algo == ALGO_SUBSET) {
+        printf("SUBSET LAPLACE EXPANSION\n");
+    }
+    else if (algo == ALGO_MODULAR) {
+        printf("MULTI-MODULAR ELIMINATION\n");
+    }
+    else if (algo == ALGO_SPARSE) {
+        printf("SPARSE MULTI-MODULAR ELIMINATION\n");
+    }
+    else if (algo == ALGO_SPARSE_LAPLACE) {
+        printf("SPARSE LAPLACE EXPANSION\n");
+    }
+    else if (algo == ALGO_RECURSIVE) {
+        printf("RECURSIVE BLOCK LU\n");
+    }
+    else {
+        printf("LAPLACE EXPANSION\n");
+    }
+    if (processes > 0) {
+        printf("Worker processes: %i\n", processes);
+    }
+    if (placement & POOL_NUMA) {
+        printf("NUMA nodes: %i\n", pool_node_count(pool));
+    }
+    det_init(&job.det);
+    compute_start = now_ms();
+    if (processes > 0) {
+        shard_determinant(algo, matrix, processes, threads, &job.det);
+    }
+    else {
+        pool_run(pool, &task);
+    }
+    compute_ms = now_ms() - compute_start;
+    printf("Compute time: %.3f ms\n", compute_ms);
+    double output_start = now_ms();
+    if (logdet) {
+        printf("Sign: %i\n", lu.sign);
+        printf("Log|det|: %.17g\n", lu.logabs);
+    }
+    else if (real) {
+        printf("Det: %.17g\n", lu.sign == 0 ? 0.0 : lu.sign * exp(lu.logabs));
+    }
+    else {
+        char *det = det_to_string(&job.det);
+        printf("%s: %s\n", perm ? "Permanent" : "Det", det);
+        free(det);
+    }
+    output_ms += now_ms() - output_start;
+    printf("Threads created: %i\n", atomic_load(&pool->threads_created));
+    if (result_cache != NULL) {
+        cache_print_counters(result_cache, stdout);
+    }
+    if (check && (real || perm)) {
+        printf("Check: skipped for --%s\n", real ? "real" : "permanent");
+    }
+    else if (check && check_determinant(&job) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    det_free(&job.det);
+    numa_release();
+    pool_collect_stats(pool, &totals);
+    int created = atomic_load(&pool->threads_created);
+    join_ms = now_ms();
+    pool_destroy(pool);
+    join_ms = now_ms() - join_ms;
+    if (stats) {
+        print_stats(&totals, parse_ms, compute_ms, output_ms, create_ms, join_ms, created);
+    }
+    arena_release(&arena);
+    if (result_cache != NULL) {
+        cache_destroy(result_cache);
+    }
 
     exit(EXIT_SUCCESS);
 
 }
 
 
-int get_matrix_size(FILE *stream) {
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    int n = 0;
-    char *token;
-
-    if ((nread = getline(&line, &len, stream)) != -1) {
-        printf("Retrived first row of length %zu (buffer len = %zu)\n", nread, len);
-        fwrite(line, nread, 1, stdout);
-        while ((token = strsep(&line, " "))) {
-            n += 1;
-        }
-        printf("Matrix size: %i\n", n);
-    }
-    return n;
+void usage(char *program) {
+    fprintf(stderr, "Usage: %s [--algo=NAME] [--threads N] [--cutoff N] [--quiet] [--check] [--scalar] [--stats] [--real|--logdet]\n", program);
+    fprintf(stderr, "       [--cache] [--cache-file PATH] [--cache-minors] [--processes N] [--permanent]\n");
+    fprintf(stderr, "       [--pin] [--numa] <file>\n");
+    fprintf(stderr, "       %s batch [--algo=NAME] [--threads N] [--cutoff N] [--scalar] [--cache...] [<file>|-]\n", program);
+    fprintf(stderr, "       %s serve [--socket PATH] [--algo=NAME] [--threads N] [--cutoff N] [--scalar] [--cache...]\n", program);
+    fprintf(stderr, "       %s client [--socket PATH] [--algo=NAME] [--repeat N] <file>...\n", program);
+    fprintf(stderr, "       %s session [--threads N] [--scalar] [<file>|-]\n", program);
+    fprintf(stderr, "       %s factor [--threads N] [--scalar] [--det] [--rank] [--solve RHS]... [--inverse] <file>\n", program);
+    fprintf(stderr, "       %s convert [--to-text|--to-binary] [--no-checksum] <input> <output>\n", program);
+    fprintf(stderr, "  <file> is text or the binary format written by convert\n");
+    fprintf(stderr, "  -a, --algo NAME   laplace (default), bareiss (O(n^3) fraction-free elimination)\n");
+    fprintf(stderr, "                    subset (memoized Laplace expansion, O(n * 2^n)) or modular\n");
+    fprintf(stderr, "                    (elimination modulo 62 bit primes, one per worker, and CRT)\n");
+    fprintf(stderr, "                    sparse (modular elimination on compressed rows with a\n");
+    fprintf(stderr, "                    fill-reducing pivot order) or sparse-laplace (expansion along\n");
+    fprintf(stderr, "                    the sparsest row or column, zero entries skipped) or\n");
+    fprintf(stderr, "                    recursive (cache-oblivious recursive block LU per prime,\n");
+    fprintf(stderr, "                    block operations spread over the pool, for large n)\n");
+    fprintf(stderr, "  -t, --threads N   number of worker threads (default: online cores)\n");
+    fprintf(stderr, "  -c, --cutoff N    minors of size <= N are expanded inline (default: %i)\n",
+            DEFAULT_INLINE_CUTOFF);
+    fprintf(stderr, "  -q, --quiet       do not print the matrix\n");
+    fprintf(stderr, "  -k, --check       compare against the Laplace expansion (n <= %i), or\n", CHECK_MAX_N);
+    fprintf(stderr, "                    Bareiss up to n = %i where Laplace is the small kernels\n", SMALL_MAX_N);
+    fprintf(stderr, "  -s, --scalar      use the scalar elimination kernels instead of AVX2/AVX-512\n");
+    fprintf(stderr, "  -r, --real        read doubles, blocked LU with partial pivoting (no --algo)\n");
+    fprintf(stderr, "  -l, --logdet      like --real, print the sign and log|det| instead of det\n");
+    fprintf(stderr, "  -p, --permanent   compute the permanent instead, Ryser's formula over column\n");
+    fprintf(stderr, "                    subsets in Gray code order, chunks spread over the pool\n");
+    fprintf(stderr, "  -C, --cache       keep results in memory, keyed by a hash of the entries\n");
+    fprintf(stderr, "  -F, --cache-file PATH  also keep results in a memory mapped file across runs\n");
+    fprintf(stderr, "  -M, --cache-minors     cache Laplace minors of size >= %i too\n", CACHE_MIN_MINOR);
+    fprintf(stderr, "  -P, --processes N split the job over N forked worker processes sharing the\n");
+    fprintf(stderr, "                    matrix in SysV shared memory: cofactors of the sparsest row,\n");
+    fprintf(stderr, "                    or ranges of primes for modular and recursive. Shards of a\n");
+    fprintf(stderr, "                    crashed worker are redone, --threads is then per process\n");
+    fprintf(stderr, "  -A, --pin         bind every worker thread to its own core\n");
+    fprintf(stderr, "  -N, --numa        spread the workers evenly over the NUMA nodes, bound to their\n");
+    fprintf(stderr, "                    node and stealing from it first, with a node local copy of\n");
+    fprintf(stderr, "                    the matrix that every dense engine reads. With --pin, one\n");
+    fprintf(stderr, "                    core each\n");
+    fprintf(stderr, "  -S, --stats       report phase times, thread and task counts, minor storage\n");
+    exit(EXIT_FAILURE);
 }
 
+
 FILE *open_file(char *filename, char *mode) {
     FILE *fp;
     fp = fopen(filename, mode);
@@ -86,104 +403,424 @@ FILE *open_file(char *filename, char *mode) {
     return fp;
 }
 
-int **form__square_matrix(FILE *stream, int n) {
-    int **matrix = (int **)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) matrix[i] = (int *)malloc(n * sizeof(int));
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    int row, col;
-    char *token;
-
-    row = 0;
-    while ((nread = getline(&line, &len, stream)) != -1) {
-        col = 0;
-        while ((token = strsep(&line, " "))) {
-            matrix[row][col] = atoi(token); 
-            col += 1;
+int parse_algo(const char *name) {
+    if (strcmp(name, "laplace") == 0) {
+        return ALGO_LAPLACE;
+    }
+    if (strcmp(name, "bareiss") == 0) {
+        return ALGO_BAREISS;
+    }
+    if (strcmp(name, "subset") == 0) {
+        return ALGO_SUBSET;
+    }
+    if (strcmp(name, "modular") == 0) {
+        return ALGO_MODULAR;
+    }
+    if (strcmp(name, "sparse") == 0) {
+        return ALGO_SPARSE;
+    }
+    if (strcmp(name, "sparse-laplace") == 0) {
+        return ALGO_SPARSE_LAPLACE;
+    }
+    if (strcmp(name, "recursive") == 0) {
+        return ALGO_RECURSIVE;
+    }
+    return -1;
+}
+
+int is_sparse_algo(int algo) {
+    return algo == ALGO_SPARSE || algo == ALGO_SPARSE_LAPLACE;
+}
+
+void compute_sparse(int algo, const csr_t *csr, det_t *det) {
+    if (algo == ALGO_SPARSE_LAPLACE) {
+        sparse_laplace(csr, det);
+    }
+    else {
+        sparse_determinant(csr, det);
+    }
+}
+
+static void copy_to_node(void *arg) {
+    matrix_t *copy = (matrix_t *)arg;
+    int n = numa_source->n;
+    copy->n = n;
+    copy->stride = n;
+    copy->data = (int *)malloc((long)n * n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        memcpy(copy->data + (long)i * n, &MAT(numa_source, i, 0), n * sizeof(int));
+    }
+}
 
+// One copy of matrix per node, each written by a thread on that node so
+// first touch puts its pages there. Nothing to do on a single node
+static void numa_replicate(const matrix_t *matrix) {
+    if (pool_node_count(pool) < 2) {
+        return;
+    }
+    numa_source = matrix;
+    numa_nodes = pool_node_count(pool);
+    numa_copies = (matrix_t *)malloc(numa_nodes * sizeof(matrix_t));
+    for (int node = 0; node < numa_nodes; node++) {
+        pool_on_node(pool, node, copy_to_node, &numa_copies[node]);
+    }
+}
+
+static void numa_release() {
+    for (int node = 0; node < numa_nodes; node++) {
+        free(numa_copies[node].data);
+    }
+    free(numa_copies);
+    numa_copies = NULL;
+    numa_nodes = 0;
+}
+
+// The copy on the calling worker's node when base is the input matrix or
+// a copy of it, base itself for anything else. Engines call it wherever
+// a pool task starts reading the input
+const matrix_t *local_matrix(const matrix_t *base) {
+    if (numa_copies == NULL) {
+        return base;
+    }
+    for (int node = 0; node < numa_nodes; node++) {
+        if (base == &numa_copies[node]) {
+            return &numa_copies[pool_node()];
+        }
+    }
+    return base == numa_source ? &numa_copies[pool_node()] : base;
+}
+
+// The expansions switch to the unrolled kernels at SMALL_MAX_N in their
+// own base cases, the eliminations run as they are at every size
+static void run_engine(int algo, const matrix_t *matrix, arena_t *arena, det_t *det) {
+    matrix = local_matrix(matrix);
+    if (algo == ALGO_BAREISS) {
+        bareiss_determinant(matrix, det);
+    }
+    else if (algo == ALGO_SUBSET) {
+        subset_determinant(matrix, laplace_prepare(matrix, arena), det);
+    }
+    else if (algo == ALGO_MODULAR) {
+        modular_determinant(matrix, det);
+    }
+    else if (algo == ALGO_RECURSIVE) {
+        recursive_determinant(matrix, det);
+    }
+    else if (is_sparse_algo(algo)) {
+        compute_sparse(algo, csr_from_matrix(matrix, arena), det);
+    }
+    else {
+        int rows[matrix->n];
+        int cols[matrix->n];
+        view_t view;
+        view_of_matrix(&view, matrix, rows, cols);
+        laplace_expansion(&view, laplace_prepare(matrix, arena), det);
+    }
+}
+
+// Run the chosen engine on matrix, scratch memory comes from arena. Meant
+// to be called from a pool task, the engines spawn and wait on the pool.
+// With a result cache a matrix seen before is answered from it
+void compute_determinant(int algo, const matrix_t *matrix, arena_t *arena, det_t *det) {
+    cache_key_t key;
+    if (result_cache != NULL) {
+        key = cache_key_matrix(matrix);
+        if (cache_get(result_cache, key, CACHE_ANY_WIDTH, det, 0)) {
+            return;
         }
-        row += 1;
     }
-    return matrix;
+    run_engine(algo, matrix, arena, det);
+    if (result_cache != NULL) {
+        cache_put(result_cache, key, det, 0);
+    }
+}
+
+void job_task(task_t *task) {
+    job_t *job = (job_t *) task->arg;
+    if (job->sparse != NULL) {
+        compute_sparse(job->algo, job->sparse, &job->det);
+    }
+    else {
+        compute_determinant(job->algo, job->matrix, job->arena, &job->det);
+    }
+}
+
+// Recompute a finished job with the Laplace expansion as the reference
+// and report whether both agree, returns nonzero on a mismatch. Up to
+// SMALL_MAX_N the expansions are the unrolled kernels, so Bareiss is the
+// reference there
+int check_determinant(const job_t *job) {
+    int n = job->sparse != NULL ? job->sparse->n : job->matrix->n;
+    job_t ref = { .algo = n <= SMALL_MAX_N ? ALGO_BAREISS : ALGO_LAPLACE, .matrix = job->matrix, .arena = job->arena };
+    task_t task = { .run = job_task, .arg = &ref, .pending = NULL };
+    char *expected;
+    char *got;
+    int mismatch;
+
+    if (job->algo == ref.algo) {
+        return 0;
+    }
+    if (n > CHECK_MAX_N) {
+        printf("Check: skipped, n > %i\n", CHECK_MAX_N);
+        return 0;
+    }
+    if (job->sparse != NULL) {
+        ref.matrix = csr_to_matrix(job->sparse, job->arena);
+    }
+    // The reference has to be computed, not looked up
+    cache_t *cache = result_cache;
+    result_cache = NULL;
+    det_init(&ref.det);
+    pool_run(pool, &task);
+    result_cache = cache;
+    expected = det_to_string(&ref.det);
+    got = det_to_string(&job->det);
+    if ((mismatch = strcmp(expected, got) != 0)) {
+        printf("Check: MISMATCH, %s gives %s\n", ref.algo == ALGO_BAREISS ? "bareiss" : "laplace", expected);
+    }
+    else {
+        printf("Check: OK\n");
+    }
+    free(expected);
+    free(got);
+    det_free(&ref.det);
+    return mismatch;
+}
+
+// --stats report. Thread creation and joining happen in pool_create and
+// pool_destroy, task time is what the workers spent running tasks
+void print_stats(const pool_stats_t *totals, double parse_ms, double compute_ms, double output_ms,
+                 double create_ms, double join_ms, int created) {
+    long spawned = 0;
+    int deepest = -1;
+    for (int d = 0; d < STATS_MAX_DEPTH; d++) {
+        spawned += totals->spawned[d];
+        if (totals->spawned[d] > 0) {
+            deepest = d;
+        }
+    }
+    printf("STATS\n");
+    printf("Parse: %.3f ms\n", parse_ms);
+    printf("Compute: %.3f ms\n", compute_ms);
+    printf("Output: %.3f ms\n", output_ms);
+    printf("Thread create: %.3f ms\n", create_ms);
+    printf("Thread join: %.3f ms\n", join_ms);
+    printf("Task time: %.3f ms over %i threads\n", totals->busy_ms, created);
+    printf("Threads created: %i\n", created);
+    printf("Max concurrent threads: %i\n", totals->max_active);
+    printf("Tasks spawned: %li\n", spawned);
+    for (int d = 0; d <= deepest; d++) {
+        printf("  depth %i: %li\n", d, totals->spawned[d]);
+    }
+    printf("Minor storage: %li bytes\n", totals->minor_bytes);
+    printf("Kernels: %s\n", kernels->name);
+}
+
+// Milliseconds on the monotonic clock, for timing phases
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
 }
 
-void print_matrix(int **matrix, int n) {
+void print_matrix(const matrix_t *matrix) {
     printf("START PRINTING MATRIX\n");
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            printf("%i ", matrix[i][j]);
+    for (int i = 0; i < matrix->n; i++) {
+        for (int j = 0; j < matrix->n; j++) {
+            printf("%i ", MAT(matrix, i, j));
         }
         printf("\n");
     }
     printf("END PRINTING MATRIX\n");
 }
 
-int rule_of_sarrus(int **matrix, int row, int col) {
-    int determinant;
-    determinant = (matrix[row][col] * matrix[row+1][col+1] * matrix[row+2][col+2] + 
-                matrix[row+1][col] * matrix[row+2][col+1] * matrix[row][col+2] + 
-                matrix[row+2][col] * matrix[row][col+1] * matrix[row+1][col+2]) -
-                (matrix[row][col+2] * matrix[row+1][col+1] * matrix[row+2][col] + 
-                matrix[row+1][col+2] * matrix[row+2][col+1] * matrix[row][col] + 
-                matrix[row+2][col+2] * matrix[row][col+1] * matrix[row+1][col]);
-    return determinant;
-}
-
-int **form_minor(int **matrix, int n, int del_row, int del_col) {
-    int **minor = (int **)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) minor[i] = (int *)malloc(n * sizeof(int));
+// Minor of matrix without del_row and del_col, rows and cols receive
+// the n - 1 remaining indices and must outlive the minor. Without the
+// last row the parent's row list is reused as is and rows may be NULL
+void form_minor(view_t *minor, const view_t *matrix, int del_row, int del_col, int *rows, int *cols) {
     int row = 0;
     int col = 0;
-    for (int i = 0; i < n; i++) {
-        if (i != del_row) {
-            col = 0;
-            for (int j = 0; j < n; j++) {
-                if (j != del_col) {
-                    minor[row][col] = matrix[i][j];
-                    col += 1;
-                }
-            }
-        row += 1;
+    for (int i = 0; i < matrix->n; i++) {
+        if (i != del_row && del_row != matrix->n - 1) {
+            rows[row] = matrix->rows[i];
+            row += 1;
+        }
+        if (i != del_col) {
+            cols[col] = matrix->cols[i];
+            col += 1;
         }
     }
-    return minor;
+    minor->base = matrix->base;
+    minor->n = matrix->n - 1;
+    minor->rows = del_row == matrix->n - 1 ? matrix->rows : rows;
+    minor->cols = cols;
 }
 
-void *laplace_expansion(void *args) {
-    arguments *args_tmp = (arguments *) args;
-    int **minor;
-    int det = 0;
-    int **matrix = args_tmp->matrix;
-    int n = args_tmp->n;
-    if (n == 3) {
-        det = rule_of_sarrus(matrix, 0, 0);
+// Sequential expansion along the last row in a fixed width type, only
+// called where the width table says no partial sum can overflow it
+#define DEFINE_LAPLACE_INLINE(name, small, type)                                    \
+    type name(const view_t *matrix) {                                               \
+        int n = matrix->n;                                                          \
+        int minor_cols[n - 1];                                                      \
+        view_t minor;                                                               \
+        type det = 0;                                                               \
+        if (n <= SMALL_MAX_N) {                                                     \
+            return small(matrix);                                                   \
+        }                                                                           \
+        for (int j = 0; j < n; j++) {                                               \
+            int multiplier = (n - 1 + j) % 2 == 0 ? 1 : -1;                         \
+            if (VIEW(matrix, n - 1, j) == 0) {                                      \
+                continue;                                                           \
+            }                                                                       \
+            form_minor(&minor, matrix, n - 1, j, NULL, minor_cols);                 \
+            det += (type)VIEW(matrix, n - 1, j) * multiplier * name(&minor);        \
+        }                                                                           \
+        return det;                                                                 \
+    }
+
+DEFINE_LAPLACE_INLINE(laplace_inline, small_det, long long)
+DEFINE_LAPLACE_INLINE(laplace_inline_wide, small_det_wide, __int128)
+
+// Pick the result width of every minor size. Minors always keep the
+// leading rows, so the row sum bound of rows 0 .. k - 1 covers all of them
+int *laplace_prepare(const matrix_t *matrix, arena_t *arena) {
+    int *width = (int *)arena_alloc(arena, (matrix->n + 1) * sizeof(int));
+    for (int k = 0; k <= matrix->n; k++) {
+        width[k] = width_for_bits(row_sum_bits(matrix, k));
+    }
+    return width;
+}
+
+// Column lists the inline expansion of an n x n view puts on the stack
+static long inline_minor_bytes(int n) {
+    long bytes = 0;
+    for (int k = SMALL_MAX_N + 1; k <= n; k++) {
+        bytes = (k - 1) * (long)sizeof(int) + k * bytes;
+    }
+    return bytes;
+}
+
+void laplace_task(task_t *task) {
+    arguments *args = (arguments *) task->arg;
+    // A stolen minor switches to the copy of the thief's node
+    args->view.base = local_matrix(args->view.base);
+    laplace_expansion(&args->view, args->width, &args->det);
+}
+
+// Expand along the last row. Minors bigger than inline_cutoff become pool
+// tasks (all but the last one, which this thread expands itself), smaller
+// ones are expanded right here so the tree does not drown in tiny tasks.
+// Minors are views sharing the parent's rows, their column lists live in
+// this frame which stays alive until every child task has finished.
+// Subtrees that fit 64 or 128 bits run in plain integer arithmetic, only
+// the levels whose bound needs more accumulate in big integers
+static void laplace_expand(const view_t *matrix, const int *widths, det_t *det) {
+    int n = matrix->n;
+    int width = widths[n];
+    int parallel = n - 1 > inline_cutoff;
+
+    if (n <= SMALL_MAX_N && width != DET_BIG) {
+        if (width == DET_INT64) {
+            det_set_i128(det, small_det(matrix), DET_INT64);
+        }
+        else {
+            det_set_i128(det, small_det_wide(matrix), DET_INT128);
+        }
+        return;
+    }
+    // Minors the cache keeps are expanded one level at a time, the inline
+    // expansion below would never look at them
+    if (!parallel && width != DET_BIG && !cache_wants_minor(result_cache, n - 1)) {
+        pool_count_minor_bytes(pool, inline_minor_bytes(n));
+        if (width == DET_INT64) {
+            det_set_i128(det, laplace_inline(matrix), DET_INT64);
+        }
+        else {
+            det_set_i128(det, laplace_inline_wide(matrix), DET_INT128);
+        }
+        return;
+    }
+
+    int multiplier;
+    int del_row = n - 1;
+    long long output[n];
+    int cols[n][n - 1];
+    int live[n];
+    int count = 0;
+    task_t tasks[n];
+    arguments args_next[n];
+    atomic_int pending;
+    // Zero entries contribute nothing, their minors are never formed
+    for (int j = 0; j < n; j++) {
+        if (VIEW(matrix, del_row, j) != 0) {
+            live[count++] = j;
+        }
+    }
+    atomic_init(&pending, parallel && count > 0 ? count - 1 : 0);
+    pool_count_minor_bytes(pool, count * (sizeof(cols[0]) + sizeof(args_next[0])));
+    for (int t = 0; t < count; t++) {
+        int j = live[t];
+        form_minor(&args_next[j].view, matrix, del_row, j, NULL, cols[j]);
+        args_next[j].width = widths;
+        det_init(&args_next[j].det);
+        if ((del_row + j) % 2 == 0) {
+            multiplier = 1;
+        }
+        else {
+            multiplier = -1;
+        };
+        output[j] = (long long)VIEW(matrix, del_row, j) * multiplier;
+        tasks[j].run = laplace_task;
+        tasks[j].arg = &args_next[j];
+        tasks[j].pending = &pending;
+        if (parallel && t < count - 1) {
+            pool_spawn(pool, &tasks[j]);
+        }
+        else {
+            pool_inline(&tasks[j]);
+        }
+    }
+    pool_wait(pool, &pending);
+
+    if (width == DET_BIG) {
+        bigint_t sum;
+        bigint_t term;
+        bigint_init(&sum);
+        bigint_init(&term);
+        for (int t = 0; t < count; t++) {
+            det_to_bigint(&args_next[live[t]].det, &term);
+            bigint_mul_i64(&term, &term, output[live[t]]);
+            bigint_add(&sum, &sum, &term);
+        }
+        det_set_big(det, &sum);
+        bigint_free(&sum);
+        bigint_free(&term);
     }
     else {
-        int multiplier;
-        int del_row = n - 1;
-        pthread_t tid[n];
-        int output[n];
-        for (int j = 0; j < n; j++) {
-            minor = form_minor(matrix, n, del_row, j);
-            if ((del_row + j) % 2 == 0) {
-                multiplier = 1;
-            }
-            else {
-                multiplier = -1;
-            };
-            output[j] = matrix[del_row][j] * multiplier;
-            arguments *args_next = malloc(sizeof(arguments));
-            args_next->matrix = minor;
-            args_next->n = n - 1;
-            pthread_create(tid+j, NULL, laplace_expansion, (void *) args_next);
-        }
-        void *minor_det;
-        for (int j = 0; j < n; j++) {
-            pthread_join(*(tid+j), &minor_det);
-            det += output[j] * (int)minor_det;
-        }
-    }
-    free(args);
-    return (void *) det;
+        __int128 sum = 0;
+        for (int t = 0; t < count; t++) {
+            sum += output[live[t]] * args_next[live[t]].det.value;
+        }
+        det_set_i128(det, sum, width);
+    }
+    for (int t = 0; t < count; t++) {
+        det_free(&args_next[live[t]].det);
+    }
+}
+
+// laplace_expansion with --cache-minors: a minor with the same entries as
+// one already expanded anywhere in the tree, in this matrix or an earlier
+// one, is looked up instead of expanded again
+void laplace_expansion(const view_t *matrix, const int *widths, det_t *det) {
+    cache_key_t key;
+    if (!cache_wants_minor(result_cache, matrix->n)) {
+        laplace_expand(matrix, widths, det);
+        return;
+    }
+    key = cache_key_view(matrix);
+    if (cache_get(result_cache, key, widths[matrix->n], det, 1)) {
+        return;
+    }
+    laplace_expand(matrix, widths, det);
+    cache_put(result_cache, key, det, 1);
 }
@@ -0,0 +1,73 @@
+#ifndef DETERMINANT_H
+#define DETERMINANT_H
+
+#include <stdio.h>
+
+#include <pool.h>
+#include <matrix.h>
+#include <result.h>
+#include <sparse.h>
+#include <real.h>
+#include <small.h>
+
+#define ALGO_LAPLACE 0
+#define ALGO_BAREISS 1
+#define ALGO_SUBSET 2
+#define ALGO_MODULAR 3
+#define ALGO_SPARSE 4
+#define ALGO_SPARSE_LAPLACE 5
+#define ALGO_RECURSIVE 6
+#define ALGO_COUNT 7
+
+// Largest matrix of the subset expansion. Column sets are bit masks,
+// layer k needs C(n, k) values so memory runs out around here anyway
+#define SUBSET_MAX_N 30
+
+typedef struct arg_struct {
+    view_t view;
+    const int *width;
+    det_t det;
+} arguments;
+
+typedef struct job_st {
+    int algo;
+    const matrix_t *matrix;
+    const csr_t *sparse;
+    arena_t *arena;
+    det_t det;
+} job_t;
+
+// Shared worker pool, created by main before any engine runs
+extern pool_t *pool;
+extern int inline_cutoff;
+
+FILE *open_file(char *, char *);
+double now_ms();
+matrix_t *parse_text_matrix(const char *, size_t, const char *, arena_t *, size_t *);
+int parse_text_lanes(const char *, size_t, const char *, small_lanes_t *);
+int *parse_text_rhs(const char *, size_t, const char *, int, int *);
+int *form_rhs(const char *, int, int *);
+matrix_t *form__square_matrix(const char *, arena_t *);
+void print_matrix(const matrix_t *);
+void form_minor(view_t *, const view_t *, int, int, int *, int *);
+long long laplace_inline(const view_t *);
+__int128 laplace_inline_wide(const view_t *);
+int *laplace_prepare(const matrix_t *, arena_t *);
+void laplace_expansion(const view_t *, const int *, det_t *);
+void laplace_task(task_t *);
+const matrix_t *local_matrix(const matrix_t *);
+void bareiss_determinant(const matrix_t *, det_t *);
+void subset_determinant(const matrix_t *, const int *, det_t *);
+void modular_determinant(const matrix_t *, det_t *);
+void recursive_determinant(const matrix_t *, det_t *);
+uint64_t recursive_det_mod(const matrix_t *, uint64_t *, uint64_t);
+void permanent(const matrix_t *, det_t *);
+void permanent_task(task_t *);
+int parse_algo(const char *);
+int is_sparse_algo(int);
+void compute_determinant(int, const matrix_t *, arena_t *, det_t *);
+void compute_sparse(int, const csr_t *, det_t *);
+void job_task(task_t *);
+int batch_main(int, char **);
+
+#endif
@@ -0,0 +1,544 @@
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <factor.h>
+#include <kernels.h>
+#include <modular.h>
+
+typedef struct factor_query_st factor_query_t;
+typedef struct factor_cli_st factor_cli_t;
+
+struct factor_st {
+    int n;
+    matrix_t matrix;
+    int count;
+    uint64_t *primes;
+    uint64_t *residues;
+    int *ranks;
+    // Row echelon form modulo each prime: the multipliers of L below the
+    // diagonal, U on and above it, rows in the order of perm
+    uint64_t **lu;
+    int **perm;
+    // The exact determinant, once a query needed it
+    int have_det;
+    det_t det;
+};
+
+// One solve spread over the pool, blocks of right hand side columns
+// against the primes the matrix is invertible modulo
+struct factor_query_st {
+    factor_t *factor;
+    const int *rhs;
+    int cols;
+    int blocks;
+    int usable;
+    // Factor index of each usable prime, the primes themselves with their
+    // CRT constants, and |det| modulo each, which scales the solution
+    int *index;
+    uint64_t *primes;
+    modular_crt_t crt;
+    uint64_t *scale;
+    // Residue of entry e modulo usable prime u at [e * usable + u]
+    uint64_t *out;
+    det_t *num;
+};
+
+struct factor_cli_st {
+    const char *filename;
+    int det;
+    int rank;
+    int inverse;
+    char **solve;
+    int solves;
+    int failed;
+    double factor_ms;
+    double query_ms;
+    int primes;
+};
+
+// Gaussian elimination with row swaps modulo prime k into row echelon
+// form. A column without a pivot is skipped, so the rank comes out of it
+// as well; L and U only mean something when it is full
+static void factor_prime(factor_t *factor, int k) {
+    int n = factor->n;
+    uint64_t p = factor->primes[k];
+    uint64_t *a = factor->lu[k];
+    int *perm = factor->perm[k];
+    uint64_t det = 1;
+    int rank = 0;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[(long)i * n + j] = residue(MAT(&factor->matrix, i, j), p);
+        }
+        perm[i] = i;
+    }
+    for (int c = 0; c < n; c++) {
+        uint64_t *pivot_row = a + (long)rank * n;
+        int piv = rank;
+        while (piv < n && a[(long)piv * n + c] == 0) {
+            piv++;
+        }
+        if (piv == n) {
+            det = 0;
+            continue;
+        }
+        if (piv != rank) {
+            uint64_t *other = a + (long)piv * n;
+            int tmp = perm[rank];
+            perm[rank] = perm[piv];
+            perm[piv] = tmp;
+            for (int j = 0; j < n; j++) {
+                uint64_t t = pivot_row[j];
+                pivot_row[j] = other[j];
+                other[j] = t;
+            }
+            det = p - det;
+        }
+        det = mul_mod(det, pivot_row[c], p);
+        uint64_t inv = inv_mod(pivot_row[c], p);
+        for (int i = rank + 1; i < n; i++) {
+            uint64_t *row = a + (long)i * n;
+            uint64_t mult = mul_mod(row[c], inv, p);
+            row[c] = mult;
+            if (mult != 0 && c + 1 < n) {
+                kernels->mod_update(row + c + 1, pivot_row + c + 1, n - c - 1, mult, kernel_shoup(mult, p), p);
+            }
+        }
+        rank += 1;
+    }
+    factor->residues[k] = rank == n ? det : 0;
+    factor->ranks[k] = rank;
+}
+
+static void factor_primes(long begin, long end, void *arg) {
+    factor_t *factor = (factor_t *)arg;
+    for (long k = begin; k < end; k++) {
+        factor_prime(factor, (int)k);
+    }
+}
+
+// Factor modulo the first count primes, the ones already done are kept
+static void factor_fit_primes(factor_t *factor, int count) {
+    int n = factor->n;
+    int old = factor->count;
+    if (count <= old) {
+        return;
+    }
+    factor->primes = (uint64_t *)realloc(factor->primes, count * sizeof(uint64_t));
+    factor->residues = (uint64_t *)realloc(factor->residues, count * sizeof(uint64_t));
+    factor->ranks = (int *)realloc(factor->ranks, count * sizeof(int));
+    factor->lu = (uint64_t **)realloc(factor->lu, count * sizeof(uint64_t *));
+    factor->perm = (int **)realloc(factor->perm, count * sizeof(int *));
+    modular_find_primes(factor->primes, count);
+    for (int k = old; k < count; k++) {
+        factor->lu[k] = (uint64_t *)malloc((long)n * n * sizeof(uint64_t));
+        factor->perm[k] = (int *)malloc(n * sizeof(int));
+    }
+    pool_count_minor_bytes(pool, (long)(count - old) * n * n * sizeof(uint64_t));
+    factor->count = count;
+    pool_parallel_for(pool, old, count, 1, factor_primes, factor);
+}
+
+static int usable_primes(const factor_t *factor) {
+    int usable = 0;
+    for (int k = 0; k < factor->count; k++) {
+        usable += factor->residues[k] != 0;
+    }
+    return usable;
+}
+
+// At least need primes the matrix is invertible modulo. Only a prime
+// dividing the determinant is singular, so a nonsingular matrix gets
+// there after a few extra primes at most
+static void factor_fit_usable(factor_t *factor, int need) {
+    int usable;
+    while ((usable = usable_primes(factor)) < need) {
+        factor_fit_primes(factor, factor->count + need - usable);
+    }
+}
+
+// Hadamard's bound covers the determinant and every minor, so the same
+// primes give the rank and the adjugate
+factor_t *factor_create(const matrix_t *matrix) {
+    factor_t *factor = (factor_t *)calloc(1, sizeof(factor_t));
+    int n = matrix->n;
+
+    factor->n = n;
+    factor->matrix.n = n;
+    factor->matrix.stride = n;
+    factor->matrix.data = (int *)malloc((long)n * n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        memcpy(factor->matrix.data + (long)i * n, &MAT(matrix, i, 0), n * sizeof(int));
+    }
+    det_init(&factor->det);
+    factor_fit_primes(factor, modular_prime_count(hadamard_bits(matrix, n)));
+    return factor;
+}
+
+void factor_destroy(factor_t *factor) {
+    for (int k = 0; k < factor->count; k++) {
+        free(factor->lu[k]);
+        free(factor->perm[k]);
+    }
+    free(factor->lu);
+    free(factor->perm);
+    free(factor->primes);
+    free(factor->residues);
+    free(factor->ranks);
+    free(factor->matrix.data);
+    det_free(&factor->det);
+    free(factor);
+}
+
+static const det_t *exact_det(factor_t *factor) {
+    if (!factor->have_det) {
+        modular_combine(factor->primes, factor->residues, factor->count, &factor->det);
+        factor->have_det = 1;
+    }
+    return &factor->det;
+}
+
+static int det_is_negative(const det_t *det) {
+    return det->width == DET_BIG ? det->big.neg : det->value < 0;
+}
+
+void factor_det(factor_t *factor, det_t *det) {
+    const det_t *exact = exact_det(factor);
+    if (exact->width == DET_BIG) {
+        det_set_big(det, &exact->big);
+    }
+    else {
+        det_set_i128(det, exact->value, exact->width);
+    }
+}
+
+// A nonzero r x r minor is below the product of the primes, so at least
+// one of them keeps it nonzero: the largest rank modulo any of them is
+// the rank over the rationals
+int factor_rank(factor_t *factor) {
+    int rank = 0;
+    for (int k = 0; k < factor->count; k++) {
+        rank = factor->ranks[k] > rank ? factor->ranks[k] : rank;
+    }
+    return rank;
+}
+
+// log2 of a bound on the numerators: by Cramer's rule they are the
+// determinants of the matrix with a column replaced by a right hand side,
+// so each row norm grows by at most the largest entry of that row of rhs
+static double solve_bits(const factor_t *factor, const int *rhs, int cols) {
+    double bits = 0;
+    for (int i = 0; i < factor->n; i++) {
+        double norm = 0;
+        double largest = 0;
+        for (int j = 0; j < factor->n; j++) {
+            double x = MAT(&factor->matrix, i, j);
+            norm += x * x;
+        }
+        for (int c = 0; c < cols; c++) {
+            double x = rhs[(long)i * cols + c];
+            largest = x * x > largest ? x * x : largest;
+        }
+        if (norm + largest > 1) {
+            bits += 0.5 * log2(norm + largest);
+        }
+    }
+    return bits;
+}
+
+// Forward and back substitution of one block of columns modulo one
+// prime. The rows of the block are contiguous, so each step is the
+// row update kernel over the block width
+static void solve_block(const factor_query_t *query, int u, int b, uint64_t *y) {
+    const factor_t *factor = query->factor;
+    int n = factor->n;
+    int k = query->index[u];
+    uint64_t p = factor->primes[k];
+    const uint64_t *lu = factor->lu[k];
+    const int *perm = factor->perm[k];
+    int first = b * FACTOR_RHS_BLOCK;
+    int width = query->cols - first < FACTOR_RHS_BLOCK ? query->cols - first : FACTOR_RHS_BLOCK;
+
+    for (int i = 0; i < n; i++) {
+        for (int t = 0; t < width; t++) {
+            y[(long)i * width + t] = residue(query->rhs[(long)perm[i] * query->cols + first + t], p);
+        }
+    }
+    // L y = P b, L has a unit diagonal
+    for (int i = 1; i < n; i++) {
+        for (int j = 0; j < i; j++) {
+            uint64_t mult = lu[(long)i * n + j];
+            if (mult != 0) {
+                kernels->mod_update(y + (long)i * width, y + (long)j * width, width, mult, kernel_shoup(mult, p), p);
+            }
+        }
+    }
+    // U x = y, then x scaled by |det| gives the numerators
+    for (int i = n - 1; i >= 0; i--) {
+        uint64_t *row = y + (long)i * width;
+        for (int j = i + 1; j < n; j++) {
+            uint64_t mult = lu[(long)i * n + j];
+            if (mult != 0) {
+                kernels->mod_update(row, y + (long)j * width, width, mult, kernel_shoup(mult, p), p);
+            }
+        }
+        uint64_t inv = inv_mod(lu[(long)i * n + i], p);
+        for (int t = 0; t < width; t++) {
+            row[t] = mul_mod(row[t], inv, p);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        for (int t = 0; t < width; t++) {
+            query->out[((long)i * query->cols + first + t) * query->usable + u] =
+                mul_mod(y[(long)i * width + t], query->scale[u], p);
+        }
+    }
+}
+
+static void solve_blocks(long begin, long end, void *arg) {
+    factor_query_t *query = (factor_query_t *)arg;
+    uint64_t *y = (uint64_t *)malloc((long)query->factor->n * FACTOR_RHS_BLOCK * sizeof(uint64_t));
+    for (long w = begin; w < end; w++) {
+        solve_block(query, (int)(w / query->blocks), (int)(w % query->blocks), y);
+    }
+    free(y);
+}
+
+static void combine_entries(long begin, long end, void *arg) {
+    factor_query_t *query = (factor_query_t *)arg;
+    for (long e = begin; e < end; e++) {
+        modular_crt_combine(&query->crt, query->out + e * query->usable, &query->num[e]);
+    }
+}
+
+// Solve A X = rhs for the n x cols right hand sides (row major) exactly:
+// X = num / den with den = |det A|, num holds n * cols initialised det_t.
+// Every pair of a prime and a block of columns is one pool chunk, then
+// the entries are put together by CRT. Returns 0 if A is singular
+int factor_solve(factor_t *factor, const int *rhs, int cols, det_t *den, det_t *num) {
+    int n = factor->n;
+    const det_t *det = exact_det(factor);
+    int negative = det_is_negative(det);
+    factor_query_t query = { .factor = factor, .rhs = rhs, .cols = cols, .num = num };
+
+    if (det->width != DET_BIG ? det->value == 0 : bigint_is_zero(&det->big)) {
+        return 0;
+    }
+    if (det->width == DET_BIG) {
+        bigint_t magnitude;
+        bigint_init(&magnitude);
+        bigint_copy(&magnitude, &det->big);
+        magnitude.neg = 0;
+        det_set_big(den, &magnitude);
+        bigint_free(&magnitude);
+    }
+    else {
+        det_set_i128(den, negative ? -det->value : det->value, det->width);
+    }
+
+    query.usable = modular_prime_count(solve_bits(factor, rhs, cols));
+    factor_fit_usable(factor, query.usable);
+    query.blocks = (cols + FACTOR_RHS_BLOCK - 1) / FACTOR_RHS_BLOCK;
+    query.index = (int *)malloc(query.usable * sizeof(int));
+    query.primes = (uint64_t *)malloc(query.usable * sizeof(uint64_t));
+    query.scale = (uint64_t *)malloc(query.usable * sizeof(uint64_t));
+    query.out = (uint64_t *)malloc((long)n * cols * query.usable * sizeof(uint64_t));
+    for (int k = 0, u = 0; u < query.usable; k++) {
+        uint64_t p = factor->primes[k];
+        if (factor->residues[k] == 0) {
+            continue;
+        }
+        query.index[u] = k;
+        query.primes[u] = p;
+        query.scale[u] = negative ? p - factor->residues[k] : factor->residues[k];
+        u += 1;
+    }
+    modular_crt_init(&query.crt, query.primes, query.usable);
+    pool_parallel_for(pool, 0, (long)query.usable * query.blocks, 1, solve_blocks, &query);
+    pool_parallel_for(pool, 0, (long)n * cols, 1, combine_entries, &query);
+    free(query.index);
+    free(query.primes);
+    modular_crt_free(&query.crt);
+    free(query.scale);
+    free(query.out);
+    return 1;
+}
+
+// The inverse is the solve against the identity: num is the adjugate up
+// to the sign of det
+int factor_inverse(factor_t *factor, det_t *den, det_t *num) {
+    int n = factor->n;
+    int *identity = (int *)calloc((long)n * n, sizeof(int));
+    int invertible;
+    for (int i = 0; i < n; i++) {
+        identity[(long)i * n + i] = 1;
+    }
+    invertible = factor_solve(factor, identity, n, den, num);
+    free(identity);
+    return invertible;
+}
+
+// Prints the denominator, then the numerators one row per line
+static void print_fraction(const char *title, const det_t *den, det_t *num, int rows, int cols) {
+    char *text = det_to_string(den);
+    printf("%s: denominator %s\n", title, text);
+    free(text);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            text = det_to_string(&num[(long)i * cols + j]);
+            printf(j + 1 < cols ? "%s " : "%s\n", text);
+            free(text);
+        }
+    }
+}
+
+static int fraction_query(factor_t *factor, const char *title, const char *rhs_file) {
+    int n = factor->n;
+    int cols = n;
+    int *rhs = rhs_file != NULL ? form_rhs(rhs_file, n, &cols) : NULL;
+    det_t *num = (det_t *)malloc((long)n * cols * sizeof(det_t));
+    det_t den;
+    int ok;
+
+    det_init(&den);
+    for (long e = 0; e < (long)n * cols; e++) {
+        det_init(&num[e]);
+    }
+    ok = rhs != NULL ? factor_solve(factor, rhs, cols, &den, num) : factor_inverse(factor, &den, num);
+    if (ok) {
+        print_fraction(title, &den, num, n, cols);
+    }
+    else {
+        fprintf(stderr, "%s: the matrix is singular\n", title);
+    }
+    for (long e = 0; e < (long)n * cols; e++) {
+        det_free(&num[e]);
+    }
+    det_free(&den);
+    free(num);
+    free(rhs);
+    return ok;
+}
+
+static void factor_task(task_t *task) {
+    factor_cli_t *cli = (factor_cli_t *)task->arg;
+    arena_t arena;
+    double start;
+
+    arena_init(&arena);
+    matrix_t *matrix = form__square_matrix(cli->filename, &arena);
+    start = now_ms();
+    factor_t *factor = factor_create(matrix);
+    cli->factor_ms = now_ms() - start;
+    start = now_ms();
+
+    if (cli->det) {
+        det_t det;
+        det_init(&det);
+        factor_det(factor, &det);
+        char *text = det_to_string(&det);
+        printf("Det: %s\n", text);
+        free(text);
+        det_free(&det);
+    }
+    if (cli->rank) {
+        printf("Rank: %i\n", factor_rank(factor));
+    }
+    for (int s = 0; s < cli->solves; s++) {
+        char title[PATH_MAX + 8];
+        snprintf(title, sizeof(title), "Solve %s", cli->solve[s]);
+        cli->failed |= !fraction_query(factor, title, cli->solve[s]);
+    }
+    if (cli->inverse) {
+        cli->failed |= !fraction_query(factor, "Inverse", NULL);
+    }
+    cli->query_ms = now_ms() - start;
+    cli->primes = factor->count;
+    factor_destroy(factor);
+    arena_release(&arena);
+}
+
+static void factor_usage(char *program) {
+    fprintf(stderr, "Usage: %s factor [--threads N] [--scalar] [--det] [--rank] [--solve RHS]... [--inverse] <file>\n", program);
+    fprintf(stderr, "  Factors the matrix once modulo enough primes and answers every query from\n");
+    fprintf(stderr, "  that factorization, det and rank when none is given:\n");
+    fprintf(stderr, "    --det          the exact determinant\n");
+    fprintf(stderr, "    --rank         the rank over the rationals\n");
+    fprintf(stderr, "    --solve RHS    exact solution of A X = RHS, a text file of n rows with any\n");
+    fprintf(stderr, "                   number of columns, printed as a denominator and numerators\n");
+    fprintf(stderr, "    --inverse      exact inverse, in the same form\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant factor: one factorization, several queries against it
+int factor_main(int argc, char **argv) {
+    int threads = default_thread_count();
+    int scalar = 0;
+    factor_cli_t cli = { 0 };
+    int opt;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"scalar", no_argument, 0, 's'},
+        {"det", no_argument, 0, 'd'},
+        {"rank", no_argument, 0, 'r'},
+        {"solve", required_argument, 0, 'x'},
+        {"inverse", no_argument, 0, 'i'},
+        {0, 0, 0, 0}
+    };
+
+    cli.solve = (char **)malloc(argc * sizeof(char *));
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "t:sdrx:i", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                if ((threads = atoi(optarg)) < 1) {
+                    factor_usage(argv[0]);
+                }
+                break;
+            case 's':
+                scalar = 1;
+                break;
+            case 'd':
+                cli.det = 1;
+                break;
+            case 'r':
+                cli.rank = 1;
+                break;
+            case 'x':
+                cli.solve[cli.solves++] = optarg;
+                break;
+            case 'i':
+                cli.inverse = 1;
+                break;
+            default:
+                factor_usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        factor_usage(argv[0]);
+    }
+    cli.filename = argv[optind];
+    if (!cli.det && !cli.rank && !cli.inverse && cli.solves == 0) {
+        cli.det = 1;
+        cli.rank = 1;
+    }
+
+    kernels_select(scalar);
+    pool = pool_create(threads);
+    task_t task = { .run = factor_task, .arg = &cli, .pending = NULL };
+    pool_run(pool, &task);
+    fflush(stdout);
+    fprintf(stderr, "Factor: %i primes, %.3f ms factorization, %.3f ms queries\n",
+            cli.primes, cli.factor_ms, cli.query_ms);
+    pool_destroy(pool);
+    free(cli.solve);
+    return cli.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
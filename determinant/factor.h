@@ -0,0 +1,27 @@
+#ifndef FACTOR_H
+#define FACTOR_H
+
+#include <matrix.h>
+#include <result.h>
+
+// Right hand side columns substituted together, one pool chunk is one
+// block against one prime
+#define FACTOR_RHS_BLOCK 16
+
+typedef struct factor_st factor_t;
+
+// PLU factorization of an integer matrix modulo enough primes for exact
+// answers, kept so that every query shares the O(n^3) elimination:
+// det and rank are read off it, solve and inverse are O(n^2) per prime
+// and right hand side. Solutions come as num / den over the common
+// denominator den = |det|. Like the engines, calls are made from inside
+// a pool task
+factor_t *factor_create(const matrix_t *matrix);
+void factor_destroy(factor_t *factor);
+void factor_det(factor_t *factor, det_t *det);
+int factor_rank(factor_t *factor);
+int factor_solve(factor_t *factor, const int *rhs, int cols, det_t *den, det_t *num);
+int factor_inverse(factor_t *factor, det_t *den, det_t *num);
+int factor_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdint.h>
+
+#include <kernels.h>
+#include <small.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// floor(factor * 2^64 / p), turns factor * x mod p into two multiplies
+// and a correction (Shoup's modular multiplication)
+uint64_t kernel_shoup(uint64_t factor, uint64_t p) {
+    return (uint64_t)(((unsigned __int128)factor << 64) / p);
+}
+
+divisor_t kernel_divisor(long long d) {
+    divisor_t div;
+    uint64_t odd;
+    uint64_t inv;
+
+    div.shift = __builtin_ctzll((uint64_t)d);
+    odd = (uint64_t)(d >> div.shift);
+    // Newton iteration, each step doubles the number of correct low bits
+    inv = odd;
+    for (int i = 0; i < 5; i++) {
+        inv *= 2 - odd * inv;
+    }
+    div.inverse = inv;
+    return div;
+}
+
+static void mod_update_scalar(uint64_t *row, const uint64_t *pivot, long len, uint64_t factor, uint64_t shoup, uint64_t p) {
+    for (long j = 0; j < len; j++) {
+        uint64_t q = (uint64_t)(((unsigned __int128)shoup * pivot[j]) >> 64);
+        uint64_t r = factor * pivot[j] - q * p;
+        r = r >= p ? r - p : r;
+        row[j] = row[j] >= r ? row[j] - r : row[j] + (p - r);
+    }
+}
+
+static void real_update_scalar(double *row, const double *pivot, long len, double factor) {
+    for (long j = 0; j < len; j++) {
+        row[j] -= factor * pivot[j];
+    }
+}
+
+static void bareiss_update_scalar(long long *row, const long long *pivot, long len, long long factor,
+                                  long long pivot_entry, divisor_t d) {
+    for (long j = 0; j < len; j++) {
+        __int128 value = (__int128)row[j] * pivot_entry - (__int128)factor * pivot[j];
+        row[j] = (long long)((uint64_t)(value >> d.shift) * d.inverse);
+    }
+}
+
+static const kernels_t scalar_kernels = {
+    "scalar", mod_update_scalar, real_update_scalar, bareiss_update_scalar, small_lanes_scalar
+};
+
+const kernels_t *kernels = &scalar_kernels;
+
+#if defined(__x86_64__)
+
+// Neither instruction set has a 64 x 64 -> 128 bit multiply, the high
+// half is put together from four 32 x 32 bit products
+TARGET_AVX2 static inline __m256i mulhi_u64_avx2(__m256i a, __m256i b) {
+    const __m256i mask = _mm256_set1_epi64x(0xFFFFFFFF);
+    __m256i ah = _mm256_srli_epi64(a, 32);
+    __m256i bh = _mm256_srli_epi64(b, 32);
+    __m256i p00 = _mm256_mul_epu32(a, b);
+    __m256i p01 = _mm256_mul_epu32(a, bh);
+    __m256i p10 = _mm256_mul_epu32(ah, b);
+    __m256i p11 = _mm256_mul_epu32(ah, bh);
+    __m256i mid = _mm256_add_epi64(_mm256_srli_epi64(p00, 32),
+                                   _mm256_add_epi64(_mm256_and_si256(p01, mask), _mm256_and_si256(p10, mask)));
+    return _mm256_add_epi64(_mm256_add_epi64(p11, _mm256_srli_epi64(mid, 32)),
+                            _mm256_add_epi64(_mm256_srli_epi64(p01, 32), _mm256_srli_epi64(p10, 32)));
+}
+
+TARGET_AVX2 static inline __m256i mullo_u64_avx2(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)),
+                                     _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+// Signed high half: the unsigned one minus b where a < 0, minus a where b < 0
+TARGET_AVX2 static inline __m256i mulhi_i64_avx2(__m256i a, __m256i b) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i hi = mulhi_u64_avx2(a, b);
+    hi = _mm256_sub_epi64(hi, _mm256_and_si256(_mm256_cmpgt_epi64(zero, a), b));
+    return _mm256_sub_epi64(hi, _mm256_and_si256(_mm256_cmpgt_epi64(zero, b), a));
+}
+
+TARGET_AVX2 static void mod_update_avx2(uint64_t *row, const uint64_t *pivot, long len, uint64_t factor, uint64_t shoup, uint64_t p) {
+    const __m256i vp = _mm256_set1_epi64x((long long)p);
+    const __m256i vf = _mm256_set1_epi64x((long long)factor);
+    const __m256i vs = _mm256_set1_epi64x((long long)shoup);
+    long j = 0;
+    // Every value stays below 2^63 so signed compares are safe
+    for (; j + 4 <= len; j += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(pivot + j));
+        __m256i a = _mm256_loadu_si256((const __m256i *)(row + j));
+        __m256i q = mulhi_u64_avx2(vs, x);
+        __m256i r = _mm256_sub_epi64(mullo_u64_avx2(vf, x), mullo_u64_avx2(q, vp));
+        r = _mm256_sub_epi64(r, _mm256_andnot_si256(_mm256_cmpgt_epi64(vp, r), vp));
+        __m256i d = _mm256_sub_epi64(a, r);
+        d = _mm256_add_epi64(d, _mm256_and_si256(_mm256_cmpgt_epi64(r, a), vp));
+        _mm256_storeu_si256((__m256i *)(row + j), d);
+    }
+    mod_update_scalar(row + j, pivot + j, len - j, factor, shoup, p);
+}
+
+TARGET_AVX2 static void real_update_avx2(double *row, const double *pivot, long len, double factor) {
+    const __m256d vf = _mm256_set1_pd(factor);
+    long j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m256d a = _mm256_loadu_pd(row + j);
+        _mm256_storeu_pd(row + j, _mm256_fnmadd_pd(vf, _mm256_loadu_pd(pivot + j), a));
+    }
+    real_update_scalar(row + j, pivot + j, len - j, factor);
+}
+
+// The 128 bit numerator is formed as (lo, hi) halves, shifted right by
+// the power of two in d and multiplied by the inverse of its odd part.
+// A shift count of 64 clears the high half, which is just what shift 0 needs
+TARGET_AVX2 static void bareiss_update_avx2(long long *row, const long long *pivot, long len, long long factor,
+                                            long long pivot_entry, divisor_t d) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i ve = _mm256_set1_epi64x(pivot_entry);
+    const __m256i vf = _mm256_set1_epi64x(factor);
+    const __m256i inv = _mm256_set1_epi64x((long long)d.inverse);
+    const __m128i right = _mm_cvtsi32_si128(d.shift);
+    const __m128i left = _mm_cvtsi32_si128(64 - d.shift);
+    long j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(row + j));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(pivot + j));
+        __m256i lo1 = mullo_u64_avx2(a, ve);
+        __m256i hi1 = mulhi_i64_avx2(a, ve);
+        __m256i lo2 = mullo_u64_avx2(vf, b);
+        __m256i hi2 = mulhi_i64_avx2(vf, b);
+        __m256i lo = _mm256_sub_epi64(lo1, lo2);
+        __m256i borrow = _mm256_cmpgt_epi64(_mm256_xor_si256(lo2, sign), _mm256_xor_si256(lo1, sign));
+        __m256i hi = _mm256_sub_epi64(_mm256_sub_epi64(hi1, hi2), _mm256_and_si256(borrow, one));
+        __m256i t = _mm256_or_si256(_mm256_srl_epi64(lo, right), _mm256_sll_epi64(hi, left));
+        _mm256_storeu_si256((__m256i *)(row + j), mullo_u64_avx2(t, inv));
+    }
+    bareiss_update_scalar(row + j, pivot + j, len - j, factor, pivot_entry, d);
+}
+
+static const kernels_t avx2_kernels = {
+    "avx2", mod_update_avx2, real_update_avx2, bareiss_update_avx2, small_lanes_avx2
+};
+
+TARGET_AVX512 static inline __m512i mulhi_u64_avx512(__m512i a, __m512i b) {
+    const __m512i mask = _mm512_set1_epi64(0xFFFFFFFF);
+    __m512i ah = _mm512_srli_epi64(a, 32);
+    __m512i bh = _mm512_srli_epi64(b, 32);
+    __m512i p00 = _mm512_mul_epu32(a, b);
+    __m512i p01 = _mm512_mul_epu32(a, bh);
+    __m512i p10 = _mm512_mul_epu32(ah, b);
+    __m512i p11 = _mm512_mul_epu32(ah, bh);
+    __m512i mid = _mm512_add_epi64(_mm512_srli_epi64(p00, 32),
+                                   _mm512_add_epi64(_mm512_and_si512(p01, mask), _mm512_and_si512(p10, mask)));
+    return _mm512_add_epi64(_mm512_add_epi64(p11, _mm512_srli_epi64(mid, 32)),
+                            _mm512_add_epi64(_mm512_srli_epi64(p01, 32), _mm512_srli_epi64(p10, 32)));
+}
+
+TARGET_AVX512 static inline __m512i mulhi_i64_avx512(__m512i a, __m512i b) {
+    __m512i hi = mulhi_u64_avx512(a, b);
+    hi = _mm512_sub_epi64(hi, _mm512_and_si512(_mm512_srai_epi64(a, 63), b));
+    return _mm512_sub_epi64(hi, _mm512_and_si512(_mm512_srai_epi64(b, 63), a));
+}
+
+TARGET_AVX512 static void mod_update_avx512(uint64_t *row, const uint64_t *pivot, long len, uint64_t factor, uint64_t shoup, uint64_t p) {
+    const __m512i vp = _mm512_set1_epi64((long long)p);
+    const __m512i vf = _mm512_set1_epi64((long long)factor);
+    const __m512i vs = _mm512_set1_epi64((long long)shoup);
+    long j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512i x = _mm512_loadu_si512(pivot + j);
+        __m512i a = _mm512_loadu_si512(row + j);
+        __m512i q = mulhi_u64_avx512(vs, x);
+        __m512i r = _mm512_sub_epi64(_mm512_mullo_epi64(vf, x), _mm512_mullo_epi64(q, vp));
+        // r - p wraps around exactly when r < p, the unsigned minimum
+        // is the reduced value in both this and the subtraction below
+        r = _mm512_min_epu64(r, _mm512_sub_epi64(r, vp));
+        __m512i d = _mm512_sub_epi64(a, r);
+        _mm512_storeu_si512(row + j, _mm512_min_epu64(d, _mm512_add_epi64(d, vp)));
+    }
+    mod_update_scalar(row + j, pivot + j, len - j, factor, shoup, p);
+}
+
+TARGET_AVX512 static void real_update_avx512(double *row, const double *pivot, long len, double factor) {
+    const __m512d vf = _mm512_set1_pd(factor);
+    long j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512d a = _mm512_loadu_pd(row + j);
+        _mm512_storeu_pd(row + j, _mm512_fnmadd_pd(vf, _mm512_loadu_pd(pivot + j), a));
+    }
+    real_update_scalar(row + j, pivot + j, len - j, factor);
+}
+
+TARGET_AVX512 static void bareiss_update_avx512(long long *row, const long long *pivot, long len, long long factor,
+                                                long long pivot_entry, divisor_t d) {
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i ve = _mm512_set1_epi64(pivot_entry);
+    const __m512i vf = _mm512_set1_epi64(factor);
+    const __m512i inv = _mm512_set1_epi64((long long)d.inverse);
+    const __m128i right = _mm_cvtsi32_si128(d.shift);
+    const __m128i left = _mm_cvtsi32_si128(64 - d.shift);
+    long j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512i a = _mm512_loadu_si512(row + j);
+        __m512i b = _mm512_loadu_si512(pivot + j);
+        __m512i lo1 = _mm512_mullo_epi64(a, ve);
+        __m512i lo2 = _mm512_mullo_epi64(vf, b);
+        __m512i hi = _mm512_sub_epi64(mulhi_i64_avx512(a, ve), mulhi_i64_avx512(vf, b));
+        __mmask8 borrow = _mm512_cmplt_epu64_mask(lo1, lo2);
+        hi = _mm512_mask_sub_epi64(hi, borrow, hi, one);
+        __m512i lo = _mm512_sub_epi64(lo1, lo2);
+        __m512i t = _mm512_or_si512(_mm512_srl_epi64(lo, right), _mm512_sll_epi64(hi, left));
+        _mm512_storeu_si512(row + j, _mm512_mullo_epi64(t, inv));
+    }
+    bareiss_update_scalar(row + j, pivot + j, len - j, factor, pivot_entry, d);
+}
+
+static const kernels_t avx512_kernels = {
+    "avx512", mod_update_avx512, real_update_avx512, bareiss_update_avx512, small_lanes_avx512
+};
+
+#endif
+
+// Pick the widest kernels the CPU supports (CPUID through the compiler
+// builtins), force_scalar keeps the portable ones for comparison
+void kernels_select(int force_scalar) {
+    kernels = &scalar_kernels;
+#if defined(__x86_64__)
+    if (force_scalar) {
+        return;
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        kernels = &avx512_kernels;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        kernels = &avx2_kernels;
+    }
+#else
+    (void)force_scalar;
+#endif
+}
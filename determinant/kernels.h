@@ -0,0 +1,47 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512dq")))
+#endif
+
+typedef struct kernels_st kernels_t;
+typedef struct divisor_st divisor_t;
+
+// Exact division by d = odd * 2^shift without a divide instruction: an
+// integer known to be a multiple of d is shifted right and multiplied by
+// the inverse of odd modulo 2^64
+struct divisor_st {
+    int shift;
+    uint64_t inverse;
+};
+
+// The row_i -= factor * row_k update of every elimination engine, one
+// entry per instruction set. Rows are len entries long and never alias
+//   mod_update:     row = row - factor * pivot (mod p), residues below
+//                   p < 2^62, shoup = kernel_shoup(factor, p)
+//   real_update:    row = row - factor * pivot
+//   bareiss_update: row = (row * pivot_entry - factor * pivot) / d, the
+//                   division is exact and the result fits 64 bits
+//   small_lanes:    determinants of one block of SMALL_LANES n x n
+//                   matrices in the layout of small_lanes_t
+struct kernels_st {
+    const char *name;
+    void (*mod_update)(uint64_t *row, const uint64_t *pivot, long len, uint64_t factor, uint64_t shoup, uint64_t p);
+    void (*real_update)(double *row, const double *pivot, long len, double factor);
+    void (*bareiss_update)(long long *row, const long long *pivot, long len, long long factor,
+                           long long pivot_entry, divisor_t d);
+    void (*small_lanes)(const int32_t *block, int n, long long *dets);
+};
+
+// Kernels in use, scalar until kernels_select picks the best the CPU has
+extern const kernels_t *kernels;
+
+void kernels_select(int force_scalar);
+uint64_t kernel_shoup(uint64_t factor, uint64_t p);
+divisor_t kernel_divisor(long long d);
+
+#endif
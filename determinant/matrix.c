@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <matrix.h>
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define ARENA_ALIGN 64
+
+
+void arena_init(arena_t *arena) {
+    arena_init_sized(arena, ARENA_BLOCK_SIZE);
+}
+
+// Arena with smaller blocks, for many short lived arenas of small matrices
+void arena_init_sized(arena_t *arena, size_t block_size) {
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->head = NULL;
+    arena->mappings = NULL;
+    arena->block_size = block_size;
+    arena->bytes = 0;
+}
+
+// Hand out cache line aligned memory from the current block, big
+// requests get a block of their own
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *block;
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    pthread_mutex_lock(&arena->lock);
+    block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        if (posix_memalign((void **)&block, ARENA_ALIGN, sizeof(arena_block_t) + ARENA_ALIGN + block_size) != 0) {
+            perror("posix_memalign");
+            exit(EXIT_FAILURE);
+        }
+        block->size = block_size;
+        // Start of data rounded up so every allocation is aligned
+        block->used = (ARENA_ALIGN - (size_t)block->data % ARENA_ALIGN) % ARENA_ALIGN;
+        block->size += block->used;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    ptr = block->data + block->used;
+    block->used += size;
+    arena->bytes += size;
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+// Hand a mapped region over to the arena, it is unmapped on release
+void arena_track_mapping(arena_t *arena, void *addr, size_t len) {
+    arena_mapping_t *mapping = (arena_mapping_t *)arena_alloc(arena, sizeof(arena_mapping_t));
+    mapping->addr = addr;
+    mapping->len = len;
+    pthread_mutex_lock(&arena->lock);
+    mapping->next = arena->mappings;
+    arena->mappings = mapping;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_release(arena_t *arena) {
+    arena_block_t *block = arena->head;
+    // Mapping records live in the blocks, walk them before freeing
+    for (arena_mapping_t *mapping = arena->mappings; mapping != NULL; mapping = mapping->next) {
+        munmap(mapping->addr, mapping->len);
+    }
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->mappings = NULL;
+    arena->bytes = 0;
+    pthread_mutex_destroy(&arena->lock);
+}
+
+matrix_t *matrix_alloc(arena_t *arena, int n) {
+    matrix_t *matrix = (matrix_t *)arena_alloc(arena, sizeof(matrix_t));
+    matrix->n = n;
+    matrix->stride = n;
+    matrix->data = (int *)arena_alloc(arena, (size_t)n * n * sizeof(int));
+    return matrix;
+}
+
+// 64 bit hash of a byte range, eight bytes per step with a
+// multiply-xorshift mix (murmur style finalizer)
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+    uint64_t word;
+
+    while (len >= 8) {
+        memcpy(&word, p, 8);
+        h ^= word * 0xBF58476D1CE4E5B9ULL;
+        h = (h << 27 | h >> 37) * 0x94D049BB133111EBULL;
+        p += 8;
+        len -= 8;
+    }
+    word = 0;
+    memcpy(&word, p, len);
+    h ^= word * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+    h *= 0xD6E8FEB86659FD93ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// View covering the whole matrix, rows and cols must hold n entries
+void view_of_matrix(view_t *view, const matrix_t *matrix, int *rows, int *cols) {
+    for (int i = 0; i < matrix->n; i++) {
+        rows[i] = i;
+        cols[i] = i;
+    }
+    view->base = matrix;
+    view->n = matrix->n;
+    view->rows = rows;
+    view->cols = cols;
+}
@@ -0,0 +1,66 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct arena_block_st arena_block_t;
+typedef struct arena_st arena_t;
+typedef struct matrix_st matrix_t;
+typedef struct view_st view_t;
+
+// Bump allocator, everything taken from it is released at once
+// by arena_release, there is no per allocation free
+struct arena_block_st {
+    arena_block_t *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// Files mapped for the lifetime of the arena, see arena_track_mapping
+typedef struct arena_mapping_st {
+    struct arena_mapping_st *next;
+    void *addr;
+    size_t len;
+} arena_mapping_t;
+
+struct arena_st {
+    pthread_mutex_t lock;
+    arena_block_t *head;
+    arena_mapping_t *mappings;
+    size_t block_size;
+    size_t bytes;
+};
+
+// Square matrix in one contiguous row major buffer, rows are stride
+// entries apart (n for matrices built here, padded in binary files)
+struct matrix_st {
+    int n;
+    int stride;
+    int *data;
+};
+
+// Square submatrix of base made of the listed rows and columns, the index
+// arrays belong to whoever formed the view, no entry is ever copied
+struct view_st {
+    const matrix_t *base;
+    int n;
+    const int *rows;
+    const int *cols;
+};
+
+#define MAT(m, i, j) ((m)->data[(long)(i) * (m)->stride + (j)])
+#define VIEW(v, i, j) ((v)->base->data[(long)(v)->rows[i] * (v)->base->stride + (v)->cols[j]])
+
+void arena_init(arena_t *arena);
+void arena_init_sized(arena_t *arena, size_t block_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_track_mapping(arena_t *arena, void *addr, size_t len);
+void arena_release(arena_t *arena);
+matrix_t *matrix_alloc(arena_t *arena, int n);
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+void view_of_matrix(view_t *view, const matrix_t *matrix, int *rows, int *cols);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <determinant.h>
+#include <kernels.h>
+#include <modular.h>
+
+typedef struct modular_st {
+    const matrix_t *matrix;
+    const uint64_t *primes;
+    uint64_t *residues;
+} modular_t;
+
+
+// Deterministic Miller-Rabin, these bases decide every 64 bit integer
+static int is_prime(uint64_t n) {
+    static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    uint64_t d = n - 1;
+    int s = 0;
+
+    for (int i = 0; i < 12; i++) {
+        if (n % bases[i] == 0) {
+            return n == bases[i];
+        }
+    }
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s += 1;
+    }
+    for (int i = 0; i < 12; i++) {
+        uint64_t x = pow_mod(bases[i], d, n);
+        if (x == 1 || x == n - 1) {
+            continue;
+        }
+        int r;
+        for (r = 1; r < s; r++) {
+            x = mul_mod(x, x, n);
+            if (x == n - 1) {
+                break;
+            }
+        }
+        if (r == s) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The count largest primes below 2^62, in decreasing order
+void modular_find_primes(uint64_t *primes, int count) {
+    uint64_t candidate = (1ULL << MODULAR_PRIME_BITS) - 1;
+    for (int i = 0; i < count; candidate -= 2) {
+        if (is_prime(candidate)) {
+            primes[i++] = candidate;
+        }
+    }
+}
+
+// Determinant modulo p by Gaussian elimination over GF(p)
+uint64_t modular_det_mod(const matrix_t *matrix, uint64_t p) {
+    int n = matrix->n;
+    uint64_t *a = (uint64_t *)malloc((long)n * n * sizeof(uint64_t));
+    uint64_t det = 1;
+
+    pool_count_minor_bytes(pool, (long)n * n * sizeof(uint64_t));
+    // Entries are ints, far below p, so one correction reduces them
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[(long)i * n + j] = residue(MAT(matrix, i, j), p);
+        }
+    }
+
+    for (int k = 0; k < n; k++) {
+        uint64_t *pivot_row = a + (long)k * n;
+        int piv = k;
+        while (piv < n && a[(long)piv * n + k] == 0) {
+            piv++;
+        }
+        if (piv == n) {
+            det = 0;
+            break;
+        }
+        if (piv != k) {
+            uint64_t *other = a + (long)piv * n;
+            for (int j = k; j < n; j++) {
+                uint64_t tmp = pivot_row[j];
+                pivot_row[j] = other[j];
+                other[j] = tmp;
+            }
+            det = det == 0 ? 0 : p - det;
+        }
+        det = mul_mod(det, pivot_row[k], p);
+        uint64_t inv = inv_mod(pivot_row[k], p);
+        for (int i = k + 1; i < n; i++) {
+            uint64_t *row = a + (long)i * n;
+            if (row[k] == 0) {
+                continue;
+            }
+            uint64_t factor = mul_mod(row[k], inv, p);
+            kernels->mod_update(row + k + 1, pivot_row + k + 1, n - k - 1, factor, kernel_shoup(factor, p), p);
+        }
+    }
+    free(a);
+    return det;
+}
+
+// Residues for primes [begin, end), each prime is an independent
+// elimination so chunks share nothing but the input matrix
+static void modular_primes(long begin, long end, void *arg) {
+    modular_t *mod = (modular_t *)arg;
+    const matrix_t *matrix = local_matrix(mod->matrix);
+    for (long i = begin; i < end; i++) {
+        mod->residues[i] = modular_det_mod(matrix, mod->primes[i]);
+    }
+}
+
+// c * x mod p for a constant c with shoup = kernel_shoup(c, p)
+static inline uint64_t mul_shoup(uint64_t x, uint64_t c, uint64_t shoup, uint64_t p) {
+    uint64_t q = (uint64_t)(((unsigned __int128)shoup * x) >> 64);
+    uint64_t r = c * x - q * p;
+    return r >= p ? r - p : r;
+}
+
+// Everything of Garner's algorithm that only depends on the primes: the
+// inverse of p_0 .. p_i-1 modulo p_i and every p_j modulo p_i with its
+// Shoup constant, so a value costs no division at all
+void modular_crt_init(modular_crt_t *crt, const uint64_t *primes, int count) {
+    crt->count = count;
+    crt->primes = primes;
+    crt->inverses = (uint64_t *)malloc(count * sizeof(uint64_t));
+    crt->radix = (uint64_t *)malloc((long)count * count * sizeof(uint64_t));
+    crt->shoup = (uint64_t *)malloc((long)count * count * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        uint64_t p = primes[i];
+        uint64_t prefix = 1;
+        for (int j = 0; j < i; j++) {
+            uint64_t radix = primes[j] % p;
+            crt->radix[(long)i * count + j] = radix;
+            crt->shoup[(long)i * count + j] = kernel_shoup(radix, p);
+            prefix = mul_mod(prefix, radix, p);
+        }
+        crt->inverses[i] = inv_mod(prefix, p);
+    }
+}
+
+void modular_crt_free(modular_crt_t *crt) {
+    free(crt->inverses);
+    free(crt->radix);
+    free(crt->shoup);
+}
+
+// Integer congruent to every residue, in the symmetric range around zero
+// of the product of the primes. Garner's algorithm turns the residues
+// into mixed radix digits with word sized arithmetic only, big integers
+// are needed just for the final Horner evaluation
+static void crt_reconstruct(const modular_crt_t *crt, const uint64_t *residues, bigint_t *out) {
+    int count = crt->count;
+    const uint64_t *primes = crt->primes;
+    uint64_t *digit = (uint64_t *)malloc(count * sizeof(uint64_t));
+    bigint_t modulus;
+    bigint_t term;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t p = primes[i];
+        const uint64_t *radix = crt->radix + (long)i * count;
+        const uint64_t *shoup = crt->shoup + (long)i * count;
+        uint64_t partial = 0;
+        // partial = digit_0 + digit_1 p_0 + .. modulo p. All primes are
+        // above 2^61, so a digit is below 2p and one subtraction reduces it
+        for (int j = i - 1; j >= 0; j--) {
+            uint64_t d = digit[j] >= p ? digit[j] - p : digit[j];
+            partial = mul_shoup(partial, radix[j], shoup[j], p) + d;
+            partial = partial >= p ? partial - p : partial;
+        }
+        digit[i] = mul_mod(sub_mod(residues[i], partial, p), crt->inverses[i], p);
+    }
+
+    bigint_init(&modulus);
+    bigint_init(&term);
+    bigint_set_i64(out, (long long)digit[count - 1]);
+    bigint_set_i64(&modulus, (long long)primes[count - 1]);
+    for (int i = count - 2; i >= 0; i--) {
+        bigint_mul_i64(out, out, (long long)primes[i]);
+        bigint_set_i64(&term, (long long)digit[i]);
+        bigint_add(out, out, &term);
+        bigint_mul_i64(&modulus, &modulus, (long long)primes[i]);
+    }
+
+    // Values above half the modulus stand for negative determinants
+    bigint_add(&term, out, out);
+    bigint_sub(&term, &term, &modulus);
+    if (!term.neg && !bigint_is_zero(&term)) {
+        bigint_sub(out, out, &modulus);
+    }
+    bigint_free(&modulus);
+    bigint_free(&term);
+    free(digit);
+}
+
+// Primes needed for a determinant of at most bits bits, sign included
+int modular_prime_count(double bits) {
+    return (int)((bits + MODULAR_EXTRA_BITS) / MODULAR_BITS_PER_PRIME) + 1;
+}
+
+// Exact determinant from its residues modulo count primes
+void modular_combine(const uint64_t *primes, const uint64_t *residues, int count, det_t *det) {
+    modular_crt_t crt;
+    modular_crt_init(&crt, primes, count);
+    modular_crt_combine(&crt, residues, det);
+    modular_crt_free(&crt);
+}
+
+// modular_combine over the primes of crt, set up once for many values
+void modular_crt_combine(const modular_crt_t *crt, const uint64_t *residues, det_t *det) {
+    if (crt->count == 1) {
+        uint64_t r = residues[0];
+        uint64_t p = crt->primes[0];
+        long long value = r > p / 2 ? -(long long)(p - r) : (long long)r;
+        det_set_i128(det, value, DET_INT64);
+    }
+    else {
+        bigint_t value;
+        bigint_init(&value);
+        crt_reconstruct(crt, residues, &value);
+        det_set_big(det, &value);
+        bigint_free(&value);
+    }
+}
+
+// Multi-modular determinant: the exact value modulo enough 62 bit primes
+// for their product to exceed twice Hadamard's bound, one elimination per
+// prime on the pool, then the Chinese remainder theorem puts it together
+void modular_determinant(const matrix_t *matrix, det_t *det) {
+    int count = modular_prime_count(hadamard_bits(matrix, matrix->n));
+    uint64_t *primes = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint64_t *residues = (uint64_t *)malloc(count * sizeof(uint64_t));
+    modular_t mod = { .matrix = matrix, .primes = primes, .residues = residues };
+
+    modular_find_primes(primes, count);
+    pool_parallel_for(pool, 0, count, 1, modular_primes, &mod);
+    modular_combine(primes, residues, count, det);
+    free(primes);
+    free(residues);
+}
@@ -0,0 +1,66 @@
+#ifndef MODULAR_H
+#define MODULAR_H
+
+#include <stdint.h>
+
+#include <result.h>
+
+// Primes are taken downwards from 2^62, so a residue plus a residue
+// still fits 64 bits and a product fits the 128 bit intermediate
+#define MODULAR_PRIME_BITS 62
+// Every prime used is above 2^61, counted as this many bits of modulus
+#define MODULAR_BITS_PER_PRIME 61
+// One bit for the sign of the result, one for rounding in the bound
+#define MODULAR_EXTRA_BITS 2
+
+typedef struct modular_crt_st modular_crt_t;
+
+// What putting values together over a fixed set of primes needs besides
+// the residues, see modular_crt_init
+struct modular_crt_st {
+    int count;
+    const uint64_t *primes;
+    uint64_t *inverses;
+    uint64_t *radix;
+    uint64_t *shoup;
+};
+
+static inline uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t p) {
+    return (uint64_t)((unsigned __int128)a * b % p);
+}
+
+static inline uint64_t sub_mod(uint64_t a, uint64_t b, uint64_t p) {
+    return a >= b ? a - b : a + (p - b);
+}
+
+static inline uint64_t pow_mod(uint64_t a, uint64_t e, uint64_t p) {
+    uint64_t r = 1;
+    while (e > 0) {
+        if (e & 1) {
+            r = mul_mod(r, a, p);
+        }
+        a = mul_mod(a, a, p);
+        e >>= 1;
+    }
+    return r;
+}
+
+// Residue of a value well below p in magnitude, as matrix entries are
+static inline uint64_t residue(long long value, uint64_t p) {
+    return value < 0 ? p - (uint64_t)(-value) : (uint64_t)value;
+}
+
+// Inverse of a nonzero residue, p is prime
+static inline uint64_t inv_mod(uint64_t a, uint64_t p) {
+    return pow_mod(a, p - 2, p);
+}
+
+int modular_prime_count(double bits);
+void modular_find_primes(uint64_t *primes, int count);
+void modular_combine(const uint64_t *primes, const uint64_t *residues, int count, det_t *det);
+void modular_crt_init(modular_crt_t *crt, const uint64_t *primes, int count);
+void modular_crt_free(modular_crt_t *crt);
+void modular_crt_combine(const modular_crt_t *crt, const uint64_t *residues, det_t *det);
+uint64_t modular_det_mod(const matrix_t *matrix, uint64_t p);
+
+#endif
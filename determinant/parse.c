@@ -0,0 +1,656 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <determinant.h>
+#include <binfmt.h>
+
+typedef struct scanner_st {
+    const char *p;
+    const char *end;
+    const char *line_start;
+    const char *name;
+    int line;
+} scanner_t;
+
+
+static void scan_error(const scanner_t *scan, const char *msg) {
+    fprintf(stderr, "%s:%i:%li: %s\n", scan->name, scan->line, (long)(scan->p - scan->line_start) + 1, msg);
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void skip_blanks(scanner_t *scan) {
+    while (scan->p < scan->end && is_blank(*scan->p)) {
+        scan->p++;
+    }
+}
+
+static void next_line(scanner_t *scan) {
+    // Caller is at a newline or at the end of input
+    if (scan->p < scan->end) {
+        scan->p++;
+    }
+    scan->line += 1;
+    scan->line_start = scan->p;
+}
+
+// Skip lines holding nothing but whitespace
+static void skip_empty_lines(scanner_t *scan) {
+    while (scan->p < scan->end) {
+        const char *save = scan->p;
+        skip_blanks(scan);
+        if (scan->p < scan->end && *scan->p == '\n') {
+            next_line(scan);
+        }
+        else {
+            scan->p = save;
+            return;
+        }
+    }
+}
+
+// One decimal integer with optional sign, it has to fit an int and be
+// followed by whitespace or the end of input
+static int scan_int(scanner_t *scan, int *value) {
+    int neg = 0;
+    long long acc = 0;
+    const char *start = scan->p;
+
+    if (*scan->p == '-' || *scan->p == '+') {
+        neg = *scan->p == '-';
+        scan->p++;
+    }
+    if (scan->p == scan->end || *scan->p < '0' || *scan->p > '9') {
+        scan->p = start;
+        scan_error(scan, "expected an integer");
+        return -1;
+    }
+    while (scan->p < scan->end && *scan->p >= '0' && *scan->p <= '9') {
+        acc = acc * 10 + (*scan->p - '0');
+        if (acc > (long long)INT_MAX + 1) {
+            scan->p = start;
+            scan_error(scan, "integer out of range");
+            return -1;
+        }
+        scan->p++;
+    }
+    if (scan->p < scan->end && !is_blank(*scan->p) && *scan->p != '\n') {
+        scan_error(scan, "unexpected character");
+        return -1;
+    }
+    if (neg) {
+        acc = -acc;
+    }
+    if (acc > INT_MAX) {
+        scan->p = start;
+        scan_error(scan, "integer out of range");
+        return -1;
+    }
+    *value = (int)acc;
+    return 0;
+}
+
+// One decimal floating point number as strtod reads it, followed by
+// whitespace or the end of input. The token is copied out first since
+// the buffer is not NUL terminated
+static int scan_double(scanner_t *scan, double *value) {
+    char token[64];
+    char *end;
+    size_t len = 0;
+
+    while (scan->p + len < scan->end && !is_blank(scan->p[len]) && scan->p[len] != '\n') {
+        len += 1;
+    }
+    if (len == 0 || len >= sizeof(token)) {
+        scan_error(scan, len == 0 ? "expected a number" : "number too long");
+        return -1;
+    }
+    memcpy(token, scan->p, len);
+    token[len] = '\0';
+    *value = strtod(token, &end);
+    if (end != token + len) {
+        scan_error(scan, "expected a number");
+        return -1;
+    }
+    if (!isfinite(*value)) {
+        scan_error(scan, "number out of range");
+        return -1;
+    }
+    scan->p += len;
+    return 0;
+}
+
+// Integers of one line into row, step entries apart, at most max of
+// them. Returns how many were read or -1 after reporting an error
+static int scan_row(scanner_t *scan, int *row, int max, int step) {
+    int count = 0;
+    skip_blanks(scan);
+    while (scan->p < scan->end && *scan->p != '\n') {
+        if (count == max) {
+            scan_error(scan, "row is longer than the first row");
+            return -1;
+        }
+        if (scan_int(scan, &row[count * step]) != 0) {
+            return -1;
+        }
+        count += 1;
+        skip_blanks(scan);
+    }
+    return count;
+}
+
+// Parse a whitespace separated square matrix from memory in a single
+// pass: the first row gives the dimension, every following row is
+// scanned straight into the matrix buffer. When consumed is NULL the
+// matrix must be all that is left in buf, otherwise parsing stops after
+// the last row and consumed receives the offset just past it. Errors are
+// reported with line and column, NULL is returned
+matrix_t *parse_text_matrix(const char *buf, size_t len, const char *name, arena_t *arena, size_t *consumed) {
+    scanner_t scan = { .p = buf, .end = buf + len, .line_start = buf, .name = name, .line = 1 };
+    matrix_t *matrix;
+    int *first;
+    int n;
+
+    skip_empty_lines(&scan);
+    if (scan.p == scan.end) {
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+
+    // The first row is read into scratch space that grows as needed
+    int cap = 64;
+    first = (int *)malloc(cap * sizeof(int));
+    n = 0;
+    skip_blanks(&scan);
+    while (scan.p < scan.end && *scan.p != '\n') {
+        if (n == cap) {
+            cap *= 2;
+            first = (int *)realloc(first, cap * sizeof(int));
+        }
+        if (scan_int(&scan, &first[n]) != 0) {
+            free(first);
+            return NULL;
+        }
+        n += 1;
+        skip_blanks(&scan);
+    }
+    if (n == 0) {
+        free(first);
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+    matrix = matrix_alloc(arena, n);
+    memcpy(matrix->data, first, n * sizeof(int));
+    free(first);
+    next_line(&scan);
+
+    for (int row = 1; row < n; row++) {
+        int count;
+        if (scan.p == scan.end) {
+            scan_error(&scan, "matrix has fewer rows than columns");
+            return NULL;
+        }
+        if ((count = scan_row(&scan, &MAT(matrix, row, 0), n, 1)) < 0) {
+            return NULL;
+        }
+        if (count != n) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "row has %i entries, expected %i", count, n);
+            scan_error(&scan, msg);
+            return NULL;
+        }
+        next_line(&scan);
+    }
+
+    if (consumed != NULL) {
+        *consumed = scan.p - buf;
+        return matrix;
+    }
+    skip_empty_lines(&scan);
+    skip_blanks(&scan);
+    if (scan.p != scan.end) {
+        scan_error(&scan, "unexpected data after the last row");
+        return NULL;
+    }
+    return matrix;
+}
+
+// parse_text_matrix into the next slot of lanes: the first row goes
+// through scratch space until it gives n, the others are scanned straight
+// into the slot with the lane stride. Returns 1 when the matrix was
+// added, 0 when it does not fit lanes (size, room or bound) and -1 after
+// reporting an error
+int parse_text_lanes(const char *buf, size_t len, const char *name, small_lanes_t *lanes) {
+    scanner_t scan = { .p = buf, .end = buf + len, .line_start = buf, .name = name, .line = 1 };
+    int first[SMALL_MAX_N];
+    int32_t *slot;
+    int n = 0;
+
+    skip_empty_lines(&scan);
+    if (scan.p == scan.end) {
+        scan_error(&scan, "no matrix found");
+        return -1;
+    }
+    skip_blanks(&scan);
+    while (scan.p < scan.end && *scan.p != '\n') {
+        if (n == SMALL_MAX_N) {
+            return 0;
+        }
+        if (scan_int(&scan, &first[n]) != 0) {
+            return -1;
+        }
+        n += 1;
+        skip_blanks(&scan);
+    }
+    if (n == 0) {
+        scan_error(&scan, "no matrix found");
+        return -1;
+    }
+    if ((slot = small_lanes_start(lanes, n)) == NULL) {
+        return 0;
+    }
+    for (int j = 0; j < n; j++) {
+        slot[j * SMALL_LANES] = first[j];
+    }
+    next_line(&scan);
+
+    for (int row = 1; row < n; row++) {
+        int count;
+        if (scan.p == scan.end) {
+            scan_error(&scan, "matrix has fewer rows than columns");
+            return -1;
+        }
+        if ((count = scan_row(&scan, slot + row * n * SMALL_LANES, n, SMALL_LANES)) < 0) {
+            return -1;
+        }
+        if (count != n) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "row has %i entries, expected %i", count, n);
+            scan_error(&scan, msg);
+            return -1;
+        }
+        next_line(&scan);
+    }
+
+    skip_empty_lines(&scan);
+    skip_blanks(&scan);
+    if (scan.p != scan.end) {
+        scan_error(&scan, "unexpected data after the last row");
+        return -1;
+    }
+    return small_lanes_commit(lanes);
+}
+
+// Map a whole input file privately, copy on write, for the form_*
+// loaders. Text is read once front to back and advised so, a binary
+// matrix may be used in place. Errors end the program
+static char *map_input(const char *filename, size_t *len) {
+    struct stat st;
+    char *buf;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: empty file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    buf = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    if (!is_binary_matrix(buf, st.st_size)) {
+        madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    }
+    *len = st.st_size;
+    return buf;
+}
+
+// Map the whole file and load it in place. Binary files become the
+// matrix buffer as they are and stay mapped until the arena goes away,
+// text is scanned straight into an arena buffer
+matrix_t *form__square_matrix(const char *filename, arena_t *arena) {
+    matrix_t *matrix;
+    size_t len;
+    char *buf = map_input(filename, &len);
+
+    if (is_binary_matrix(buf, len)) {
+        arena_track_mapping(arena, buf, len);
+        matrix = load_binary_matrix(buf, len, filename, arena, NULL);
+    }
+    else {
+        matrix = parse_text_matrix(buf, len, filename, arena, NULL);
+        munmap(buf, len);
+    }
+    if (matrix == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return matrix;
+}
+
+// n rows of right hand sides for factor_solve, as many columns as the
+// first row has, all in one row major array of n * cols entries. Errors
+// are reported with line and column, NULL is returned
+int *parse_text_rhs(const char *buf, size_t len, const char *name, int n, int *cols) {
+    scanner_t scan = { .p = buf, .end = buf + len, .line_start = buf, .name = name, .line = 1 };
+    int *rhs;
+    int cap = 64;
+    int k = 0;
+
+    skip_empty_lines(&scan);
+    if (scan.p == scan.end) {
+        scan_error(&scan, "no right hand side found");
+        return NULL;
+    }
+    rhs = (int *)malloc(cap * sizeof(int));
+    skip_blanks(&scan);
+    while (scan.p < scan.end && *scan.p != '\n') {
+        if (k == cap) {
+            cap *= 2;
+            rhs = (int *)realloc(rhs, cap * sizeof(int));
+        }
+        if (scan_int(&scan, &rhs[k]) != 0) {
+            free(rhs);
+            return NULL;
+        }
+        k += 1;
+        skip_blanks(&scan);
+    }
+    if (k == 0) {
+        free(rhs);
+        scan_error(&scan, "no right hand side found");
+        return NULL;
+    }
+    rhs = (int *)realloc(rhs, (long)n * k * sizeof(int));
+    next_line(&scan);
+
+    for (int row = 1; row < n; row++) {
+        int count;
+        if (scan.p == scan.end) {
+            scan_error(&scan, "right hand side has fewer rows than the matrix");
+            goto fail;
+        }
+        if ((count = scan_row(&scan, rhs + (long)row * k, k, 1)) < 0) {
+            goto fail;
+        }
+        if (count != k) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "row has %i entries, expected %i", count, k);
+            scan_error(&scan, msg);
+            goto fail;
+        }
+        next_line(&scan);
+    }
+
+    skip_empty_lines(&scan);
+    skip_blanks(&scan);
+    if (scan.p != scan.end) {
+        scan_error(&scan, "unexpected data after the last row");
+        goto fail;
+    }
+    *cols = k;
+    return rhs;
+
+fail:
+    free(rhs);
+    return NULL;
+}
+
+// Load a text file of right hand sides for an n x n matrix
+int *form_rhs(const char *filename, int n, int *cols) {
+    size_t len;
+    char *buf = map_input(filename, &len);
+    int *rhs = parse_text_rhs(buf, len, filename, n, cols);
+
+    munmap(buf, len);
+    if (rhs == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return rhs;
+}
+
+// Parse a text matrix straight into compressed rows: each line is scanned
+// into one scratch row and only its nonzeros are kept, so memory follows
+// the number of nonzeros rather than n^2
+csr_t *parse_text_sparse(const char *buf, size_t len, const char *name, arena_t *arena) {
+    scanner_t scan = { .p = buf, .end = buf + len, .line_start = buf, .name = name, .line = 1 };
+    csr_t *csr = NULL;
+    int *row;
+    int *col;
+    int *val;
+    long cap;
+    long nnz = 0;
+    int n = 0;
+
+    skip_empty_lines(&scan);
+    if (scan.p == scan.end) {
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+
+    // The first row sizes the scratch row, same as parse_text_matrix
+    int row_cap = 64;
+    row = (int *)malloc(row_cap * sizeof(int));
+    skip_blanks(&scan);
+    while (scan.p < scan.end && *scan.p != '\n') {
+        if (n == row_cap) {
+            row_cap *= 2;
+            row = (int *)realloc(row, row_cap * sizeof(int));
+        }
+        if (scan_int(&scan, &row[n]) != 0) {
+            free(row);
+            return NULL;
+        }
+        n += 1;
+        skip_blanks(&scan);
+    }
+    if (n == 0) {
+        free(row);
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+
+    cap = 4L * n + 16;
+    col = (int *)malloc(cap * sizeof(int));
+    val = (int *)malloc(cap * sizeof(int));
+    csr = (csr_t *)arena_alloc(arena, sizeof(csr_t));
+    csr->n = n;
+    csr->row_ptr = (long *)arena_alloc(arena, (n + 1) * sizeof(long));
+    csr->row_ptr[0] = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            int count;
+            if (scan.p == scan.end) {
+                scan_error(&scan, "matrix has fewer rows than columns");
+                goto fail;
+            }
+            if ((count = scan_row(&scan, row, n, 1)) < 0) {
+                goto fail;
+            }
+            if (count != n) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "row has %i entries, expected %i", count, n);
+                scan_error(&scan, msg);
+                goto fail;
+            }
+        }
+        for (int j = 0; j < n; j++) {
+            if (row[j] == 0) {
+                continue;
+            }
+            if (nnz == cap) {
+                cap *= 2;
+                col = (int *)realloc(col, cap * sizeof(int));
+                val = (int *)realloc(val, cap * sizeof(int));
+            }
+            col[nnz] = j;
+            val[nnz] = row[j];
+            nnz += 1;
+        }
+        csr->row_ptr[i + 1] = nnz;
+        next_line(&scan);
+    }
+
+    skip_empty_lines(&scan);
+    skip_blanks(&scan);
+    if (scan.p != scan.end) {
+        scan_error(&scan, "unexpected data after the last row");
+        goto fail;
+    }
+    csr->nnz = nnz;
+    csr->col = (int *)arena_alloc(arena, (nnz + 1) * sizeof(int));
+    csr->val = (int *)arena_alloc(arena, (nnz + 1) * sizeof(int));
+    memcpy(csr->col, col, nnz * sizeof(int));
+    memcpy(csr->val, val, nnz * sizeof(int));
+    free(row);
+    free(col);
+    free(val);
+    return csr;
+
+fail:
+    free(row);
+    free(col);
+    free(val);
+    return NULL;
+}
+
+// Load a file for the sparse engines. Binary files are viewed in place
+// just long enough to pick out the nonzeros, then unmapped
+csr_t *form_sparse_matrix(const char *filename, arena_t *arena) {
+    csr_t *csr = NULL;
+    size_t len;
+    char *buf = map_input(filename, &len);
+
+    if (is_binary_matrix(buf, len)) {
+        matrix_t *matrix = load_binary_matrix(buf, len, filename, arena, NULL);
+        if (matrix != NULL) {
+            csr = csr_from_matrix(matrix, arena);
+        }
+    }
+    else {
+        csr = parse_text_sparse(buf, len, filename, arena);
+    }
+    munmap(buf, len);
+    if (csr == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return csr;
+}
+
+// parse_text_matrix for --real: the same layout with entries read as
+// doubles, the whole input must be the one matrix
+rmatrix_t *parse_text_real(const char *buf, size_t len, const char *name, arena_t *arena) {
+    scanner_t scan = { .p = buf, .end = buf + len, .line_start = buf, .name = name, .line = 1 };
+    rmatrix_t *matrix;
+    double *first;
+    int n = 0;
+
+    skip_empty_lines(&scan);
+    if (scan.p == scan.end) {
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+
+    int cap = 64;
+    first = (double *)malloc(cap * sizeof(double));
+    skip_blanks(&scan);
+    while (scan.p < scan.end && *scan.p != '\n') {
+        if (n == cap) {
+            cap *= 2;
+            first = (double *)realloc(first, cap * sizeof(double));
+        }
+        if (scan_double(&scan, &first[n]) != 0) {
+            free(first);
+            return NULL;
+        }
+        n += 1;
+        skip_blanks(&scan);
+    }
+    if (n == 0) {
+        free(first);
+        scan_error(&scan, "no matrix found");
+        return NULL;
+    }
+    matrix = rmatrix_alloc(arena, n);
+    memcpy(matrix->data, first, n * sizeof(double));
+    free(first);
+    next_line(&scan);
+
+    for (int row = 1; row < n; row++) {
+        int count = 0;
+        if (scan.p == scan.end) {
+            scan_error(&scan, "matrix has fewer rows than columns");
+            return NULL;
+        }
+        skip_blanks(&scan);
+        while (scan.p < scan.end && *scan.p != '\n') {
+            if (count == n) {
+                scan_error(&scan, "row is longer than the first row");
+                return NULL;
+            }
+            if (scan_double(&scan, &RMAT(matrix, row, count)) != 0) {
+                return NULL;
+            }
+            count += 1;
+            skip_blanks(&scan);
+        }
+        if (count != n) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "row has %i entries, expected %i", count, n);
+            scan_error(&scan, msg);
+            return NULL;
+        }
+        next_line(&scan);
+    }
+
+    skip_empty_lines(&scan);
+    skip_blanks(&scan);
+    if (scan.p != scan.end) {
+        scan_error(&scan, "unexpected data after the last row");
+        return NULL;
+    }
+    return matrix;
+}
+
+// Load a file for --real. Binary files hold integers, they are widened
+// to doubles and unmapped
+rmatrix_t *form_real_matrix(const char *filename, arena_t *arena) {
+    rmatrix_t *matrix = NULL;
+    size_t len;
+    char *buf = map_input(filename, &len);
+
+    if (is_binary_matrix(buf, len)) {
+        matrix_t *ints = load_binary_matrix(buf, len, filename, arena, NULL);
+        if (ints != NULL) {
+            matrix = rmatrix_alloc(arena, ints->n);
+            for (int i = 0; i < ints->n; i++) {
+                for (int j = 0; j < ints->n; j++) {
+                    RMAT(matrix, i, j) = MAT(ints, i, j);
+                }
+            }
+        }
+    }
+    else {
+        matrix = parse_text_real(buf, len, filename, arena);
+    }
+    munmap(buf, len);
+    if (matrix == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return matrix;
+}
@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+
+// Subsets are walked in this many Gray code chunks, each one restarts
+// its row sums from scratch and leaves one partial sum
+#define PERMANENT_CHUNKS 1024
+// Widest accumulator of the wide kernel, in 64 bit limbs
+#define PERMANENT_MAX_LIMBS 32
+// 2^n subsets, past this a run would not finish anyway
+#define PERMANENT_MAX_N 48
+
+typedef struct ryser_st ryser_t;
+
+// cols holds the matrix column by column, so adding a column to the row
+// sums is a contiguous walk. partial has one accumulator per chunk
+struct ryser_st {
+    int n;
+    int limbs;
+    int shift;
+    long long *cols;
+    void *partial;
+};
+
+// Row sums over the columns of the Gray code subset of index k
+static void ryser_start(const ryser_t *ry, uint64_t k, long long *sums) {
+    uint64_t gray = k ^ (k >> 1);
+    memset(sums, 0, ry->n * sizeof(long long));
+    for (int j = 0; j < ry->n; j++) {
+        if (gray >> j & 1) {
+            for (int i = 0; i < ry->n; i++) {
+                sums[i] += ry->cols[(long)j * ry->n + i];
+            }
+        }
+    }
+}
+
+// Moves the row sums from subset k - 1 to subset k, which differ in
+// column ctz(k), and returns whether the subset has an odd size now
+static inline int ryser_step(const ryser_t *ry, uint64_t k, long long *sums, int odd) {
+    int j = __builtin_ctzll(k);
+    const long long *col = ry->cols + (long)j * ry->n;
+    if ((k ^ (k >> 1)) >> j & 1) {
+        for (int i = 0; i < ry->n; i++) {
+            sums[i] += col[i];
+        }
+    }
+    else {
+        for (int i = 0; i < ry->n; i++) {
+            sums[i] -= col[i];
+        }
+    }
+    return !odd;
+}
+
+// Ryser: perm A = (-1)^n sum over column subsets S of (-1)^|S| times the
+// product of the row sums over S. Each chunk adds up its subsets into a
+// type accumulator without allocating, the width table picked type so
+// that neither a product nor a partial sum overflows
+#define DEFINE_RYSER_CHUNKS(name, type)                                      \
+    static void name(long begin, long end, void *arg) {                      \
+        ryser_t *ry = (ryser_t *)arg;                                        \
+        long long sums[ry->n];                                               \
+        for (long c = begin; c < end; c++) {                                 \
+            uint64_t k = (uint64_t)c << ry->shift;                           \
+            uint64_t last = k + (1ULL << ry->shift);                         \
+            int odd = __builtin_popcountll(k ^ (k >> 1)) & 1;                \
+            type total = 0;                                                  \
+            ryser_start(ry, k, sums);                                        \
+            while (1) {                                                      \
+                type prod = 1;                                               \
+                for (int i = 0; i < ry->n; i++) {                            \
+                    prod *= (type)sums[i];                                   \
+                }                                                            \
+                total += odd ? -prod : prod;                                 \
+                if (++k == last) {                                           \
+                    break;                                                   \
+                }                                                            \
+                odd = ryser_step(ry, k, sums, odd);                          \
+            }                                                                \
+            ((type *)ry->partial)[c] = total;                                \
+        }                                                                    \
+    }
+
+DEFINE_RYSER_CHUNKS(ryser_chunks, long long)
+DEFINE_RYSER_CHUNKS(ryser_chunks_wide, __int128)
+
+// Same walk with a two's complement accumulator of ry->limbs limbs. The
+// product is built as a magnitude, only as many limbs as it has used
+static void ryser_chunks_big(long begin, long end, void *arg) {
+    ryser_t *ry = (ryser_t *)arg;
+    int limbs = ry->limbs;
+    long long sums[ry->n];
+    uint64_t prod[PERMANENT_MAX_LIMBS];
+
+    for (long c = begin; c < end; c++) {
+        uint64_t k = (uint64_t)c << ry->shift;
+        uint64_t last = k + (1ULL << ry->shift);
+        int odd = __builtin_popcountll(k ^ (k >> 1)) & 1;
+        uint64_t *total = (uint64_t *)ry->partial + c * limbs;
+        memset(total, 0, limbs * sizeof(uint64_t));
+        ryser_start(ry, k, sums);
+        while (1) {
+            int used = 1;
+            int neg = odd;
+            prod[0] = 1;
+            for (int i = 0; i < ry->n; i++) {
+                uint64_t v = sums[i] < 0 ? -(uint64_t)sums[i] : (uint64_t)sums[i];
+                unsigned __int128 carry = 0;
+                neg ^= sums[i] < 0;
+                if (v == 0) {
+                    used = 0;
+                    break;
+                }
+                for (int l = 0; l < used; l++) {
+                    carry += (unsigned __int128)prod[l] * v;
+                    prod[l] = (uint64_t)carry;
+                    carry >>= 64;
+                }
+                if (carry != 0) {
+                    prod[used++] = (uint64_t)carry;
+                }
+            }
+            if (used > 0 && neg) {
+                __int128 diff = 0;
+                for (int l = 0; l < limbs && (l < used || diff != 0); l++) {
+                    diff += (__int128)total[l] - (l < used ? prod[l] : 0);
+                    total[l] = (uint64_t)diff;
+                    diff >>= 64;
+                }
+            }
+            else if (used > 0) {
+                unsigned __int128 sum = 0;
+                for (int l = 0; l < limbs && (l < used || sum != 0); l++) {
+                    sum += (unsigned __int128)total[l] + (l < used ? prod[l] : 0);
+                    total[l] = (uint64_t)sum;
+                    sum >>= 64;
+                }
+            }
+            if (++k == last) {
+                break;
+            }
+            odd = ryser_step(ry, k, sums, odd);
+        }
+    }
+}
+
+// Two's complement limbs to a big integer, added to sum
+static void add_limbs(bigint_t *sum, const uint64_t *limbs, int count) {
+    uint32_t words[2 * PERMANENT_MAX_LIMBS];
+    int neg = limbs[count - 1] >> 63;
+    uint64_t carry = neg;
+    bigint_t term = { .neg = neg, .len = 0, .cap = 2 * count, .limb = words };
+
+    for (int l = 0; l < count; l++) {
+        // Negative values are negated as ~x + 1
+        uint64_t v = neg ? ~limbs[l] + carry : limbs[l];
+        carry = carry && v == 0;
+        words[2 * l] = (uint32_t)v;
+        words[2 * l + 1] = (uint32_t)(v >> 32);
+    }
+    term.len = 2 * count;
+    while (term.len > 0 && words[term.len - 1] == 0) {
+        term.len--;
+    }
+    bigint_add(sum, sum, &term);
+}
+
+// Permanent of the matrix by Ryser's formula over the 2^n column subsets
+// in Gray code order, so one column is added or removed per subset and a
+// term costs O(n). Chunks of the subset space are spread over the pool.
+// The accumulator is 64 or 128 bits when the bound allows it, otherwise
+// as many limbs as the bound needs
+void permanent(const matrix_t *matrix, det_t *det) {
+    int n = matrix->n;
+    // Every term is at most the product of the absolute row sums, and
+    // there are 2^n of them
+    int width = width_for_bits(row_sum_bits(matrix, n) + n);
+    int limbs = (int)((row_sum_bits(matrix, n) + n + 2) / 64) + 1;
+    long chunks = n < 10 ? 1 : PERMANENT_CHUNKS;
+    ryser_t ry = { .n = n, .limbs = limbs };
+    size_t size;
+
+    if (n > PERMANENT_MAX_N) {
+        fprintf(stderr, "Permanent: n > %i is out of reach\n", PERMANENT_MAX_N);
+        exit(EXIT_FAILURE);
+    }
+    if (width == DET_BIG && limbs > PERMANENT_MAX_LIMBS) {
+        fprintf(stderr, "Permanent: entries too large for a %i bit accumulator\n", 64 * PERMANENT_MAX_LIMBS);
+        exit(EXIT_FAILURE);
+    }
+    ry.shift = n - __builtin_ctzl(chunks);
+    ry.cols = (long long *)malloc((long)n * n * sizeof(long long));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            ry.cols[(long)j * n + i] = MAT(matrix, i, j);
+        }
+    }
+    size = width == DET_INT64 ? sizeof(long long) : width == DET_INT128 ? sizeof(__int128) : limbs * sizeof(uint64_t);
+    ry.partial = malloc(chunks * size);
+
+    if (width == DET_INT64) {
+        long long total = 0;
+        pool_parallel_for(pool, 0, chunks, 1, ryser_chunks, &ry);
+        for (long c = 0; c < chunks; c++) {
+            total += ((long long *)ry.partial)[c];
+        }
+        det_set_i128(det, n % 2 == 1 ? -total : total, DET_INT64);
+    }
+    else if (width == DET_INT128) {
+        __int128 total = 0;
+        pool_parallel_for(pool, 0, chunks, 1, ryser_chunks_wide, &ry);
+        for (long c = 0; c < chunks; c++) {
+            total += ((__int128 *)ry.partial)[c];
+        }
+        det_set_i128(det, n % 2 == 1 ? -total : total, DET_INT128);
+    }
+    else {
+        bigint_t total;
+        bigint_init(&total);
+        pool_parallel_for(pool, 0, chunks, 1, ryser_chunks_big, &ry);
+        for (long c = 0; c < chunks; c++) {
+            add_limbs(&total, (uint64_t *)ry.partial + c * limbs, limbs);
+        }
+        if (n % 2 == 1) {
+            bigint_neg(&total);
+        }
+        det_set_big(det, &total);
+        bigint_free(&total);
+    }
+    free(ry.partial);
+    free(ry.cols);
+}
+
+void permanent_task(task_t *task) {
+    job_t *job = (job_t *)task->arg;
+    permanent(job->matrix, &job->det);
+}
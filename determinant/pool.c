@@ -0,0 +1,603 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pool.h>
+
+// How many times an idle worker looks for work before going to sleep
+#define SPIN_LIMIT 64
+#define DEQUE_INITIAL_CAP 64
+// Node ids looked up in sysfs
+#define POOL_MAX_NODES 64
+
+// CPUs the process may run on grouped by NUMA node, nodes without any of
+// them left out. cpus lists them node by node, node k owning the indices
+// first[k] .. first[k + 1] - 1
+struct topology_st {
+    int nodes;
+    int total;
+    cpu_set_t node_cpus[POOL_MAX_NODES];
+    int first[POOL_MAX_NODES + 1];
+    int cpus[CPU_SETSIZE];
+};
+
+typedef struct node_call_st {
+    void (*fn)(void *);
+    void *arg;
+} node_call_t;
+
+typedef struct worker_start_st {
+    pool_t *pool;
+    int id;
+} worker_start_t;
+
+typedef struct range_st {
+    range_fn fn;
+    void *arg;
+    long begin;
+    long end;
+} range_t;
+
+typedef struct root_st {
+    task_t *task;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+} root_t;
+
+static __thread int worker_id = -1;
+// Node of the worker running on this thread, -1 outside of the pool
+static __thread int worker_node = -1;
+// Depth of the task running on this thread, -1 outside of any task
+static __thread int task_depth = -1;
+static __thread unsigned int steal_seed = 1;
+
+
+static void deque_init(deque_t *deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->cap = DEQUE_INITIAL_CAP;
+    deque->buf = (task_t **)malloc(deque->cap * sizeof(task_t *));
+    deque->top = 0;
+    deque->bottom = 0;
+}
+
+static void deque_push_bottom(deque_t *deque, task_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->cap) {
+        // Full, copy live entries into a buffer twice as big
+        task_t **buf = (task_t **)malloc(2 * deque->cap * sizeof(task_t *));
+        for (long i = deque->top; i < deque->bottom; i++) {
+            buf[i % (2 * deque->cap)] = deque->buf[i % deque->cap];
+        }
+        free(deque->buf);
+        deque->buf = buf;
+        deque->cap *= 2;
+    }
+    deque->buf[deque->bottom % deque->cap] = task;
+    deque->bottom += 1;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static task_t *deque_pop_bottom(deque_t *deque) {
+    task_t *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        deque->bottom -= 1;
+        task = deque->buf[deque->bottom % deque->cap];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static task_t *deque_steal_top(deque_t *deque) {
+    task_t *task = NULL;
+    // Thieves never wait for a busy deque, they just try the next victim
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL;
+    }
+    if (deque->bottom > deque->top) {
+        task = deque->buf[deque->top % deque->cap];
+        deque->top += 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+
+// Own deque first, then the shared one, then steal from a random victim
+static task_t *find_task(pool_t *pool) {
+    task_t *task = NULL;
+    int self = worker_id >= 0 ? worker_id : pool->nthreads;
+
+    if (atomic_load(&pool->queued) == 0) {
+        return NULL;
+    }
+    task = deque_pop_bottom(&pool->deques[self]);
+    if (task == NULL && self != pool->nthreads) {
+        task = deque_steal_top(&pool->deques[pool->nthreads]);
+    }
+    if (task == NULL) {
+        // With POOL_NUMA the first pass only visits workers of this node
+        int start = rand_r(&steal_seed) % pool->nthreads;
+        int local = (pool->placement & POOL_NUMA) && pool->topology->nodes > 1 && worker_node >= 0;
+        for (int pass = !local; pass < 2 && task == NULL; pass++) {
+            for (int i = 0; i < pool->nthreads && task == NULL; i++) {
+                int victim = (start + i) % pool->nthreads;
+                if (victim != self && (pass == 1 || pool->node_of[victim] == worker_node)) {
+                    task = deque_steal_top(&pool->deques[victim]);
+                }
+            }
+        }
+    }
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return task;
+}
+
+static pool_stats_t *own_stats(pool_t *pool) {
+    return &pool->stats[worker_id >= 0 ? worker_id : pool->nthreads];
+}
+
+// Add to a counter of own_stats. A worker's slot is private, the shared
+// one of non-worker threads needs an atomic add
+static void stats_add(long *counter, long amount) {
+    if (worker_id >= 0) {
+        *counter += amount;
+    }
+    else {
+        __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+    }
+}
+
+static double clock_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void run_task(task_t *task) {
+    // The task may be gone as soon as pending drops, read it first
+    atomic_int *pending = task->pending;
+    int depth = task_depth;
+    task_depth = task->depth;
+    task->run(task);
+    task_depth = depth;
+    if (pending != NULL) {
+        atomic_fetch_sub(pending, 1);
+    }
+}
+
+// A worker turned busy, only transitions touch the shared counters
+static void mark_active(pool_t *pool) {
+    int active = atomic_fetch_add(&pool->active, 1) + 1;
+    int max = atomic_load(&pool->max_active);
+    while (active > max && !atomic_compare_exchange_weak(&pool->max_active, &max, active)) {
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_start_t *start = (worker_start_t *)arg;
+    pool_t *pool = start->pool;
+    int idle = 0;
+    int busy = 0;
+    task_t *task;
+
+    worker_id = start->id;
+    worker_node = pool->node_of[start->id];
+    steal_seed = start->id * 2654435761u + 1;
+    free(start);
+
+    while (!atomic_load(&pool->shutdown)) {
+        if ((task = find_task(pool)) != NULL) {
+            if (pool->stats != NULL) {
+                pool_stats_t *stats = own_stats(pool);
+                double start_ms = clock_ms();
+                if (!busy) {
+                    busy = 1;
+                    mark_active(pool);
+                }
+                run_task(task);
+                stats->busy_ms += clock_ms() - start_ms;
+            }
+            else {
+                run_task(task);
+            }
+            idle = 0;
+            continue;
+        }
+        if (busy) {
+            busy = 0;
+            atomic_fetch_sub(&pool->active, 1);
+        }
+        if (++idle < SPIN_LIMIT) {
+            sched_yield();
+            continue;
+        }
+        // Nothing to do for a while, sleep until somebody spawns a task
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->shutdown)) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        pthread_mutex_unlock(&pool->idle_lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+
+// "0-3,8-11" as sysfs writes CPU lists
+static void parse_cpulist(const char *text, cpu_set_t *set) {
+    const char *p = text;
+    for (;;) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p) {
+            return;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*end != ',') {
+            return;
+        }
+        p = end + 1;
+    }
+}
+
+// Nodes and their CPUs from /sys/devices/system/node, everything allowed
+// is one node when that is missing
+static topology_t *topology_read() {
+    topology_t *topology = (topology_t *)calloc(1, sizeof(topology_t));
+    cpu_set_t allowed;
+    char path[64];
+    char line[4096];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+    for (int node = 0; node < POOL_MAX_NODES; node++) {
+        cpu_set_t *cpus = &topology->node_cpus[topology->nodes];
+        FILE *file;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%i/cpulist", node);
+        if ((file = fopen(path, "r")) == NULL) {
+            continue;
+        }
+        CPU_ZERO(cpus);
+        if (fgets(line, sizeof(line), file) != NULL) {
+            parse_cpulist(line, cpus);
+        }
+        fclose(file);
+        CPU_AND(cpus, cpus, &allowed);
+        if (CPU_COUNT(cpus) > 0) {
+            topology->nodes += 1;
+        }
+    }
+    if (topology->nodes == 0) {
+        topology->node_cpus[0] = allowed;
+        topology->nodes = 1;
+    }
+    for (int node = 0; node < topology->nodes; node++) {
+        topology->first[node] = topology->total;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &topology->node_cpus[node])) {
+                topology->cpus[topology->total++] = cpu;
+            }
+        }
+    }
+    topology->first[topology->nodes] = topology->total;
+    return topology;
+}
+
+// Where worker i goes: its node and the CPUs it may run on. POOL_NUMA
+// gives every node an equal share of consecutive workers, POOL_PIN one
+// CPU each, taken node by node so neighbouring workers share a node
+static void place_worker(pool_t *pool, int i, cpu_set_t *set) {
+    topology_t *topology = pool->topology;
+    int node = 0;
+    int index = i % topology->total;
+
+    if (pool->placement & POOL_NUMA) {
+        int nodes = topology->nodes;
+        node = (int)((long)i * nodes / pool->nthreads);
+        int rank = i - (int)(((long)node * pool->nthreads + nodes - 1) / nodes);
+        int size = topology->first[node + 1] - topology->first[node];
+        index = topology->first[node] + rank % size;
+    }
+    else {
+        while (index >= topology->first[node + 1]) {
+            node++;
+        }
+    }
+    pool->node_of[i] = node;
+    if (pool->placement & POOL_PIN) {
+        CPU_ZERO(set);
+        CPU_SET(topology->cpus[index], set);
+    }
+    else {
+        *set = topology->node_cpus[node];
+    }
+}
+
+pool_t *pool_create(int nthreads) {
+    return pool_create_placed(nthreads, 0);
+}
+
+// pool_create with workers bound to CPUs as placement says
+pool_t *pool_create_placed(int nthreads, int placement) {
+    pool_t *pool = (pool_t *)malloc(sizeof(pool_t));
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    pool->nthreads = nthreads;
+    pool->placement = placement;
+    pool->topology = placement != 0 ? topology_read() : NULL;
+    pool->node_of = (int *)calloc(nthreads, sizeof(int));
+    pool->tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    pool->deques = (deque_t *)malloc((nthreads + 1) * sizeof(deque_t));
+    for (int i = 0; i < nthreads + 1; i++) {
+        deque_init(&pool->deques[i]);
+    }
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->sleeping, 0);
+    atomic_init(&pool->shutdown, 0);
+    atomic_init(&pool->threads_created, 0);
+    atomic_init(&pool->active, 0);
+    atomic_init(&pool->max_active, 0);
+    pool->stats = NULL;
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        worker_start_t *start = (worker_start_t *)malloc(sizeof(worker_start_t));
+        pthread_attr_t attr;
+        start->pool = pool;
+        start->id = i;
+        pthread_attr_init(&attr);
+        // Bound before it starts, so even its stack is on its node
+        if (pool->topology != NULL) {
+            cpu_set_t set;
+            place_worker(pool, i, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        if (pthread_create(&pool->tids[i], &attr, worker_main, start) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pthread_attr_destroy(&attr);
+        atomic_fetch_add(&pool->threads_created, 1);
+    }
+    return pool;
+}
+
+void pool_destroy(pool_t *pool) {
+    atomic_store(&pool->shutdown, 1);
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+    for (int i = 0; i < pool->nthreads + 1; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].buf);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->deques);
+    free(pool->tids);
+    free(pool->stats);
+    free(pool->topology);
+    free(pool->node_of);
+    free(pool);
+}
+
+// Make task visible to other workers, caller must keep it alive
+// and eventually pool_wait on its pending counter
+void pool_spawn(pool_t *pool, task_t *task) {
+    int self = worker_id >= 0 ? worker_id : pool->nthreads;
+    task->depth = task_depth + 1;
+    if (pool->stats != NULL) {
+        stats_add(&pool->stats[self].spawned[task->depth < STATS_MAX_DEPTH ? task->depth : STATS_MAX_DEPTH - 1], 1);
+    }
+    deque_push_bottom(&pool->deques[self], task);
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+// Help running tasks until every task counted by pending has finished,
+// blocking here instead would deadlock a fixed size pool
+void pool_wait(pool_t *pool, atomic_int *pending) {
+    task_t *task;
+    while (atomic_load(pending) > 0) {
+        if ((task = find_task(pool)) != NULL) {
+            run_task(task);
+        }
+        else {
+            sched_yield();
+        }
+    }
+}
+
+// Run task on this thread right away, one level deeper like a spawned
+// task would be. Its pending counter is left alone
+void pool_inline(task_t *task) {
+    int depth = task_depth;
+    task->depth = depth + 1;
+    task_depth = depth + 1;
+    task->run(task);
+    task_depth = depth;
+}
+
+static void root_run(task_t *task) {
+    root_t *root = (root_t *)task->arg;
+    root->task->depth = task->depth;
+    run_task(root->task);
+    pthread_mutex_lock(&root->lock);
+    root->done = 1;
+    pthread_cond_signal(&root->cond);
+    pthread_mutex_unlock(&root->lock);
+}
+
+// Run task on the pool and sleep until it is done, meant for threads
+// outside of the pool so they do not compete with workers for cores
+void pool_run(pool_t *pool, task_t *task) {
+    if (worker_id >= 0) {
+        task->depth = task_depth;
+        run_task(task);
+        return;
+    }
+    root_t root = { .task = task, .done = 0 };
+    task_t root_task = { .run = root_run, .arg = &root, .pending = NULL };
+    pthread_mutex_init(&root.lock, NULL);
+    pthread_cond_init(&root.cond, NULL);
+
+    pool_spawn(pool, &root_task);
+    pthread_mutex_lock(&root.lock);
+    while (!root.done) {
+        pthread_cond_wait(&root.cond, &root.lock);
+    }
+    pthread_mutex_unlock(&root.lock);
+    pthread_mutex_destroy(&root.lock);
+    pthread_cond_destroy(&root.cond);
+}
+
+static void range_run(task_t *task) {
+    range_t *range = (range_t *)task->arg;
+    range->fn(range->begin, range->end, range->arg);
+}
+
+// Split [begin, end) into chunks of at least grain iterations, at most a
+// few per worker, and run them on the pool. The caller takes the last chunk
+void pool_parallel_for(pool_t *pool, long begin, long end, long grain, range_fn fn, void *arg) {
+    long len = end - begin;
+    long chunks;
+
+    if (len <= 0) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+    chunks = (len + grain - 1) / grain;
+    if (pool == NULL || chunks < 2) {
+        fn(begin, end, arg);
+        return;
+    }
+    if (chunks > 4 * pool->nthreads) {
+        chunks = 4 * pool->nthreads;
+    }
+
+    task_t tasks[chunks];
+    range_t ranges[chunks];
+    atomic_int pending;
+    atomic_init(&pending, chunks - 1);
+    for (long c = 0; c < chunks; c++) {
+        ranges[c].fn = fn;
+        ranges[c].arg = arg;
+        ranges[c].begin = begin + len * c / chunks;
+        ranges[c].end = begin + len * (c + 1) / chunks;
+        tasks[c].run = range_run;
+        tasks[c].arg = &ranges[c];
+        tasks[c].pending = &pending;
+        if (c < chunks - 1) {
+            pool_spawn(pool, &tasks[c]);
+        }
+    }
+    range_run(&tasks[chunks - 1]);
+    pool_wait(pool, &pending);
+}
+
+int pool_worker_id() {
+    return worker_id;
+}
+
+// Node of the calling worker, 0 for threads outside of the pool
+int pool_node() {
+    return worker_node >= 0 ? worker_node : 0;
+}
+
+int pool_node_count(pool_t *pool) {
+    return pool->topology != NULL ? pool->topology->nodes : 1;
+}
+
+static void *node_call_main(void *arg) {
+    node_call_t *call = (node_call_t *)arg;
+    call->fn(call->arg);
+    return NULL;
+}
+
+// Run fn on a short lived thread bound to the CPUs of node, so the pages
+// it touches first are placed on that node. Without placement it simply
+// runs on the calling thread
+void pool_on_node(pool_t *pool, int node, void (*fn)(void *), void *arg) {
+    node_call_t call = { .fn = fn, .arg = arg };
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    if (pool->topology == NULL) {
+        fn(arg);
+        return;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &pool->topology->node_cpus[node]);
+    if (pthread_create(&tid, &attr, node_call_main, &call) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    pthread_join(tid, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+// Start counting for --stats, before the first task is spawned
+void pool_enable_stats(pool_t *pool) {
+    size_t size = (pool->nthreads + 1) * sizeof(pool_stats_t);
+    pool->stats = (pool_stats_t *)aligned_alloc(64, size);
+    memset(pool->stats, 0, size);
+}
+
+// Scratch memory an engine set aside for minors, charged to this thread
+void pool_count_minor_bytes(pool_t *pool, long bytes) {
+    if (pool != NULL && pool->stats != NULL) {
+        stats_add(&own_stats(pool)->minor_bytes, bytes);
+    }
+}
+
+// Sum of every thread's counters, meant for when the pool is quiet
+void pool_collect_stats(pool_t *pool, pool_stats_t *total) {
+    memset(total, 0, sizeof(pool_stats_t));
+    if (pool->stats == NULL) {
+        return;
+    }
+    for (int i = 0; i < pool->nthreads + 1; i++) {
+        for (int d = 0; d < STATS_MAX_DEPTH; d++) {
+            total->spawned[d] += pool->stats[i].spawned[d];
+        }
+        total->minor_bytes += pool->stats[i].minor_bytes;
+        total->busy_ms += pool->stats[i].busy_ms;
+    }
+    total->max_active = atomic_load(&pool->max_active);
+}
+
+int default_thread_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
@@ -0,0 +1,99 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Spawn counts are kept for this many task depths, deeper ones are
+// added to the last
+#define STATS_MAX_DEPTH 32
+
+// Worker placement for pool_create_placed. POOL_PIN binds each worker to
+// one core, POOL_NUMA spreads the workers evenly over the NUMA nodes,
+// binds them to their node and has them steal from their node first
+#define POOL_PIN 1
+#define POOL_NUMA 2
+
+typedef struct task_st task_t;
+typedef struct deque_st deque_t;
+typedef struct pool_stats_st pool_stats_t;
+typedef struct pool_st pool_t;
+typedef struct topology_st topology_t;
+
+// Unit of work handed to the pool. The spawning frame owns the task
+// (usually on its stack) and keeps it alive until pool_wait returns.
+struct task_st {
+    void (*run)(task_t *);
+    void *arg;
+    atomic_int *pending;
+    // Set by pool_spawn, one more than the task that spawned it
+    int depth;
+};
+
+// Per worker double ended queue, owner works on the bottom (LIFO),
+// thieves take from the top (FIFO) so they get the biggest pieces of work
+struct deque_st {
+    pthread_mutex_t lock;
+    task_t **buf;
+    int cap;
+    long top;
+    long bottom;
+};
+
+// Counters for --stats. Every worker owns one slot and is the only one
+// writing it, the last slot is shared by every other thread (main, serve
+// and batch threads) which add to it atomically. Slots are a cache line
+// apart and merged once at the end
+struct pool_stats_st {
+    long spawned[STATS_MAX_DEPTH];
+    long minor_bytes;
+    // Time workers spent inside tasks, as opposed to looking for them
+    double busy_ms;
+    int max_active;
+} __attribute__((aligned(64)));
+
+struct pool_st {
+    int nthreads;
+    pthread_t *tids;
+    // deques[0 .. nthreads - 1] belong to workers, deques[nthreads]
+    // is shared by every thread that is not a worker (e.g. main)
+    deque_t *deques;
+    atomic_int queued;
+    atomic_int sleeping;
+    atomic_int shutdown;
+    atomic_int threads_created;
+    // Workers currently between finding work and running out of it
+    atomic_int active;
+    atomic_int max_active;
+    // nthreads + 1 slots like deques, NULL unless pool_enable_stats
+    pool_stats_t *stats;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    // Placement flags, the cores of each node and the node of every
+    // worker (all 0 without placement)
+    int placement;
+    topology_t *topology;
+    int *node_of;
+};
+
+// Body of a parallel loop, called with a half open range of iterations
+typedef void (*range_fn)(long begin, long end, void *arg);
+
+pool_t *pool_create(int nthreads);
+pool_t *pool_create_placed(int nthreads, int placement);
+void pool_destroy(pool_t *pool);
+void pool_spawn(pool_t *pool, task_t *task);
+void pool_wait(pool_t *pool, atomic_int *pending);
+void pool_inline(task_t *task);
+void pool_run(pool_t *pool, task_t *task);
+void pool_parallel_for(pool_t *pool, long begin, long end, long grain, range_fn fn, void *arg);
+int pool_worker_id();
+int pool_node();
+int pool_node_count(pool_t *pool);
+void pool_on_node(pool_t *pool, int node, void (*fn)(void *), void *arg);
+void pool_enable_stats(pool_t *pool);
+void pool_count_minor_bytes(pool_t *pool, long bytes);
+void pool_collect_stats(pool_t *pool, pool_stats_t *total);
+int default_thread_count();
+
+#endif
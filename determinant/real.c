@@ -0,0 +1,145 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <kernels.h>
+#include <real.h>
+
+// Panel width of the blocked factorization and the column block each
+// trailing update task owns
+#define LU_PANEL 64
+#define LU_COLUMNS 256
+
+typedef struct panel_st {
+    rmatrix_t *a;
+    int k;
+    int nb;
+} panel_t;
+
+rmatrix_t *rmatrix_alloc(arena_t *arena, int n) {
+    rmatrix_t *matrix = (rmatrix_t *)arena_alloc(arena, sizeof(rmatrix_t));
+    matrix->n = n;
+    matrix->data = (double *)arena_alloc(arena, (size_t)n * n * sizeof(double));
+    return matrix;
+}
+
+void print_real_matrix(const rmatrix_t *matrix) {
+    printf("START PRINTING MATRIX\n");
+    for (int i = 0; i < matrix->n; i++) {
+        for (int j = 0; j < matrix->n; j++) {
+            printf("%g ", RMAT(matrix, i, j));
+        }
+        printf("\n");
+    }
+    printf("END PRINTING MATRIX\n");
+}
+
+// Unblocked LU with partial pivoting of columns k .. k + nb - 1, rows
+// below the diagonal. Pivot rows are swapped across the full width so the
+// trailing columns see the same permutation. Returns the number of swaps
+// or -1 when a column has no nonzero pivot left
+static int factor_panel(rmatrix_t *a, int k, int nb) {
+    int n = a->n;
+    int swaps = 0;
+
+    for (int c = k; c < k + nb; c++) {
+        int p = c;
+        double best = fabs(RMAT(a, c, c));
+        for (int i = c + 1; i < n; i++) {
+            if (fabs(RMAT(a, i, c)) > best) {
+                best = fabs(RMAT(a, i, c));
+                p = i;
+            }
+        }
+        if (best == 0) {
+            return -1;
+        }
+        if (p != c) {
+            double *x = &RMAT(a, p, 0);
+            double *y = &RMAT(a, c, 0);
+            for (int j = 0; j < n; j++) {
+                double t = x[j];
+                x[j] = y[j];
+                y[j] = t;
+            }
+            swaps += 1;
+        }
+        double inv = 1.0 / RMAT(a, c, c);
+        for (int i = c + 1; i < n; i++) {
+            double l = RMAT(a, i, c) * inv;
+            RMAT(a, i, c) = l;
+            kernels->real_update(&RMAT(a, i, c + 1), &RMAT(a, c, c + 1), k + nb - c - 1, l);
+        }
+    }
+    return swaps;
+}
+
+// Columns right of the panel, one block of LU_COLUMNS per iteration:
+// first U12 = L11^-1 A12 for the panel rows, then A22 -= L21 U12 for all
+// rows below. Blocks share nothing but the finished panel, so each one is
+// an independent task
+static void update_blocks(long begin, long end, void *arg) {
+    panel_t *panel = (panel_t *)arg;
+    rmatrix_t *a = panel->a;
+    int n = a->n;
+    int k = panel->k;
+    int nb = panel->nb;
+
+    for (long b = begin; b < end; b++) {
+        int j0 = k + nb + (int)b * LU_COLUMNS;
+        int len = n - j0 < LU_COLUMNS ? n - j0 : LU_COLUMNS;
+        for (int r = k + 1; r < k + nb; r++) {
+            for (int p = k; p < r; p++) {
+                kernels->real_update(&RMAT(a, r, j0), &RMAT(a, p, j0), len, RMAT(a, r, p));
+            }
+        }
+        for (int i = k + nb; i < n; i++) {
+            for (int p = k; p < k + nb; p++) {
+                kernels->real_update(&RMAT(a, i, j0), &RMAT(a, p, j0), len, RMAT(a, i, p));
+            }
+        }
+    }
+}
+
+// Right looking blocked LU with partial pivoting, in place. The
+// determinant comes out as a sign and the sum of log|u_ii|, which stays
+// finite where the product of the pivots would overflow a double
+void lu_determinant(rmatrix_t *a, int *sign, double *logabs) {
+    int n = a->n;
+    int swaps = 0;
+
+    *sign = 1;
+    *logabs = 0;
+    for (int k = 0; k < n; k += LU_PANEL) {
+        int nb = n - k < LU_PANEL ? n - k : LU_PANEL;
+        int s = factor_panel(a, k, nb);
+        if (s < 0) {
+            *sign = 0;
+            *logabs = -INFINITY;
+            return;
+        }
+        swaps += s;
+        if (k + nb < n) {
+            panel_t panel = { .a = a, .k = k, .nb = nb };
+            long blocks = (n - k - nb + LU_COLUMNS - 1) / LU_COLUMNS;
+            pool_parallel_for(pool, 0, blocks, 1, update_blocks, &panel);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        double u = RMAT(a, i, i);
+        *logabs += log(fabs(u));
+        if (u < 0) {
+            *sign = -*sign;
+        }
+    }
+    if (swaps % 2 != 0) {
+        *sign = -*sign;
+    }
+}
+
+void lu_task(task_t *task) {
+    lu_job_t *job = (lu_job_t *)task->arg;
+    lu_determinant(job->matrix, &job->sign, &job->logabs);
+}
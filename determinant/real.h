@@ -0,0 +1,35 @@
+#ifndef REAL_H
+#define REAL_H
+
+#include <stddef.h>
+
+#include <matrix.h>
+#include <pool.h>
+
+typedef struct rmatrix_st rmatrix_t;
+typedef struct lu_job_st lu_job_t;
+
+// Square matrix of doubles, row major without padding
+struct rmatrix_st {
+    int n;
+    double *data;
+};
+
+// Floating point determinant as sign and log|det|, sign is 0 for a
+// matrix found singular and logabs is then -inf
+struct lu_job_st {
+    rmatrix_t *matrix;
+    int sign;
+    double logabs;
+};
+
+#define RMAT(m, i, j) ((m)->data[(long)(i) * (m)->n + (j)])
+
+rmatrix_t *rmatrix_alloc(arena_t *arena, int n);
+rmatrix_t *parse_text_real(const char *buf, size_t len, const char *name, arena_t *arena);
+rmatrix_t *form_real_matrix(const char *filename, arena_t *arena);
+void print_real_matrix(const rmatrix_t *matrix);
+void lu_determinant(rmatrix_t *matrix, int *sign, double *logabs);
+void lu_task(task_t *task);
+
+#endif
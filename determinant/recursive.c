@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <determinant.h>
+#include <kernels.h>
+#include <modular.h>
+
+// Blocks at most this wide are handled by plain loops, everything bigger
+// is halved. Below RLU_SPAWN_WORK multiply-adds a block operation stays
+// on the calling thread
+#define RLU_BASE 48
+#define RLU_SPAWN_WORK (1L << 20)
+
+typedef struct rlu_st rlu_t;
+typedef struct rlu_op_st rlu_op_t;
+
+// The residue matrix of one prime, row major, n x n
+struct rlu_st {
+    uint64_t *a;
+    long n;
+    uint64_t p;
+};
+
+// One block operation, so either half of a split can become a pool task.
+// c -= a * b for a gemm, b = L^-1 b for a trsm with L unit lower
+// triangular at a; (row, col) pairs address the blocks inside the matrix
+struct rlu_op_st {
+    task_t task;
+    const rlu_t *f;
+    int trsm;
+    long ci, cj, ai, aj, bi, bj;
+    long m, n, k;
+};
+
+#define AT(f, i, j) ((f)->a + (i) * (f)->n + (j))
+
+static void gemm(const rlu_t *f, long ci, long cj, long ai, long aj, long bi, long bj, long m, long n, long k);
+static void trsm(const rlu_t *f, long li, long lj, long bi, long bj, long k, long n);
+
+static void op_run(task_t *task) {
+    rlu_op_t *op = (rlu_op_t *)task->arg;
+    if (op->trsm) {
+        trsm(op->f, op->ai, op->aj, op->bi, op->bj, op->k, op->n);
+    }
+    else {
+        gemm(op->f, op->ci, op->cj, op->ai, op->aj, op->bi, op->bj, op->m, op->n, op->k);
+    }
+}
+
+// Run two independent halves, the first on the pool and the second here
+static void run_pair(rlu_op_t *first, rlu_op_t *second) {
+    atomic_int pending;
+    atomic_init(&pending, 1);
+    first->task.run = op_run;
+    first->task.arg = first;
+    first->task.pending = &pending;
+    pool_spawn(pool, &first->task);
+    second->task.run = op_run;
+    second->task.arg = second;
+    second->task.pending = NULL;
+    pool_inline(&second->task);
+    pool_wait(pool, &pending);
+}
+
+// C (m x n at ci, cj) -= A (m x k at ai, aj) * B (k x n at bi, bj), all
+// mod p. The largest dimension is halved until the blocks fit in cache,
+// whatever the cache sizes are; halves of m or n are independent and
+// run in parallel, halves of k one after the other
+static void gemm(const rlu_t *f, long ci, long cj, long ai, long aj, long bi, long bj, long m, long n, long k) {
+    if (m <= RLU_BASE && n <= RLU_BASE * 4 && k <= RLU_BASE) {
+        for (long i = 0; i < m; i++) {
+            uint64_t *row = AT(f, ci + i, cj);
+            const uint64_t *a = AT(f, ai + i, aj);
+            for (long q = 0; q < k; q++) {
+                if (a[q] != 0) {
+                    kernels->mod_update(row, AT(f, bi + q, bj), n, a[q], kernel_shoup(a[q], f->p), f->p);
+                }
+            }
+        }
+        return;
+    }
+    if (k >= m && k >= n / 4) {
+        long k1 = k / 2;
+        gemm(f, ci, cj, ai, aj, bi, bj, m, n, k1);
+        gemm(f, ci, cj, ai, aj + k1, bi + k1, bj, m, n, k - k1);
+        return;
+    }
+    rlu_op_t lo = { .f = f, .ci = ci, .cj = cj, .ai = ai, .aj = aj, .bi = bi, .bj = bj, .m = m, .n = n, .k = k };
+    rlu_op_t hi = lo;
+    if (m >= n / 4) {
+        lo.m = m / 2;
+        hi.m = m - lo.m;
+        hi.ci += lo.m;
+        hi.ai += lo.m;
+    }
+    else {
+        lo.n = n / 2;
+        hi.n = n - lo.n;
+        hi.cj += lo.n;
+        hi.bj += lo.n;
+    }
+    if (m * n * k >= RLU_SPAWN_WORK) {
+        run_pair(&lo, &hi);
+    }
+    else {
+        gemm(f, lo.ci, lo.cj, lo.ai, lo.aj, lo.bi, lo.bj, lo.m, lo.n, lo.k);
+        gemm(f, hi.ci, hi.cj, hi.ai, hi.aj, hi.bi, hi.bj, hi.m, hi.n, hi.k);
+    }
+}
+
+// B (k x n at bi, bj) = L^-1 B with L the unit lower triangle of the
+// k x k block at li, lj. Column halves of B are independent, row halves
+// are a solve, an update and another solve
+static void trsm(const rlu_t *f, long li, long lj, long bi, long bj, long k, long n) {
+    if (n > RLU_BASE * 4 && k * k * n >= RLU_SPAWN_WORK) {
+        rlu_op_t lo = { .f = f, .trsm = 1, .ai = li, .aj = lj, .bi = bi, .bj = bj, .n = n / 2, .k = k };
+        rlu_op_t hi = lo;
+        hi.bj += lo.n;
+        hi.n = n - lo.n;
+        run_pair(&lo, &hi);
+        return;
+    }
+    if (k <= RLU_BASE) {
+        for (long r = 1; r < k; r++) {
+            uint64_t *row = AT(f, bi + r, bj);
+            const uint64_t *l = AT(f, li + r, lj);
+            for (long q = 0; q < r; q++) {
+                if (l[q] != 0) {
+                    kernels->mod_update(row, AT(f, bi + q, bj), n, l[q], kernel_shoup(l[q], f->p), f->p);
+                }
+            }
+        }
+        return;
+    }
+    long k1 = k / 2;
+    trsm(f, li, lj, bi, bj, k1, n);
+    gemm(f, bi + k1, bj, li + k1, lj, bi, bj, k - k1, n, k1);
+    trsm(f, li + k1, lj + k1, bi + k1, bj, k - k1, n);
+}
+
+// Unblocked LU of the columns c0 .. c0 + n - 1, rows r0 .. end, pivots
+// multiplied into det. Pivot rows are swapped across the whole matrix
+// so every block to the right sees the same row order
+static int panel(const rlu_t *f, long r0, long c0, long n, uint64_t *det) {
+    uint64_t p = f->p;
+    for (long c = 0; c < n; c++) {
+        long k = r0 + c;
+        long piv = k;
+        while (piv < f->n && *AT(f, piv, c0 + c) == 0) {
+            piv++;
+        }
+        if (piv == f->n) {
+            return -1;
+        }
+        if (piv != k) {
+            uint64_t *x = AT(f, piv, 0);
+            uint64_t *y = AT(f, k, 0);
+            for (long j = 0; j < f->n; j++) {
+                uint64_t t = x[j];
+                x[j] = y[j];
+                y[j] = t;
+            }
+            *det = *det == 0 ? 0 : p - *det;
+        }
+        uint64_t *pivot_row = AT(f, k, c0 + c);
+        uint64_t inv = inv_mod(*pivot_row, p);
+        *det = mul_mod(*det, *pivot_row, p);
+        for (long i = k + 1; i < f->n; i++) {
+            uint64_t *row = AT(f, i, c0 + c);
+            if (*row == 0) {
+                continue;
+            }
+            uint64_t l = mul_mod(*row, inv, p);
+            *row = l;
+            kernels->mod_update(row + 1, pivot_row + 1, n - c - 1, l, kernel_shoup(l, p), p);
+        }
+    }
+    return 0;
+}
+
+// Recursive LU of the n columns from c0 on, rows from r0 = c0 down
+// (Toledo's scheme): factor the left half, solve for the top right
+// block, update the bottom right one, factor what is left of it
+static int rlu(const rlu_t *f, long c0, long n, uint64_t *det) {
+    long n1 = n / 2;
+    if (n <= RLU_BASE) {
+        return panel(f, c0, c0, n, det);
+    }
+    if (rlu(f, c0, n1, det) != 0) {
+        return -1;
+    }
+    trsm(f, c0, c0, c0, c0 + n1, n1, n - n1);
+    gemm(f, c0 + n1, c0 + n1, c0 + n1, c0, c0, c0 + n1, f->n - c0 - n1, n - n1, n1);
+    return rlu(f, c0 + n1, n - n1, det);
+}
+
+// Determinant modulo p, a is room for the n x n residues
+uint64_t recursive_det_mod(const matrix_t *matrix, uint64_t *a, uint64_t p) {
+    rlu_t f = { .a = a, .n = matrix->n, .p = p };
+    uint64_t det = 1;
+
+    for (long i = 0; i < f.n; i++) {
+        for (long j = 0; j < f.n; j++) {
+            *AT(&f, i, j) = residue(MAT(matrix, i, j), p);
+        }
+    }
+    if (rlu(&f, 0, f.n, &det) != 0) {
+        return 0;
+    }
+    return det;
+}
+
+// Multi-modular like modular_determinant, but the primes are done one at
+// a time and each factorization uses the whole pool. Only one residue
+// matrix is ever allocated, which is what makes n in the ten thousands
+// fit in memory
+void recursive_determinant(const matrix_t *matrix, det_t *det) {
+    int count = modular_prime_count(hadamard_bits(matrix, matrix->n));
+    uint64_t *primes = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint64_t *residues = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint64_t *a = (uint64_t *)malloc((long)matrix->n * matrix->n * sizeof(uint64_t) + 1);
+
+    pool_count_minor_bytes(pool, (long)matrix->n * matrix->n * sizeof(uint64_t));
+    modular_find_primes(primes, count);
+    for (int i = 0; i < count; i++) {
+        residues[i] = recursive_det_mod(matrix, a, primes[i]);
+    }
+    modular_combine(primes, residues, count, det);
+    free(a);
+    free(primes);
+    free(residues);
+}
@@ -0,0 +1,97 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <result.h>
+
+// Slack for rounding in the floating point bounds below
+#define BOUND_SLACK_BITS 1.0
+
+
+void det_init(det_t *det) {
+    det->width = DET_INT64;
+    det->value = 0;
+    bigint_init(&det->big);
+}
+
+void det_free(det_t *det) {
+    bigint_free(&det->big);
+}
+
+void det_set_i128(det_t *det, __int128 value, int width) {
+    det->width = width;
+    det->value = value;
+}
+
+void det_set_big(det_t *det, const bigint_t *value) {
+    det->width = DET_BIG;
+    bigint_copy(&det->big, value);
+}
+
+void det_to_bigint(const det_t *det, bigint_t *out) {
+    if (det->width == DET_BIG) {
+        bigint_copy(out, &det->big);
+    }
+    else {
+        bigint_set_i128(out, det->value);
+    }
+}
+
+// Decimal representation, caller frees
+char *det_to_string(const det_t *det) {
+    bigint_t tmp;
+    char *str;
+    if (det->width == DET_BIG) {
+        return bigint_to_string(&det->big);
+    }
+    bigint_init(&tmp);
+    bigint_set_i128(&tmp, det->value);
+    str = bigint_to_string(&tmp);
+    bigint_free(&tmp);
+    return str;
+}
+
+int width_for_bits(double bits) {
+    if (bits + BOUND_SLACK_BITS < 63) {
+        return DET_INT64;
+    }
+    if (bits + BOUND_SLACK_BITS < 127) {
+        return DET_INT128;
+    }
+    return DET_BIG;
+}
+
+// log2 of Hadamard's bound over the first rows rows: product of the
+// euclidean row norms. Rows shorter than 1 count as 1 so the bound also
+// covers every minor made of a subset of those rows
+double hadamard_bits(const matrix_t *matrix, int rows) {
+    double bits = 0;
+    for (int i = 0; i < rows; i++) {
+        double norm = 0;
+        for (int j = 0; j < matrix->n; j++) {
+            double x = MAT(matrix, i, j);
+            norm += x * x;
+        }
+        if (norm > 1) {
+            bits += 0.5 * log2(norm);
+        }
+    }
+    return bits;
+}
+
+// log2 of the product of absolute row sums over the first rows rows. It
+// bounds the sum of the absolute values of all terms of the expansion, so
+// unlike Hadamard's bound it also covers every partial sum along the way
+double row_sum_bits(const matrix_t *matrix, int rows) {
+    double bits = 0;
+    for (int i = 0; i < rows; i++) {
+        double sum = 0;
+        for (int j = 0; j < matrix->n; j++) {
+            sum += fabs((double)MAT(matrix, i, j));
+        }
+        if (sum > 1) {
+            bits += log2(sum);
+        }
+    }
+    return bits;
+}
@@ -0,0 +1,32 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include <bigint.h>
+#include <matrix.h>
+
+// Narrowest integer type an engine needs for every intermediate value,
+// picked from a bound on the input before any arithmetic is done
+#define DET_INT64 0
+#define DET_INT128 1
+#define DET_BIG 2
+
+typedef struct det_st det_t;
+
+// Exact determinant, value holds it unless width is DET_BIG
+struct det_st {
+    int width;
+    __int128 value;
+    bigint_t big;
+};
+
+void det_init(det_t *det);
+void det_free(det_t *det);
+void det_set_i128(det_t *det, __int128 value, int width);
+void det_set_big(det_t *det, const bigint_t *value);
+void det_to_bigint(const det_t *det, bigint_t *out);
+char *det_to_string(const det_t *det);
+int width_for_bits(double bits);
+double hadamard_bits(const matrix_t *matrix, int rows);
+double row_sum_bits(const matrix_t *matrix, int rows);
+
+#endif
@@ -0,0 +1,621 @@
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <determinant.h>
+#include <binfmt.h>
+#include <kernels.h>
+#include <cache.h>
+#include <serve.h>
+
+// Requests picked up together are cut into pool tasks of at most this
+// many matrices or this much work (sum of n^3), so thousands of tiny
+// requests cost a handful of tasks while big ones still spread out
+#define SERVE_GROUP_MAX 64
+#define SERVE_GROUP_COST (1L << 18)
+#define SERVE_ARENA_BLOCK 4096
+
+typedef struct request_st request_t;
+typedef struct conn_st conn_t;
+typedef struct server_st server_t;
+typedef struct group_st group_t;
+
+struct request_st {
+    uint32_t id;
+    int algo;
+    conn_t *conn;
+    matrix_t *matrix;
+    arena_t arena;
+    det_t det;
+    request_t *next;
+};
+
+// One client. Its reader thread parses frames and submits them, its
+// writer thread sends finished requests back. Whoever is last to leave
+// frees it: the writer, once the reader is done and nothing is in flight
+struct conn_st {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    request_t *done_head;
+    request_t *done_tail;
+    int in_flight;
+    int reading;
+    server_t *server;
+};
+
+// Requests waiting for the dispatcher, which is the only thread spawning
+// pool tasks from outside the pool
+struct server_st {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    request_t *head;
+    request_t *tail;
+    int algo;
+};
+
+struct group_st {
+    task_t task;
+    int count;
+    request_t *items[SERVE_GROUP_MAX];
+};
+
+static const char *socket_path;
+
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Read exactly len bytes, returns 0 on a clean end of stream before the
+// first byte and -1 on errors or a stream cut short
+static int read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n == 0 && done == 0 ? 0 : -1;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static void request_free(request_t *req) {
+    det_free(&req->det);
+    arena_release(&req->arena);
+    free(req);
+}
+
+// Hand a finished request to its connection's writer
+static void request_done(request_t *req) {
+    conn_t *conn = req->conn;
+    pthread_mutex_lock(&conn->lock);
+    req->next = NULL;
+    if (conn->done_tail == NULL) {
+        conn->done_head = req;
+    }
+    else {
+        conn->done_tail->next = req;
+    }
+    conn->done_tail = req;
+    pthread_cond_signal(&conn->ready);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static void group_run(task_t *task) {
+    group_t *group = (group_t *)task->arg;
+    for (int i = 0; i < group->count; i++) {
+        request_t *req = group->items[i];
+        compute_determinant(req->algo, req->matrix, &req->arena, &req->det);
+        request_done(req);
+    }
+    free(group);
+}
+
+static void *dispatcher_main(void *arg) {
+    server_t *server = (server_t *)arg;
+    for (;;) {
+        request_t *req;
+        pthread_mutex_lock(&server->lock);
+        while (server->head == NULL) {
+            pthread_cond_wait(&server->queued, &server->lock);
+        }
+        req = server->head;
+        server->head = server->tail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        // Everything that arrived since the last round, cut into groups
+        while (req != NULL) {
+            group_t *group = (group_t *)malloc(sizeof(group_t));
+            long cost = 0;
+            group->count = 0;
+            while (req != NULL && group->count < SERVE_GROUP_MAX && cost < SERVE_GROUP_COST) {
+                long n = req->matrix->n;
+                group->items[group->count++] = req;
+                cost += n * n * n;
+                req = req->next;
+            }
+            group->task.run = group_run;
+            group->task.arg = group;
+            group->task.pending = NULL;
+            pool_spawn(pool, &group->task);
+        }
+    }
+    return NULL;
+}
+
+static void submit(server_t *server, request_t *req) {
+    pthread_mutex_lock(&server->lock);
+    req->next = NULL;
+    if (server->tail == NULL) {
+        server->head = req;
+    }
+    else {
+        server->tail->next = req;
+    }
+    server->tail = req;
+    pthread_cond_signal(&server->queued);
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Parse one request frame into a request, a matrix that does not parse
+// is answered right away without going through the pool
+static request_t *read_request(conn_t *conn, int *status) {
+    unsigned char header[4 + SERVE_REQUEST_HEADER];
+    request_t *req;
+    uint32_t length;
+    size_t size;
+    char *body;
+    char name[32];
+
+    if ((*status = read_full(conn->fd, header, sizeof(header))) <= 0) {
+        return NULL;
+    }
+    length = get_u32(header);
+    if (length < SERVE_REQUEST_HEADER || length > SERVE_MAX_FRAME) {
+        fprintf(stderr, "serve: bad frame length %u, dropping client\n", length);
+        *status = -1;
+        return NULL;
+    }
+    size = length - SERVE_REQUEST_HEADER;
+    req = (request_t *)calloc(1, sizeof(request_t));
+    req->id = get_u32(header + 4);
+    req->algo = header[8] == SERVE_ALGO_DEFAULT ? conn->server->algo : header[8];
+    req->conn = conn;
+    arena_init_sized(&req->arena, SERVE_ARENA_BLOCK);
+    det_init(&req->det);
+    // Arena memory is aligned, so binary rows can be used where they land
+    body = (char *)arena_alloc(&req->arena, size + 1);
+    if (read_full(conn->fd, body, size) != 1) {
+        request_free(req);
+        *status = -1;
+        return NULL;
+    }
+    snprintf(name, sizeof(name), "request %u", req->id);
+    if (req->algo >= ALGO_COUNT) {
+        fprintf(stderr, "%s: unknown algorithm %i\n", name, req->algo);
+    }
+    else if (is_binary_matrix(body, size)) {
+        req->matrix = load_binary_matrix(body, size, name, &req->arena, NULL);
+    }
+    else {
+        req->matrix = parse_text_matrix(body, size, name, &req->arena, NULL);
+    }
+    // The engine would exit on it, taking every other client down too
+    if (req->matrix != NULL && req->algo == ALGO_SUBSET && req->matrix->n > SUBSET_MAX_N) {
+        fprintf(stderr, "%s: subset expansion supports matrices up to %ix%i\n", name, SUBSET_MAX_N, SUBSET_MAX_N);
+        req->matrix = NULL;
+    }
+    return req;
+}
+
+static void *conn_reader(void *arg) {
+    conn_t *conn = (conn_t *)arg;
+    request_t *req;
+    int status;
+
+    while ((req = read_request(conn, &status)) != NULL) {
+        pthread_mutex_lock(&conn->lock);
+        conn->in_flight += 1;
+        pthread_mutex_unlock(&conn->lock);
+        if (req->matrix == NULL) {
+            request_done(req);
+        }
+        else {
+            submit(conn->server, req);
+        }
+    }
+    // No more requests, the writer drains what is in flight and exits
+    shutdown(conn->fd, SHUT_RD);
+    pthread_mutex_lock(&conn->lock);
+    conn->reading = 0;
+    pthread_cond_signal(&conn->ready);
+    pthread_mutex_unlock(&conn->lock);
+    return NULL;
+}
+
+static int send_response(int fd, const request_t *req) {
+    unsigned char header[4 + SERVE_RESPONSE_HEADER];
+    char *text = req->matrix != NULL ? det_to_string(&req->det) : NULL;
+    const char *body = text != NULL ? text : "invalid matrix";
+    size_t len = strlen(body);
+    int status;
+
+    put_u32(header, SERVE_RESPONSE_HEADER + len);
+    put_u32(header + 4, req->id);
+    header[8] = text != NULL ? SERVE_OK : SERVE_ERROR;
+    status = write_full(fd, header, sizeof(header)) == 0 && write_full(fd, body, len) == 0 ? 0 : -1;
+    free(text);
+    return status;
+}
+
+static void *conn_writer(void *arg) {
+    conn_t *conn = (conn_t *)arg;
+    int broken = 0;
+
+    pthread_mutex_lock(&conn->lock);
+    for (;;) {
+        while (conn->done_head == NULL && (conn->reading || conn->in_flight > 0)) {
+            pthread_cond_wait(&conn->ready, &conn->lock);
+        }
+        if (conn->done_head == NULL) {
+            break;
+        }
+        request_t *batch = conn->done_head;
+        conn->done_head = conn->done_tail = NULL;
+        pthread_mutex_unlock(&conn->lock);
+
+        // Everything finished so far goes out in one go
+        int sent = 0;
+        while (batch != NULL) {
+            request_t *next = batch->next;
+            if (!broken && send_response(conn->fd, batch) != 0) {
+                broken = 1;
+            }
+            request_free(batch);
+            batch = next;
+            sent += 1;
+        }
+        pthread_mutex_lock(&conn->lock);
+        conn->in_flight -= sent;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->lock);
+    pthread_cond_destroy(&conn->ready);
+    free(conn);
+    return NULL;
+}
+
+static void serve_stop(int sig) {
+    (void)sig;
+    unlink(socket_path);
+    _exit(EXIT_SUCCESS);
+}
+
+static int socket_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static void serve_usage(char *program) {
+    fprintf(stderr, "Usage: %s serve [--socket PATH] [--algo=NAME] [--threads N] [--cutoff N] [--scalar]\n", program);
+    fprintf(stderr, "       [--cache] [--cache-file PATH] [--cache-minors]\n");
+    fprintf(stderr, "  Answers determinant requests on a Unix socket (default %s) with a\n", SERVE_DEFAULT_SOCKET);
+    fprintf(stderr, "  warm worker pool, see serve.h for the frame format\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant serve: one accept loop, a reader and a writer thread per
+// client and a dispatcher feeding the shared pool
+int serve_main(int argc, char **argv) {
+    int threads = default_thread_count();
+    int scalar = 0;
+    int cache = 0;
+    int cache_minors = 0;
+    const char *cache_file = NULL;
+    int listen_fd;
+    int opt;
+    struct sockaddr_un addr;
+    server_t server;
+    pthread_t dispatcher;
+
+    static struct option long_options[] = {
+        {"socket", required_argument, 0, 'S'},
+        {"threads", required_argument, 0, 't'},
+        {"cutoff", required_argument, 0, 'c'},
+        {"algo", required_argument, 0, 'a'},
+        {"scalar", no_argument, 0, 's'},
+        {"cache", no_argument, 0, 'C'},
+        {"cache-file", required_argument, 0, 'F'},
+        {"cache-minors", no_argument, 0, 'M'},
+        {0, 0, 0, 0}
+    };
+
+    memset(&server, 0, sizeof(server));
+    server.algo = ALGO_LAPLACE;
+    socket_path = SERVE_DEFAULT_SOCKET;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "S:t:c:a:sCF:M", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 't':
+                if ((threads = atoi(optarg)) < 1) {
+                    serve_usage(argv[0]);
+                }
+                break;
+            case 'c':
+                inline_cutoff = atoi(optarg);
+                break;
+            case 'a':
+                if ((server.algo = parse_algo(optarg)) < 0) {
+                    fprintf(stderr, "Unknown algorithm: %s\n", optarg);
+                    serve_usage(argv[0]);
+                }
+                break;
+            case 's':
+                scalar = 1;
+                break;
+            case 'C':
+                cache = 1;
+                break;
+            case 'F':
+                cache = 1;
+                cache_file = optarg;
+                break;
+            case 'M':
+                cache = 1;
+                cache_minors = 1;
+                break;
+            default:
+                serve_usage(argv[0]);
+        }
+    }
+    if (optind != argc || socket_address(&addr, socket_path) != 0) {
+        serve_usage(argv[0]);
+    }
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        perror(socket_path);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serve_stop);
+    signal(SIGTERM, serve_stop);
+
+    kernels_select(scalar);
+    if (cache) {
+        result_cache = cache_create(cache_file, cache_minors);
+    }
+    pool = pool_create(threads);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.queued, NULL);
+    pthread_create(&dispatcher, NULL, dispatcher_main, &server);
+    fprintf(stderr, "Serving on %s with %i threads\n", socket_path, threads);
+
+    for (;;) {
+        pthread_t reader;
+        pthread_t writer;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
+        }
+        conn_t *conn = (conn_t *)calloc(1, sizeof(conn_t));
+        conn->fd = fd;
+        conn->reading = 1;
+        conn->server = &server;
+        pthread_mutex_init(&conn->lock, NULL);
+        pthread_cond_init(&conn->ready, NULL);
+        pthread_create(&reader, NULL, conn_reader, conn);
+        pthread_create(&writer, NULL, conn_writer, conn);
+        pthread_detach(reader);
+        pthread_detach(writer);
+    }
+    return EXIT_SUCCESS;
+}
+
+typedef struct client_st {
+    int fd;
+    int algo;
+    int files;
+    char **names;
+    char **bodies;
+    size_t *sizes;
+    long repeat;
+} client_t;
+
+static char *read_file(const char *filename, size_t *size) {
+    FILE *fp = open_file((char *)filename, "rb");
+    char *buf;
+    long len;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    buf = (char *)malloc(len + 1);
+    if (fread(buf, 1, len, fp) != (size_t)len) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    *size = len;
+    return buf;
+}
+
+// Requests go out from their own thread so a client with more requests
+// in flight than the socket buffers hold cannot deadlock the server
+static void *client_sender(void *arg) {
+    client_t *client = (client_t *)arg;
+    uint32_t id = 0;
+    for (long r = 0; r < client->repeat; r++) {
+        for (int f = 0; f < client->files; f++, id++) {
+            unsigned char header[4 + SERVE_REQUEST_HEADER];
+            put_u32(header, SERVE_REQUEST_HEADER + client->sizes[f]);
+            put_u32(header + 4, id);
+            header[8] = client->algo;
+            if (write_full(client->fd, header, sizeof(header)) != 0 ||
+                write_full(client->fd, client->bodies[f], client->sizes[f]) != 0) {
+                perror("write");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    shutdown(client->fd, SHUT_WR);
+    return NULL;
+}
+
+static void client_usage(char *program) {
+    fprintf(stderr, "Usage: %s client [--socket PATH] [--algo=NAME] [--repeat N] <file>...\n", program);
+    fprintf(stderr, "  Sends every file as one request, N times over, and prints\n");
+    fprintf(stderr, "  \"<file> <det>\" per response as it arrives\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant client: a minimal client to exercise a running server
+int client_main(int argc, char **argv) {
+    const char *path = SERVE_DEFAULT_SOCKET;
+    client_t client = { .algo = SERVE_ALGO_DEFAULT, .repeat = 1 };
+    struct sockaddr_un addr;
+    pthread_t sender;
+    long received = 0;
+    long errors = 0;
+    double start;
+    int opt;
+
+    static struct option long_options[] = {
+        {"socket", required_argument, 0, 'S'},
+        {"algo", required_argument, 0, 'a'},
+        {"repeat", required_argument, 0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "S:a:r:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'S':
+                path = optarg;
+                break;
+            case 'a':
+                if ((client.algo = parse_algo(optarg)) < 0) {
+                    fprintf(stderr, "Unknown algorithm: %s\n", optarg);
+                    client_usage(argv[0]);
+                }
+                break;
+            case 'r':
+                if ((client.repeat = atol(optarg)) < 1) {
+                    client_usage(argv[0]);
+                }
+                break;
+            default:
+                client_usage(argv[0]);
+        }
+    }
+    if (optind == argc || socket_address(&addr, path) != 0) {
+        client_usage(argv[0]);
+    }
+
+    client.files = argc - optind;
+    client.names = argv + optind;
+    client.bodies = (char **)malloc(client.files * sizeof(char *));
+    client.sizes = (size_t *)malloc(client.files * sizeof(size_t));
+    for (int f = 0; f < client.files; f++) {
+        client.bodies[f] = read_file(client.names[f], &client.sizes[f]);
+        if (client.sizes[f] > SERVE_MAX_FRAME - SERVE_REQUEST_HEADER) {
+            fprintf(stderr, "%s: too large for one request\n", client.names[f]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((client.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(client.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_ms();
+    pthread_create(&sender, NULL, client_sender, &client);
+    for (;;) {
+        unsigned char header[4 + SERVE_RESPONSE_HEADER];
+        uint32_t length;
+        char *body;
+        int status = read_full(client.fd, header, sizeof(header));
+        if (status == 0) {
+            break;
+        }
+        if (status < 0 || (length = get_u32(header)) < SERVE_RESPONSE_HEADER || length > SERVE_MAX_FRAME) {
+            fprintf(stderr, "client: broken response\n");
+            exit(EXIT_FAILURE);
+        }
+        body = (char *)malloc(length - SERVE_RESPONSE_HEADER + 1);
+        if (read_full(client.fd, body, length - SERVE_RESPONSE_HEADER) < 0) {
+            fprintf(stderr, "client: broken response\n");
+            exit(EXIT_FAILURE);
+        }
+        body[length - SERVE_RESPONSE_HEADER] = '\0';
+        if (header[8] != SERVE_OK) {
+            errors += 1;
+        }
+        printf("%s %s\n", client.names[get_u32(header + 4) % client.files], header[8] == SERVE_OK ? body : "error");
+        free(body);
+        received += 1;
+    }
+    pthread_join(sender, NULL);
+    close(client.fd);
+    double elapsed = now_ms() - start;
+    fprintf(stderr, "Client: %li responses, %li errors, %.3f ms, %.0f requests/s\n", received, errors, elapsed,
+            elapsed > 0 ? received * 1000.0 / elapsed : 0.0);
+    for (int f = 0; f < client.files; f++) {
+        free(client.bodies[f]);
+    }
+    free(client.bodies);
+    free(client.sizes);
+    return errors > 0 || received != client.repeat * client.files ? EXIT_FAILURE : EXIT_SUCCESS;
+}
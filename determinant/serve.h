@@ -0,0 +1,25 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+// Wire format of determinant serve, all integers little endian. Every
+// frame starts with a u32 length counting the bytes that follow it
+//   request:  u32 length | u32 id | u8 algo | matrix
+//   response: u32 length | u32 id | u8 status | text
+// matrix is one text matrix or one binary record as written by convert,
+// algo is one of ALGO_* or SERVE_ALGO_DEFAULT for the server's --algo.
+// text is the decimal determinant with SERVE_OK, a message otherwise.
+// Responses come back as requests finish, not in request order
+#define SERVE_DEFAULT_SOCKET "/tmp/determinant.sock"
+#define SERVE_ALGO_DEFAULT 0xff
+#define SERVE_OK 0
+#define SERVE_ERROR 1
+#define SERVE_REQUEST_HEADER 5
+#define SERVE_RESPONSE_HEADER 5
+#define SERVE_MAX_FRAME (256u << 20)
+
+int serve_main(int argc, char **argv);
+int client_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,571 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <kernels.h>
+#include <modular.h>
+#include <session.h>
+
+typedef struct session_edit_st session_edit_t;
+typedef struct session_stream_st session_stream_t;
+
+// Per prime state is kept as parallel arrays so primes and residues can
+// go to modular_combine as they are
+struct session_st {
+    int n;
+    matrix_t matrix;
+    int count;
+    uint64_t *primes;
+    uint64_t *residues;
+    // A^-1 modulo each prime, row major, unless keep is 0
+    uint64_t **inverses;
+    int keep;
+    // valid: the inverse can take the next edit, stale: the residue is
+    // out of date and the prime is refactored by the next query
+    char *valid;
+    char *stale;
+    // Difference along the edited row or column and where it is nonzero
+    long long *delta;
+    int *nonzero;
+    long edits;
+    long queries;
+    long refactors;
+};
+
+// One edit spread over the primes
+struct session_edit_st {
+    session_t *session;
+    int index;
+    int col;
+    int nnz;
+};
+
+struct session_stream_st {
+    FILE *fp;
+    const char *name;
+    long line;
+    char *buf;
+    size_t cap;
+    session_t *session;
+    // Counters of the sessions already replaced
+    long edits;
+    long queries;
+    long refactors;
+};
+
+// Gauss-Jordan elimination of the matrix modulo prime k, giving its
+// determinant and, unless the session keeps none, its inverse
+static void session_factor(session_t *session, int k) {
+    int n = session->n;
+    uint64_t p = session->primes[k];
+    uint64_t det = 1;
+
+    session->stale[k] = 0;
+    if (!session->keep) {
+        session->residues[k] = modular_det_mod(&session->matrix, p);
+        session->valid[k] = 0;
+        return;
+    }
+    uint64_t *a = (uint64_t *)malloc((long)n * n * sizeof(uint64_t));
+    uint64_t *inv = session->inverses[k];
+    pool_count_minor_bytes(pool, (long)n * n * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[(long)i * n + j] = residue(MAT(&session->matrix, i, j), p);
+            inv[(long)i * n + j] = i == j;
+        }
+    }
+    for (int c = 0; c < n && det != 0; c++) {
+        uint64_t *pivot_row = a + (long)c * n;
+        uint64_t *pivot_inv = inv + (long)c * n;
+        int piv = c;
+        while (piv < n && a[(long)piv * n + c] == 0) {
+            piv++;
+        }
+        if (piv == n) {
+            det = 0;
+            break;
+        }
+        if (piv != c) {
+            uint64_t *other = a + (long)piv * n;
+            uint64_t *other_inv = inv + (long)piv * n;
+            for (int j = 0; j < n; j++) {
+                uint64_t tmp = pivot_row[j];
+                pivot_row[j] = other[j];
+                other[j] = tmp;
+                tmp = pivot_inv[j];
+                pivot_inv[j] = other_inv[j];
+                other_inv[j] = tmp;
+            }
+            det = p - det;
+        }
+        det = mul_mod(det, pivot_row[c], p);
+        uint64_t scale = inv_mod(pivot_row[c], p);
+        for (int j = c; j < n; j++) {
+            pivot_row[j] = mul_mod(pivot_row[j], scale, p);
+        }
+        for (int j = 0; j < n; j++) {
+            pivot_inv[j] = mul_mod(pivot_inv[j], scale, p);
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t factor = a[(long)i * n + c];
+            if (i == c || factor == 0) {
+                continue;
+            }
+            uint64_t shoup = kernel_shoup(factor, p);
+            kernels->mod_update(a + (long)i * n + c, pivot_row + c, n - c, factor, shoup, p);
+            kernels->mod_update(inv + (long)i * n, pivot_inv, n, factor, shoup, p);
+        }
+    }
+    free(a);
+    session->residues[k] = det;
+    // Singular modulo p, there is no inverse to update
+    session->valid[k] = det != 0;
+}
+
+// Row i replaced, A' = A + e_i d^T: det A' = det A (1 + d^T A^-1 e_i)
+// and A'^-1 = A^-1 - (A^-1 e_i)(d^T A^-1) / (1 + d^T A^-1 e_i)
+static void update_row(session_t *session, int k, const session_edit_t *edit, uint64_t *w) {
+    int n = session->n;
+    uint64_t p = session->primes[k];
+    uint64_t *inv = session->inverses[k];
+    int i = edit->index;
+
+    memset(w, 0, n * sizeof(uint64_t));
+    for (int t = 0; t < edit->nnz; t++) {
+        int r = session->nonzero[t];
+        uint64_t factor = p - residue(session->delta[r], p);
+        kernels->mod_update(w, inv + (long)r * n, n, factor, kernel_shoup(factor, p), p);
+    }
+    uint64_t f = w[i] + 1 == p ? 0 : w[i] + 1;
+    if (f == 0) {
+        session->residues[k] = 0;
+        session->valid[k] = 0;
+        return;
+    }
+    uint64_t finv = inv_mod(f, p);
+    for (int r = 0; r < n; r++) {
+        uint64_t factor = mul_mod(inv[(long)r * n + i], finv, p);
+        if (factor != 0) {
+            kernels->mod_update(inv + (long)r * n, w, n, factor, kernel_shoup(factor, p), p);
+        }
+    }
+    session->residues[k] = mul_mod(session->residues[k], f, p);
+}
+
+// Column j replaced, A' = A + d e_j^T: det A' = det A (1 + e_j^T A^-1 d)
+// and A'^-1 = A^-1 - (A^-1 d)(e_j^T A^-1) / (1 + e_j^T A^-1 d)
+static void update_col(session_t *session, int k, const session_edit_t *edit, uint64_t *u, uint64_t *w) {
+    int n = session->n;
+    uint64_t p = session->primes[k];
+    uint64_t *inv = session->inverses[k];
+    int j = edit->index;
+
+    for (int r = 0; r < n; r++) {
+        const uint64_t *row = inv + (long)r * n;
+        uint64_t sum = 0;
+        for (int t = 0; t < edit->nnz; t++) {
+            int c = session->nonzero[t];
+            sum += mul_mod(row[c], residue(session->delta[c], p), p);
+            sum = sum >= p ? sum - p : sum;
+        }
+        u[r] = sum;
+    }
+    uint64_t f = u[j] + 1 == p ? 0 : u[j] + 1;
+    if (f == 0) {
+        session->residues[k] = 0;
+        session->valid[k] = 0;
+        return;
+    }
+    uint64_t finv = inv_mod(f, p);
+    memcpy(w, inv + (long)j * n, n * sizeof(uint64_t));
+    for (int r = 0; r < n; r++) {
+        uint64_t factor = mul_mod(u[r], finv, p);
+        if (factor != 0) {
+            kernels->mod_update(inv + (long)r * n, w, n, factor, kernel_shoup(factor, p), p);
+        }
+    }
+    session->residues[k] = mul_mod(session->residues[k], f, p);
+}
+
+static void edit_primes(long begin, long end, void *arg) {
+    session_edit_t *edit = (session_edit_t *)arg;
+    session_t *session = edit->session;
+    uint64_t *scratch = (uint64_t *)malloc(2 * session->n * sizeof(uint64_t));
+    for (long k = begin; k < end; k++) {
+        if (!session->valid[k]) {
+            session->stale[k] = 1;
+        }
+        else if (edit->col) {
+            update_col(session, k, edit, scratch, scratch + session->n);
+        }
+        else {
+            update_row(session, k, edit, scratch);
+        }
+    }
+    free(scratch);
+}
+
+static void factor_primes(long begin, long end, void *arg) {
+    session_t *session = (session_t *)arg;
+    for (long k = begin; k < end; k++) {
+        if (session->stale[k]) {
+            session_factor(session, k);
+        }
+    }
+}
+
+// Enough primes for Hadamard's bound of the current matrix. New primes
+// start stale, and once the inverses would outgrow SESSION_MAX_BYTES
+// none are kept any more
+static void session_fit_primes(session_t *session) {
+    int n = session->n;
+    int count = modular_prime_count(hadamard_bits(&session->matrix, n));
+    if (count <= session->count) {
+        return;
+    }
+    session->primes = (uint64_t *)realloc(session->primes, count * sizeof(uint64_t));
+    session->residues = (uint64_t *)realloc(session->residues, count * sizeof(uint64_t));
+    session->inverses = (uint64_t **)realloc(session->inverses, count * sizeof(uint64_t *));
+    session->valid = (char *)realloc(session->valid, count);
+    session->stale = (char *)realloc(session->stale, count);
+    // The same primes come first whatever the count
+    modular_find_primes(session->primes, count);
+    if (session->keep && (long)count * n * n * sizeof(uint64_t) > SESSION_MAX_BYTES) {
+        for (int k = 0; k < session->count; k++) {
+            free(session->inverses[k]);
+            session->inverses[k] = NULL;
+            session->valid[k] = 0;
+        }
+        session->keep = 0;
+    }
+    for (int k = session->count; k < count; k++) {
+        session->inverses[k] = NULL;
+        if (session->keep) {
+            session->inverses[k] = (uint64_t *)malloc((long)n * n * sizeof(uint64_t));
+        }
+        session->valid[k] = 0;
+        session->stale[k] = 1;
+    }
+    session->count = count;
+}
+
+session_t *session_create(const matrix_t *matrix) {
+    session_t *session = (session_t *)calloc(1, sizeof(session_t));
+    int n = matrix->n;
+
+    session->n = n;
+    session->keep = 1;
+    session->matrix.n = n;
+    session->matrix.stride = n;
+    session->matrix.data = (int *)malloc((long)n * n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        memcpy(session->matrix.data + (long)i * n, &MAT(matrix, i, 0), n * sizeof(int));
+    }
+    session->delta = (long long *)malloc(n * sizeof(long long));
+    session->nonzero = (int *)malloc(n * sizeof(int));
+    session_fit_primes(session);
+    return session;
+}
+
+void session_destroy(session_t *session) {
+    for (int k = 0; k < session->count; k++) {
+        free(session->inverses[k]);
+    }
+    free(session->inverses);
+    free(session->primes);
+    free(session->residues);
+    free(session->valid);
+    free(session->stale);
+    free(session->delta);
+    free(session->nonzero);
+    free(session->matrix.data);
+    free(session);
+}
+
+// Applies session->delta at the nnz nonzero positions along row or
+// column index, to every prime and then to the matrix
+static void session_apply(session_t *session, int index, int col, int nnz) {
+    session_edit_t edit = { .session = session, .index = index, .col = col, .nnz = nnz };
+    if (nnz == 0) {
+        return;
+    }
+    pool_parallel_for(pool, 0, session->count, 1, edit_primes, &edit);
+    for (int t = 0; t < nnz; t++) {
+        int x = session->nonzero[t];
+        int *entry = col ? &MAT(&session->matrix, x, index) : &MAT(&session->matrix, index, x);
+        *entry += (int)session->delta[x];
+    }
+    session->edits += 1;
+    session_fit_primes(session);
+}
+
+void session_replace_row(session_t *session, int row, const int *values) {
+    int nnz = 0;
+    for (int j = 0; j < session->n; j++) {
+        session->delta[j] = (long long)values[j] - MAT(&session->matrix, row, j);
+        if (session->delta[j] != 0) {
+            session->nonzero[nnz++] = j;
+        }
+    }
+    session_apply(session, row, 0, nnz);
+}
+
+void session_replace_col(session_t *session, int col, const int *values) {
+    int nnz = 0;
+    for (int i = 0; i < session->n; i++) {
+        session->delta[i] = (long long)values[i] - MAT(&session->matrix, i, col);
+        if (session->delta[i] != 0) {
+            session->nonzero[nnz++] = i;
+        }
+    }
+    session_apply(session, col, 1, nnz);
+}
+
+// One entry is a row edit with a single nonzero, O(n^2) per prime
+// without ever touching the rest of the row
+void session_set(session_t *session, int row, int col, int value) {
+    session->delta[col] = (long long)value - MAT(&session->matrix, row, col);
+    session->nonzero[0] = col;
+    session_apply(session, row, 0, session->delta[col] != 0);
+}
+
+void session_det(session_t *session, det_t *det) {
+    for (int k = 0; k < session->count; k++) {
+        session->refactors += session->stale[k];
+    }
+    pool_parallel_for(pool, 0, session->count, 1, factor_primes, session);
+    modular_combine(session->primes, session->residues, session->count, det);
+    session->queries += 1;
+}
+
+static void stream_error(const session_stream_t *stream, const char *msg) {
+    fprintf(stderr, "%s:%li: %s\n", stream->name, stream->line, msg);
+    exit(EXIT_FAILURE);
+}
+
+// Next line without its newline, NULL at the end of the stream
+static char *stream_line(session_stream_t *stream) {
+    ssize_t len = getline(&stream->buf, &stream->cap, stream->fp);
+    if (len < 0) {
+        return NULL;
+    }
+    stream->line += 1;
+    while (len > 0 && isspace((unsigned char)stream->buf[len - 1])) {
+        stream->buf[--len] = '\0';
+    }
+    return stream->buf;
+}
+
+// Integer at *cursor, which is moved past it. 0 when there is none
+static int next_int(char **cursor, int *value) {
+    char *end;
+    errno = 0;
+    long v = strtol(*cursor, &end, 10);
+    if (end == *cursor) {
+        return 0;
+    }
+    if (errno == ERANGE || v < INT_MIN || v > INT_MAX) {
+        return 0;
+    }
+    *cursor = end;
+    *value = (int)v;
+    return 1;
+}
+
+static void read_values(session_stream_t *stream, char *cursor, int *values, int n) {
+    for (int j = 0; j < n; j++) {
+        if (!next_int(&cursor, &values[j])) {
+            stream_error(stream, "expected an integer");
+        }
+    }
+    while (isspace((unsigned char)*cursor)) {
+        cursor++;
+    }
+    if (*cursor != '\0') {
+        stream_error(stream, "too many values");
+    }
+}
+
+static int read_index(session_stream_t *stream, char **cursor, int n) {
+    int index;
+    if (!next_int(cursor, &index) || index < 0 || index >= n) {
+        stream_error(stream, "index out of range");
+    }
+    return index;
+}
+
+static void end_session(session_stream_t *stream) {
+    if (stream->session != NULL) {
+        stream->edits += stream->session->edits;
+        stream->queries += stream->session->queries;
+        stream->refactors += stream->session->refactors;
+        session_destroy(stream->session);
+        stream->session = NULL;
+    }
+}
+
+static void new_session(session_stream_t *stream, const matrix_t *matrix) {
+    end_session(stream);
+    stream->session = session_create(matrix);
+}
+
+// Whole command stream in one pool task, the edits and the queries use
+// the pool from inside it
+static void stream_task(task_t *task) {
+    session_stream_t *stream = (session_stream_t *)task->arg;
+    int *values = NULL;
+    char *line;
+
+    while ((line = stream_line(stream)) != NULL) {
+        char *cursor = line;
+        char word[16];
+        int skip = 0;
+        while (isspace((unsigned char)*cursor)) {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#') {
+            continue;
+        }
+        if (sscanf(cursor, "%15s%n", word, &skip) != 1) {
+            stream_error(stream, "expected a command");
+        }
+        cursor += skip;
+        if (strcmp(word, "matrix") == 0 || strcmp(word, "load") == 0) {
+            arena_t arena;
+            matrix_t *matrix;
+            arena_init(&arena);
+            if (strcmp(word, "load") == 0) {
+                while (isspace((unsigned char)*cursor)) {
+                    cursor++;
+                }
+                matrix = form__square_matrix(cursor, &arena);
+            }
+            else {
+                int n;
+                if (!next_int(&cursor, &n) || n < 1) {
+                    stream_error(stream, "expected the matrix size");
+                }
+                matrix = matrix_alloc(&arena, n);
+                for (int i = 0; i < n; i++) {
+                    if ((line = stream_line(stream)) == NULL) {
+                        stream_error(stream, "matrix ends early");
+                    }
+                    read_values(stream, line, &MAT(matrix, i, 0), n);
+                }
+            }
+            new_session(stream, matrix);
+            values = (int *)realloc(values, matrix->n * sizeof(int));
+            arena_release(&arena);
+            continue;
+        }
+        if (stream->session == NULL) {
+            stream_error(stream, "no matrix yet");
+        }
+        session_t *session = stream->session;
+        if (strcmp(word, "row") == 0 || strcmp(word, "col") == 0) {
+            int index = read_index(stream, &cursor, session->n);
+            read_values(stream, cursor, values, session->n);
+            if (word[0] == 'r') {
+                session_replace_row(session, index, values);
+            }
+            else {
+                session_replace_col(session, index, values);
+            }
+        }
+        else if (strcmp(word, "set") == 0) {
+            int row = read_index(stream, &cursor, session->n);
+            int col = read_index(stream, &cursor, session->n);
+            read_values(stream, cursor, values, 1);
+            session_set(session, row, col, values[0]);
+        }
+        else if (strcmp(word, "det") == 0) {
+            det_t det;
+            det_init(&det);
+            session_det(session, &det);
+            char *text = det_to_string(&det);
+            printf("%li %s\n", stream->line, text);
+            free(text);
+            det_free(&det);
+        }
+        else {
+            stream_error(stream, "unknown command");
+        }
+    }
+    free(values);
+}
+
+static void session_usage(char *program) {
+    fprintf(stderr, "Usage: %s session [--threads N] [--scalar] [<file>|-]\n", program);
+    fprintf(stderr, "  Reads commands from file or stdin, one per line, # starts a comment:\n");
+    fprintf(stderr, "    matrix N        followed by N lines of N integers, starts a new session\n");
+    fprintf(stderr, "    load PATH       starts a new session with a text or binary matrix file\n");
+    fprintf(stderr, "    row I V...      replaces row I (from 0) with the N values\n");
+    fprintf(stderr, "    col J V...      replaces column J with the N values\n");
+    fprintf(stderr, "    set I J V       replaces one entry\n");
+    fprintf(stderr, "    det             prints \"<line> <det>\" for the current matrix\n");
+    fprintf(stderr, "  Edits cost O(n^2) per prime, a query refactors only primes that could\n");
+    fprintf(stderr, "  not take an edit (the matrix was singular modulo them) or are new\n");
+    exit(EXIT_FAILURE);
+}
+
+// determinant session: an edit and query stream against one matrix
+int session_main(int argc, char **argv) {
+    int threads = default_thread_count();
+    int scalar = 0;
+    double start = now_ms();
+    session_stream_t stream = { .name = "-" };
+    int opt;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"scalar", no_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "t:s", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                if ((threads = atoi(optarg)) < 1) {
+                    session_usage(argv[0]);
+                }
+                break;
+            case 's':
+                scalar = 1;
+                break;
+            default:
+                session_usage(argv[0]);
+        }
+    }
+    if (optind < argc - 1) {
+        session_usage(argv[0]);
+    }
+    if (optind == argc - 1) {
+        stream.name = argv[optind];
+    }
+
+    kernels_select(scalar);
+    stream.fp = strcmp(stream.name, "-") == 0 ? stdin : open_file((char *)stream.name, "r");
+    pool = pool_create(threads);
+    task_t task = { .run = stream_task, .arg = &stream, .pending = NULL };
+    pool_run(pool, &task);
+    fflush(stdout);
+    end_session(&stream);
+    fprintf(stderr, "Session: %li edits, %li queries, %li prime refactorizations, %.3f ms\n",
+            stream.edits, stream.queries, stream.refactors, now_ms() - start);
+    pool_destroy(pool);
+    if (stream.fp != stdin) {
+        fclose(stream.fp);
+    }
+    free(stream.buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <matrix.h>
+#include <result.h>
+
+// Memory the per prime inverses of a session may take. Past it only the
+// residues are kept and every query after an edit is a full multi-modular
+// determinant again
+#define SESSION_MAX_BYTES (1L << 30)
+
+typedef struct session_st session_t;
+
+// A matrix kept together with its determinant and inverse modulo enough
+// primes. Replacing a row or a column is a rank-1 update: the matrix
+// determinant lemma gives the new determinant and Sherman-Morrison the
+// new inverse in O(n^2) per prime. Every call uses the pool, so like the
+// engines they are made from inside a pool task
+session_t *session_create(const matrix_t *matrix);
+void session_destroy(session_t *session);
+void session_replace_row(session_t *session, int row, const int *values);
+void session_replace_col(session_t *session, int col, const int *values);
+void session_set(session_t *session, int row, int col, int value);
+void session_det(session_t *session, det_t *det);
+int session_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+
+#include <determinant.h>
+#include <cache.h>
+#include <modular.h>
+#include <shard.h>
+
+#define SHARD_PENDING 0
+#define SHARD_RUNNING 1
+#define SHARD_DONE 2
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+typedef struct shard_header_st shard_header_t;
+typedef struct shard_st shard_t;
+typedef struct shard_work_st shard_work_t;
+
+// Start of the shared segment. The shard table follows it, then the
+// n x n entries, then the results: limbs per cofactor, or the primes
+// and their residues
+struct shard_header_st {
+    int n;
+    int algo;
+    int kind;
+    int count;
+    // Row the cofactors are taken along
+    int row;
+    // Room for one cofactor result, from Hadamard's bound
+    int limbs;
+    int primes;
+    size_t entries;
+    size_t results;
+};
+
+// One unit of work. state and owner only change under the semaphore,
+// the owner writes the result before it marks the shard done
+struct shard_st {
+    int state;
+    pid_t owner;
+    // Column of the cofactor, or the primes [first, last)
+    int first;
+    int last;
+    int neg;
+    int len;
+};
+
+// What a worker process runs one shard with, as a pool task
+struct shard_work_st {
+    char *base;
+    matrix_t matrix;
+    matrix_t *minor;
+    uint64_t *scratch;
+    arena_t *arena;
+    int index;
+};
+
+static int semaphore;
+static struct sembuf shard_lock_op = { 0, -1, SEM_UNDO };
+static struct sembuf shard_unlock_op = { 0, 1, SEM_UNDO };
+
+#define HEADER(base) ((shard_header_t *)(base))
+#define SHARDS(base) ((shard_t *)((base) + ALIGN8(sizeof(shard_header_t))))
+#define LIMBS(base, i) ((uint32_t *)((base) + HEADER(base)->results) + (long)(i) * HEADER(base)->limbs)
+#define PRIMES(base) ((uint64_t *)((base) + HEADER(base)->results))
+#define RESIDUES(base) (PRIMES(base) + HEADER(base)->primes)
+
+// SEM_UNDO gives the lock back if its holder dies, so a crashed worker
+// never leaves the others waiting
+static void shard_lock() {
+    while (semop(semaphore, &shard_lock_op, 1) != 0) {
+        if (errno != EINTR) {
+            perror("semop");
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void shard_unlock() {
+    while (semop(semaphore, &shard_unlock_op, 1) != 0) {
+        if (errno != EINTR) {
+            perror("semop");
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Index of a pending shard now owned by this process, -1 when none is left
+static int shard_claim(char *base) {
+    shard_t *shards = SHARDS(base);
+    int claimed = -1;
+    shard_lock();
+    for (int i = 0; i < HEADER(base)->count; i++) {
+        if (shards[i].state == SHARD_PENDING) {
+            shards[i].state = SHARD_RUNNING;
+            shards[i].owner = getpid();
+            claimed = i;
+            break;
+        }
+    }
+    shard_unlock();
+    return claimed;
+}
+
+static void shard_primes(long begin, long end, void *arg) {
+    shard_work_t *work = (shard_work_t *)arg;
+    for (long i = begin; i < end; i++) {
+        RESIDUES(work->base)[i] = modular_det_mod(&work->matrix, PRIMES(work->base)[i]);
+    }
+}
+
+// Signed cofactor of the expansion row times its entry, or the residues
+// of a range of primes
+static void shard_task(task_t *task) {
+    shard_work_t *work = (shard_work_t *)task->arg;
+    shard_header_t *header = HEADER(work->base);
+    shard_t *shard = SHARDS(work->base) + work->index;
+    int n = header->n;
+
+    if (header->kind == SHARD_PRIMES && header->algo == ALGO_RECURSIVE) {
+        for (int i = shard->first; i < shard->last; i++) {
+            RESIDUES(work->base)[i] = recursive_det_mod(&work->matrix, work->scratch, PRIMES(work->base)[i]);
+        }
+        return;
+    }
+    if (header->kind == SHARD_PRIMES) {
+        pool_parallel_for(pool, shard->first, shard->last, 1, shard_primes, work);
+        return;
+    }
+    int col = shard->first;
+    for (int i = 0, r = 0; i < n; i++) {
+        if (i == header->row) {
+            continue;
+        }
+        for (int j = 0, c = 0; j < n; j++) {
+            if (j != col) {
+                MAT(work->minor, r, c++) = MAT(&work->matrix, i, j);
+            }
+        }
+        r++;
+    }
+    det_t det;
+    bigint_t value;
+    det_init(&det);
+    bigint_init(&value);
+    compute_determinant(header->algo, work->minor, work->arena, &det);
+    det_to_bigint(&det, &value);
+    bigint_mul_i64(&value, &value, MAT(&work->matrix, header->row, col));
+    if ((header->row + col) % 2 == 1) {
+        bigint_neg(&value);
+    }
+    if (value.len > header->limbs) {
+        fprintf(stderr, "shard %i: cofactor exceeds its bound\n", work->index);
+        _exit(EXIT_FAILURE);
+    }
+    memcpy(LIMBS(work->base, work->index), value.limb, value.len * sizeof(uint32_t));
+    shard->neg = value.neg;
+    shard->len = value.len;
+    bigint_free(&value);
+    det_free(&det);
+}
+
+// Body of a forked worker: its own pool, then shards until none is
+// pending. Results go to the segment, the process never returns
+static void shard_worker(char *base, int threads) {
+    shard_header_t *header = HEADER(base);
+    arena_t arena;
+    shard_work_t work = { .base = base, .arena = &arena };
+    int index;
+
+    // The parent's pool threads did not survive the fork, and a cache
+    // file lock would be shared with the parent
+    pool = pool_create(threads);
+    result_cache = NULL;
+    arena_init(&arena);
+    work.matrix.n = header->n;
+    work.matrix.stride = header->n;
+    work.matrix.data = (int *)(base + header->entries);
+    if (header->kind == SHARD_COFACTORS) {
+        work.minor = matrix_alloc(&arena, header->n - 1);
+    }
+    else if (header->algo == ALGO_RECURSIVE) {
+        work.scratch = (uint64_t *)malloc((long)header->n * header->n * sizeof(uint64_t));
+    }
+    while ((index = shard_claim(base)) >= 0) {
+        task_t task = { .run = shard_task, .arg = &work, .pending = NULL };
+        work.index = index;
+        pool_run(pool, &task);
+        shard_lock();
+        SHARDS(base)[index].state = SHARD_DONE;
+        shard_unlock();
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static pid_t shard_fork(char *base, int threads) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+    }
+    else if (pid == 0) {
+        shard_worker(base, threads);
+    }
+    return pid;
+}
+
+// Row with the most zero entries, each of them is a cofactor less
+static int sparsest_row(const matrix_t *matrix, int *nonzeros) {
+    int best = 0;
+    *nonzeros = matrix->n + 1;
+    for (int i = 0; i < matrix->n; i++) {
+        int count = 0;
+        for (int j = 0; j < matrix->n; j++) {
+            count += MAT(matrix, i, j) != 0;
+        }
+        if (count < *nonzeros) {
+            best = i;
+            *nonzeros = count;
+        }
+    }
+    return best;
+}
+
+static void shard_cleanup(char *base) {
+    shmdt(base);
+    semctl(semaphore, 0, IPC_RMID);
+}
+
+// Determinant computed by processes forked workers of threads threads
+// each. The matrix goes into one SysV segment, workers claim shards from
+// a table next to it under a semaphore and leave their results there.
+// Shards of a worker that dies are handed to the others and a new worker
+// is started in its place, up to SHARD_RESTARTS per process
+void shard_determinant(int algo, const matrix_t *matrix, int processes, int threads, det_t *det) {
+    struct sembuf open_op = { 0, 1, 0 };
+    int n = matrix->n;
+    int kind = algo == ALGO_MODULAR || algo == ALGO_RECURSIVE ? SHARD_PRIMES : SHARD_COFACTORS;
+    double bits = hadamard_bits(matrix, n);
+    int row = 0;
+    int count;
+    int primes = 0;
+    size_t results;
+    size_t size;
+    cache_key_t key;
+
+    if (n == 1) {
+        det_set_i128(det, MAT(matrix, 0, 0), DET_INT64);
+        return;
+    }
+    if (result_cache != NULL) {
+        key = cache_key_matrix(matrix);
+        if (cache_get(result_cache, key, CACHE_ANY_WIDTH, det, 0)) {
+            return;
+        }
+    }
+    if (kind == SHARD_PRIMES) {
+        primes = modular_prime_count(bits);
+        count = primes < processes * SHARD_PRIMES_PER_PROCESS ? primes : processes * SHARD_PRIMES_PER_PROCESS;
+        results = 2 * primes * sizeof(uint64_t);
+    }
+    else {
+        row = sparsest_row(matrix, &count);
+        if (count == 0) {
+            det_set_i128(det, 0, DET_INT64);
+            return;
+        }
+        results = (size_t)count * ((int)(bits / 32) + 2) * sizeof(uint32_t);
+    }
+
+    size_t entries = ALIGN8(sizeof(shard_header_t)) + ALIGN8(count * sizeof(shard_t));
+    size = ALIGN8(entries + (size_t)n * n * sizeof(int)) + results;
+    int id = shmget(IPC_PRIVATE, size, 0600 | IPC_CREAT);
+    if (id < 0) {
+        perror("shmget");
+        exit(EXIT_FAILURE);
+    }
+    char *base = (char *)shmat(id, NULL, 0);
+    if (base == (char *)-1) {
+        perror("shmat");
+        exit(EXIT_FAILURE);
+    }
+    // Removed now, it goes away with the last process attached to it
+    shmctl(id, IPC_RMID, NULL);
+    if ((semaphore = semget(IPC_PRIVATE, 1, 0600 | IPC_CREAT)) < 0) {
+        perror("semget");
+        exit(EXIT_FAILURE);
+    }
+    semop(semaphore, &open_op, 1);
+
+    shard_header_t *header = HEADER(base);
+    shard_t *shards = SHARDS(base);
+    header->n = n;
+    header->algo = algo;
+    header->kind = kind;
+    header->count = count;
+    header->row = row;
+    header->limbs = (int)(bits / 32) + 2;
+    header->primes = primes;
+    header->entries = entries;
+    header->results = ALIGN8(entries + (size_t)n * n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        memcpy(base + entries + (size_t)i * n * sizeof(int), &MAT(matrix, i, 0), n * sizeof(int));
+    }
+    if (kind == SHARD_PRIMES) {
+        modular_find_primes(PRIMES(base), primes);
+        for (int i = 0; i < count; i++) {
+            shards[i] = (shard_t){ .state = SHARD_PENDING, .first = (long)primes * i / count,
+                                   .last = (long)primes * (i + 1) / count };
+        }
+    }
+    else {
+        for (int j = 0, i = 0; j < n; j++) {
+            if (MAT(matrix, row, j) != 0) {
+                shards[i++] = (shard_t){ .state = SHARD_PENDING, .first = j };
+            }
+        }
+    }
+
+    // Nothing buffered may be written twice by the children
+    fflush(stdout);
+    fflush(stderr);
+    int live = 0;
+    int restarts = processes * SHARD_RESTARTS;
+    for (int i = 0; i < processes; i++) {
+        live += shard_fork(base, threads) > 0;
+    }
+    while (live > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waitpid");
+            break;
+        }
+        live--;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            continue;
+        }
+        int pending = 0;
+        shard_lock();
+        for (int i = 0; i < count; i++) {
+            if (shards[i].state == SHARD_RUNNING && shards[i].owner == pid) {
+                shards[i].state = SHARD_PENDING;
+            }
+            pending += shards[i].state == SHARD_PENDING;
+        }
+        shard_unlock();
+        fprintf(stderr, "Worker %i %s %i, %i shards pending\n", (int)pid,
+                WIFSIGNALED(status) ? "killed by signal" : "exited with",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status), pending);
+        // Workers still running would pick them up too, but without a
+        // replacement the last crash would leave them pending
+        if (pending > 0 && restarts > 0) {
+            restarts--;
+            live += shard_fork(base, threads) > 0;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (shards[i].state != SHARD_DONE) {
+            fprintf(stderr, "Shard %i of %i was not computed\n", i, count);
+            shard_cleanup(base);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (kind == SHARD_PRIMES) {
+        modular_combine(PRIMES(base), RESIDUES(base), primes, det);
+    }
+    else {
+        bigint_t total;
+        bigint_init(&total);
+        for (int i = 0; i < count; i++) {
+            bigint_t term = { .neg = shards[i].neg, .len = shards[i].len, .cap = shards[i].len, .limb = LIMBS(base, i) };
+            bigint_add(&total, &total, &term);
+        }
+        det_set_big(det, &total);
+        bigint_free(&total);
+    }
+    shard_cleanup(base);
+    if (result_cache != NULL) {
+        cache_put(result_cache, key, det, 0);
+    }
+}
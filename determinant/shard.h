@@ -0,0 +1,18 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <matrix.h>
+#include <result.h>
+
+// How a job is cut for --processes: modular and recursive hand out
+// ranges of primes, every other engine a cofactor of the expansion row
+#define SHARD_COFACTORS 0
+#define SHARD_PRIMES 1
+// Prime shards per worker process, more than one so a crash loses little
+#define SHARD_PRIMES_PER_PROCESS 4
+// Worker processes started again after crashes, per process asked for
+#define SHARD_RESTARTS 2
+
+void shard_determinant(int algo, const matrix_t *matrix, int processes, int threads, det_t *det);
+
+#endif
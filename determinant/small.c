@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <kernels.h>
+#include <small.h>
+
+// Entry (i, j) of the view, widened before any arithmetic
+#define X(type, i, j) ((type)VIEW(m, i, j))
+
+// Determinants of the k x k blocks made of the bottom k rows (from row r
+// on) and the listed columns, each expanded along its first row into the
+// (k - 1) x (k - 1) blocks below. Every block is computed exactly once and
+// shared by all the bigger ones containing it, so a 4x4 costs 6 2x2
+// products and 4 3x3 ones instead of 4 separate 3x3 expansions
+#define P2(type, r, a, b) type p2_##a##b = X(type, r, a) * X(type, r + 1, b) - X(type, r, b) * X(type, r + 1, a)
+#define P3(type, r, a, b, c) \
+    type p3_##a##b##c = X(type, r, a) * p2_##b##c - X(type, r, b) * p2_##a##c + X(type, r, c) * p2_##a##b
+#define P4(type, r, a, b, c, d)                                                                 \
+    type p4_##a##b##c##d = X(type, r, a) * p3_##b##c##d - X(type, r, b) * p3_##a##c##d +       \
+                           X(type, r, c) * p3_##a##b##d - X(type, r, d) * p3_##a##b##c
+#define P5(type, r, a, b, c, d, e)                                                              \
+    type p5_##a##b##c##d##e = X(type, r, a) * p4_##b##c##d##e - X(type, r, b) * p4_##a##c##d##e + \
+                              X(type, r, c) * p4_##a##b##d##e - X(type, r, d) * p4_##a##b##c##e + \
+                              X(type, r, e) * p4_##a##b##c##d
+
+// Fully unrolled 1x1 .. 6x6 determinants in a given type, without loops,
+// calls or memory beyond the named sub-products. The last statement is
+// result followed by the value, return for a function or an assignment.
+// The width table guarantees no intermediate overflows: every block is a
+// minor of the leading rows its bound covers
+#define SMALL_DET1(type, result)                                                                                \
+    result X(type, 0, 0)
+#define SMALL_DET2(type, result)                                                                                \
+    result X(type, 0, 0) * X(type, 1, 1) - X(type, 0, 1) * X(type, 1, 0)
+#define SMALL_DET3(type, result)                                                                                \
+    P2(type, 1, 0, 1); P2(type, 1, 0, 2); P2(type, 1, 1, 2);                                                    \
+    result X(type, 0, 0) * p2_12 - X(type, 0, 1) * p2_02 + X(type, 0, 2) * p2_01
+#define SMALL_DET4(type, result)                                                                                \
+    P2(type, 2, 0, 1); P2(type, 2, 0, 2); P2(type, 2, 0, 3); P2(type, 2, 1, 2); P2(type, 2, 1, 3);              \
+    P2(type, 2, 2, 3);                                                                                          \
+    P3(type, 1, 0, 1, 2); P3(type, 1, 0, 1, 3); P3(type, 1, 0, 2, 3); P3(type, 1, 1, 2, 3);                     \
+    result X(type, 0, 0) * p3_123 - X(type, 0, 1) * p3_023 + X(type, 0, 2) * p3_013                             \
+           - X(type, 0, 3) * p3_012
+#define SMALL_DET5(type, result)                                                                                \
+    P2(type, 3, 0, 1); P2(type, 3, 0, 2); P2(type, 3, 0, 3); P2(type, 3, 0, 4); P2(type, 3, 1, 2);              \
+    P2(type, 3, 1, 3); P2(type, 3, 1, 4); P2(type, 3, 2, 3); P2(type, 3, 2, 4); P2(type, 3, 3, 4);              \
+    P3(type, 2, 0, 1, 2); P3(type, 2, 0, 1, 3); P3(type, 2, 0, 1, 4); P3(type, 2, 0, 2, 3);                     \
+    P3(type, 2, 0, 2, 4); P3(type, 2, 0, 3, 4); P3(type, 2, 1, 2, 3); P3(type, 2, 1, 2, 4);                     \
+    P3(type, 2, 1, 3, 4); P3(type, 2, 2, 3, 4);                                                                 \
+    P4(type, 1, 0, 1, 2, 3); P4(type, 1, 0, 1, 2, 4); P4(type, 1, 0, 1, 3, 4);                                  \
+    P4(type, 1, 0, 2, 3, 4); P4(type, 1, 1, 2, 3, 4);                                                           \
+    result X(type, 0, 0) * p4_1234 - X(type, 0, 1) * p4_0234 + X(type, 0, 2) * p4_0134                          \
+           - X(type, 0, 3) * p4_0124 + X(type, 0, 4) * p4_0123
+#define SMALL_DET6(type, result)                                                                                \
+    P2(type, 4, 0, 1); P2(type, 4, 0, 2); P2(type, 4, 0, 3); P2(type, 4, 0, 4); P2(type, 4, 0, 5);              \
+    P2(type, 4, 1, 2); P2(type, 4, 1, 3); P2(type, 4, 1, 4); P2(type, 4, 1, 5); P2(type, 4, 2, 3);              \
+    P2(type, 4, 2, 4); P2(type, 4, 2, 5); P2(type, 4, 3, 4); P2(type, 4, 3, 5); P2(type, 4, 4, 5);              \
+    P3(type, 3, 0, 1, 2); P3(type, 3, 0, 1, 3); P3(type, 3, 0, 1, 4); P3(type, 3, 0, 1, 5);                     \
+    P3(type, 3, 0, 2, 3); P3(type, 3, 0, 2, 4); P3(type, 3, 0, 2, 5); P3(type, 3, 0, 3, 4);                     \
+    P3(type, 3, 0, 3, 5); P3(type, 3, 0, 4, 5); P3(type, 3, 1, 2, 3); P3(type, 3, 1, 2, 4);                     \
+    P3(type, 3, 1, 2, 5); P3(type, 3, 1, 3, 4); P3(type, 3, 1, 3, 5); P3(type, 3, 1, 4, 5);                     \
+    P3(type, 3, 2, 3, 4); P3(type, 3, 2, 3, 5); P3(type, 3, 2, 4, 5); P3(type, 3, 3, 4, 5);                     \
+    P4(type, 2, 0, 1, 2, 3); P4(type, 2, 0, 1, 2, 4); P4(type, 2, 0, 1, 2, 5);                                  \
+    P4(type, 2, 0, 1, 3, 4); P4(type, 2, 0, 1, 3, 5); P4(type, 2, 0, 1, 4, 5);                                  \
+    P4(type, 2, 0, 2, 3, 4); P4(type, 2, 0, 2, 3, 5); P4(type, 2, 0, 2, 4, 5);                                  \
+    P4(type, 2, 0, 3, 4, 5); P4(type, 2, 1, 2, 3, 4); P4(type, 2, 1, 2, 3, 5);                                  \
+    P4(type, 2, 1, 2, 4, 5); P4(type, 2, 1, 3, 4, 5); P4(type, 2, 2, 3, 4, 5);                                  \
+    P5(type, 1, 0, 1, 2, 3, 4); P5(type, 1, 0, 1, 2, 3, 5); P5(type, 1, 0, 1, 2, 4, 5);                         \
+    P5(type, 1, 0, 1, 3, 4, 5); P5(type, 1, 0, 2, 3, 4, 5); P5(type, 1, 1, 2, 3, 4, 5);                         \
+    result X(type, 0, 0) * p5_12345 - X(type, 0, 1) * p5_02345 + X(type, 0, 2) * p5_01345                       \
+           - X(type, 0, 3) * p5_01245 + X(type, 0, 4) * p5_01235 - X(type, 0, 5) * p5_01234
+
+// The kernels on a view, one matrix at a time
+#define DEFINE_SMALL_DETS(suffix, type)                                                                         \
+    static type small_det1##suffix(const view_t *m) {                                                           \
+        SMALL_DET1(type, return);                                                                               \
+    }                                                                                                           \
+    static type small_det2##suffix(const view_t *m) {                                                           \
+        SMALL_DET2(type, return);                                                                               \
+    }                                                                                                           \
+    static type small_det3##suffix(const view_t *m) {                                                           \
+        SMALL_DET3(type, return);                                                                               \
+    }                                                                                                           \
+    static type small_det4##suffix(const view_t *m) {                                                           \
+        SMALL_DET4(type, return);                                                                               \
+    }                                                                                                           \
+    static type small_det5##suffix(const view_t *m) {                                                           \
+        SMALL_DET5(type, return);                                                                               \
+    }                                                                                                           \
+    static type small_det6##suffix(const view_t *m) {                                                           \
+        SMALL_DET6(type, return);                                                                               \
+    }                                                                                                           \
+    type small_det##suffix(const view_t *m) {                                                                   \
+        switch (m->n) {                                                                                         \
+            case 1:                                                                                             \
+                return small_det1##suffix(m);                                                                   \
+            case 2:                                                                                             \
+                return small_det2##suffix(m);                                                                   \
+            case 3:                                                                                             \
+                return small_det3##suffix(m);                                                                   \
+            case 4:                                                                                             \
+                return small_det4##suffix(m);                                                                   \
+            case 5:                                                                                             \
+                return small_det5##suffix(m);                                                                   \
+            case 6:                                                                                             \
+                return small_det6##suffix(m);                                                                   \
+        }                                                                                                       \
+        return 0;                                                                                               \
+    }
+
+DEFINE_SMALL_DETS(, long long)
+DEFINE_SMALL_DETS(_wide, __int128)
+
+// The same kernels over SMALL_LANES matrices at once: every named
+// sub-product is a vector of doubles, one lane per matrix. Doubles hold
+// every intermediate exactly below SMALL_LANE_BOUND, which
+// small_lanes_commit checks per matrix
+typedef double lane_t __attribute__((vector_size(SMALL_LANES * sizeof(double))));
+typedef int32_t lane_int_t __attribute__((vector_size(SMALL_LANES * sizeof(int32_t))));
+typedef long long lane_long_t __attribute__((vector_size(SMALL_LANES * sizeof(long long))));
+
+#undef X
+#define X(type, i, j) (e[(i) * SMALL_MAX_N + (j)])
+
+// Entries are widened once into e, the result goes out through det so no
+// vector is ever passed by value
+#define DEFINE_SMALL_LANES(name, target)                                                                        \
+    target static void name##1(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET1(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target static void name##2(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET2(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target static void name##3(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET3(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target static void name##4(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET4(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target static void name##5(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET5(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target static void name##6(const lane_t *e, lane_t *det) {                                                  \
+        SMALL_DET6(lane_t, *det =);                                                                             \
+    }                                                                                                           \
+    target void name(const int32_t *block, int n, long long *dets) {                                            \
+        lane_t e[SMALL_MAX_N * SMALL_MAX_N];                                                                    \
+        lane_t det = { 0 };                                                                                     \
+        lane_long_t out;                                                                                        \
+        for (int i = 0; i < n; i++) {                                                                           \
+            for (int j = 0; j < n; j++) {                                                                       \
+                lane_int_t v;                                                                                   \
+                memcpy(&v, block + (i * n + j) * SMALL_LANES, sizeof(v));                                       \
+                X(lane_t, i, j) = __builtin_convertvector(v, lane_t);                                           \
+            }                                                                                                   \
+        }                                                                                                       \
+        switch (n) {                                                                                            \
+            case 1:                                                                                             \
+                name##1(e, &det);                                                                               \
+                break;                                                                                          \
+            case 2:                                                                                             \
+                name##2(e, &det);                                                                               \
+                break;                                                                                          \
+            case 3:                                                                                             \
+                name##3(e, &det);                                                                               \
+                break;                                                                                          \
+            case 4:                                                                                             \
+                name##4(e, &det);                                                                               \
+                break;                                                                                          \
+            case 5:                                                                                             \
+                name##5(e, &det);                                                                               \
+                break;                                                                                          \
+            case 6:                                                                                             \
+                name##6(e, &det);                                                                               \
+                break;                                                                                          \
+        }                                                                                                       \
+        out = __builtin_convertvector(det, lane_long_t);                                                        \
+        memcpy(dets, &out, sizeof(out));                                                                        \
+    }
+
+DEFINE_SMALL_LANES(small_lanes_scalar, )
+#if defined(__x86_64__)
+DEFINE_SMALL_LANES(small_lanes_avx2, TARGET_AVX2)
+DEFINE_SMALL_LANES(small_lanes_avx512, TARGET_AVX512)
+#endif
+
+void small_lanes_init(small_lanes_t *lanes, long cap) {
+    lanes->n = 0;
+    lanes->count = 0;
+    lanes->cap = cap;
+    lanes->data = NULL;
+}
+
+void small_lanes_free(small_lanes_t *lanes) {
+    free(lanes->data);
+    lanes->data = NULL;
+    lanes->count = 0;
+}
+
+// Slot of the next matrix, entry (i, j) at [(i * n + j) * SMALL_LANES].
+// The first matrix fixes n, NULL when the batch is full or of another size
+int32_t *small_lanes_start(small_lanes_t *lanes, int n) {
+    long blocks = (lanes->cap + SMALL_LANES - 1) / SMALL_LANES;
+    long index = lanes->count;
+    if (n < 1 || n > SMALL_MAX_N || index == lanes->cap || (index > 0 && n != lanes->n)) {
+        return NULL;
+    }
+    if (index == 0 && (lanes->data == NULL || n != lanes->n)) {
+        lanes->n = n;
+        lanes->data = (int32_t *)realloc(lanes->data, blocks * n * n * SMALL_LANES * sizeof(int32_t));
+        memset(lanes->data, 0, blocks * n * n * SMALL_LANES * sizeof(int32_t));
+    }
+    return lanes->data + index / SMALL_LANES * n * n * SMALL_LANES + index % SMALL_LANES;
+}
+
+// Keep the matrix written to the slot of small_lanes_start, unless its
+// row sum bound is too large for the double lanes. Returns whether it
+// was kept
+int small_lanes_commit(small_lanes_t *lanes) {
+    int n = lanes->n;
+    long index = lanes->count;
+    const int32_t *slot = lanes->data + index / SMALL_LANES * n * n * SMALL_LANES + index % SMALL_LANES;
+    double bound = 1;
+    for (int i = 0; i < n; i++) {
+        double sum = 0;
+        for (int j = 0; j < n; j++) {
+            sum += llabs((long long)slot[(i * n + j) * SMALL_LANES]);
+        }
+        if (sum > 1) {
+            bound *= sum;
+        }
+    }
+    if (bound >= SMALL_LANE_BOUND) {
+        return 0;
+    }
+    lanes->count += 1;
+    return 1;
+}
+
+int small_lanes_add(small_lanes_t *lanes, const matrix_t *matrix) {
+    int n = matrix->n;
+    int32_t *slot = small_lanes_start(lanes, n);
+    if (slot == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            slot[(i * n + j) * SMALL_LANES] = MAT(matrix, i, j);
+        }
+    }
+    return small_lanes_commit(lanes);
+}
+
+// Determinants of all the matrices, in order. Lanes past count in the
+// last block are zero or left over, their results are dropped
+void small_lanes_det(const small_lanes_t *lanes, long long *dets) {
+    int n = lanes->n;
+    long full = lanes->count / SMALL_LANES;
+    for (long b = 0; b < full; b++) {
+        kernels->small_lanes(lanes->data + b * n * n * SMALL_LANES, n, dets + b * SMALL_LANES);
+    }
+    if (lanes->count % SMALL_LANES != 0) {
+        long long last[SMALL_LANES];
+        kernels->small_lanes(lanes->data + full * n * n * SMALL_LANES, n, last);
+        memcpy(dets + full * SMALL_LANES, last, lanes->count % SMALL_LANES * sizeof(long long));
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SMALL_H
+#define SMALL_H
+
+#include <stdint.h>
+#include <matrix.h>
+
+// Largest size with an unrolled kernel, see small.c
+#define SMALL_MAX_N 6
+// Matrices computed side by side by the batched kernels, one per double
+// lane of an AVX-512 register (two AVX2 ones, four SSE2 ones)
+#define SMALL_LANES 8
+// The batched kernels compute in doubles, exact as long as the row sum
+// bound of a matrix stays below 2^53
+#define SMALL_LANE_BOUND 0x1p52
+
+typedef struct small_lanes_st small_lanes_t;
+
+// Matrices of one size in structure of arrays layout: entry (i, j) of the
+// SMALL_LANES matrices of block b sits side by side at
+// data[((b * n + i) * n + j) * SMALL_LANES], so one vector load fetches
+// it for the whole block. Up to cap matrices, storage is allocated when
+// the first one fixes n
+struct small_lanes_st {
+    int n;
+    long count;
+    long cap;
+    int32_t *data;
+};
+
+long long small_det(const view_t *m);
+__int128 small_det_wide(const view_t *m);
+
+void small_lanes_init(small_lanes_t *lanes, long cap);
+void small_lanes_free(small_lanes_t *lanes);
+int32_t *small_lanes_start(small_lanes_t *lanes, int n);
+int small_lanes_commit(small_lanes_t *lanes);
+int small_lanes_add(small_lanes_t *lanes, const matrix_t *matrix);
+void small_lanes_det(const small_lanes_t *lanes, long long *dets);
+
+// One block of SMALL_LANES matrices per call, per instruction set, see
+// kernels_t
+void small_lanes_scalar(const int32_t *block, int n, long long *dets);
+#if defined(__x86_64__)
+void small_lanes_avx2(const int32_t *block, int n, long long *dets);
+void small_lanes_avx512(const int32_t *block, int n, long long *dets);
+#endif
+
+#endif
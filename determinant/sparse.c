@@ -0,0 +1,731 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <determinant.h>
+#include <modular.h>
+#include <sparse.h>
+
+csr_t *csr_from_matrix(const matrix_t *matrix, arena_t *arena) {
+    csr_t *csr = (csr_t *)arena_alloc(arena, sizeof(csr_t));
+    long nnz = 0;
+    int n = matrix->n;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            nnz += MAT(matrix, i, j) != 0;
+        }
+    }
+    csr->n = n;
+    csr->nnz = nnz;
+    csr->row_ptr = (long *)arena_alloc(arena, (n + 1) * sizeof(long));
+    csr->col = (int *)arena_alloc(arena, (nnz + 1) * sizeof(int));
+    csr->val = (int *)arena_alloc(arena, (nnz + 1) * sizeof(int));
+    nnz = 0;
+    csr->row_ptr[0] = 0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (MAT(matrix, i, j) != 0) {
+                csr->col[nnz] = j;
+                csr->val[nnz] = MAT(matrix, i, j);
+                nnz += 1;
+            }
+        }
+        csr->row_ptr[i + 1] = nnz;
+    }
+    return csr;
+}
+
+matrix_t *csr_to_matrix(const csr_t *csr, arena_t *arena) {
+    matrix_t *matrix = matrix_alloc(arena, csr->n);
+    memset(matrix->data, 0, (long)csr->n * csr->n * sizeof(int));
+    for (int i = 0; i < csr->n; i++) {
+        for (long k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++) {
+            MAT(matrix, i, csr->col[k]) = csr->val[k];
+        }
+    }
+    return matrix;
+}
+
+// Same output as print_matrix, without ever holding a dense row
+void print_sparse_matrix(const csr_t *csr) {
+    printf("START PRINTING MATRIX\n");
+    for (int i = 0; i < csr->n; i++) {
+        long k = csr->row_ptr[i];
+        for (int j = 0; j < csr->n; j++) {
+            if (k < csr->row_ptr[i + 1] && csr->col[k] == j) {
+                printf("%i ", csr->val[k]);
+                k += 1;
+            }
+            else {
+                printf("0 ");
+            }
+        }
+        printf("\n");
+    }
+    printf("END PRINTING MATRIX\n");
+}
+
+// hadamard_bits over the stored entries only
+double csr_hadamard_bits(const csr_t *csr) {
+    double bits = 0;
+    for (int i = 0; i < csr->n; i++) {
+        double norm = 0;
+        for (long k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++) {
+            double x = csr->val[k];
+            norm += x * x;
+        }
+        if (norm > 1) {
+            bits += 0.5 * log2(norm);
+        }
+    }
+    return bits;
+}
+
+// row_sum_bits over the stored entries only
+double csr_row_sum_bits(const csr_t *csr) {
+    double bits = 0;
+    for (int i = 0; i < csr->n; i++) {
+        double sum = 0;
+        for (long k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++) {
+            sum += fabs((double)csr->val[k]);
+        }
+        if (sum > 1) {
+            bits += log2(sum);
+        }
+    }
+    return bits;
+}
+
+// The columns of csr as the rows of a new matrix, malloc'ed in one block
+// so a single free releases it
+static csr_t *csr_transpose(const csr_t *csr) {
+    int n = csr->n;
+    csr_t *t = (csr_t *)malloc(sizeof(csr_t) + (n + 1) * sizeof(long) + 2 * (csr->nnz + 1) * sizeof(int));
+    long *next;
+
+    t->n = n;
+    t->nnz = csr->nnz;
+    t->row_ptr = (long *)(t + 1);
+    t->col = (int *)(t->row_ptr + n + 1);
+    t->val = t->col + csr->nnz + 1;
+    memset(t->row_ptr, 0, (n + 1) * sizeof(long));
+    for (long k = 0; k < csr->nnz; k++) {
+        t->row_ptr[csr->col[k] + 1] += 1;
+    }
+    for (int j = 0; j < n; j++) {
+        t->row_ptr[j + 1] += t->row_ptr[j];
+    }
+    next = (long *)malloc((n + 1) * sizeof(long));
+    memcpy(next, t->row_ptr, (n + 1) * sizeof(long));
+    for (int i = 0; i < n; i++) {
+        for (long k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++) {
+            long at = next[csr->col[k]]++;
+            t->col[at] = i;
+            t->val[at] = csr->val[k];
+        }
+    }
+    free(next);
+    return t;
+}
+
+// Sparse Laplace expansion. A minor is the matrix restricted to the rows
+// and columns still marked live, so descending one level only takes two
+// lines out. Every level expands along whichever live row or column has
+// the fewest live nonzeros, zero entries are never visited and a line
+// with none ends the branch at once. Minors of up to SMALL_MAX_N lines
+// are gathered into a dense block for the unrolled kernels
+typedef struct expand_st {
+    const csr_t *rows;
+    csr_t *cols;
+} expand_t;
+
+// Live rows or columns of one branch. count is the number of live
+// nonzeros of every line, kept up to date as crossing lines come and go,
+// and tree a Fenwick tree over the live flags, which gives the position
+// of a line among the live ones (and with it the cofactor sign) in
+// O(log n)
+typedef struct lines_st {
+    char *live;
+    int *count;
+    int *tree;
+} lines_t;
+
+// Both sides of a branch in one malloc'ed block, see live_alloc
+typedef struct live_st {
+    int n;
+    lines_t row;
+    lines_t col;
+} live_t;
+
+typedef struct root_st {
+    const expand_t *e;
+    const live_t *live;
+    int line;
+    int is_row;
+    int m;
+    const int *other;
+    __int128 *small;
+    bigint_t *big;
+} root_t;
+
+static void live_alloc(live_t *live, int n) {
+    int *ints = (int *)malloc((4 * (n + 1) + 1) * sizeof(int) + 2 * n);
+    live->n = n;
+    live->row.count = ints;
+    live->row.tree = ints + n + 1;
+    live->col.count = ints + 2 * (n + 1);
+    live->col.tree = ints + 3 * (n + 1);
+    live->row.live = (char *)(ints + 4 * (n + 1) + 1);
+    live->col.live = live->row.live + n;
+}
+
+static void live_free(live_t *live) {
+    free(live->row.count);
+}
+
+static void live_copy(live_t *dst, const live_t *src) {
+    memcpy(dst->row.count, src->row.count, 4 * (src->n + 1) * sizeof(int));
+    memcpy(dst->row.live, src->row.live, 2 * src->n);
+}
+
+// Every line live, a Fenwick tree over all ones has node i covering the
+// lowest set bit of i
+static void lines_init(lines_t *lines, const csr_t *csr) {
+    int n = csr->n;
+    memset(lines->live, 1, n);
+    lines->tree[0] = 0;
+    for (int i = 0; i < n; i++) {
+        lines->count[i] = (int)(csr->row_ptr[i + 1] - csr->row_ptr[i]);
+        lines->tree[i + 1] = (i + 1) & -(i + 1);
+    }
+}
+
+// Live lines before index
+static int live_position(const lines_t *lines, int index) {
+    int pos = 0;
+    for (int i = index; i > 0; i -= i & -i) {
+        pos += lines->tree[i];
+    }
+    return pos;
+}
+
+// Takes line out of own (delta -1) or puts it back (delta 1). The lines
+// it crosses in other lose or regain one live nonzero
+static void update_line(const csr_t *lines, lines_t *own, lines_t *other, int line, int delta) {
+    own->live[line] = delta > 0;
+    for (int i = line + 1; i <= lines->n; i += i & -i) {
+        own->tree[i] += delta;
+    }
+    for (long k = lines->row_ptr[line]; k < lines->row_ptr[line + 1]; k++) {
+        other->count[lines->col[k]] += delta;
+    }
+}
+
+// Sparsest live line, returns its number of live nonzeros
+static int pick_line(const live_t *live, int *line, int *is_row) {
+    int best = INT_MAX;
+    for (int i = 0; i < live->n && best > 0; i++) {
+        if (live->row.live[i] && live->row.count[i] < best) {
+            best = live->row.count[i];
+            *line = i;
+            *is_row = 1;
+        }
+    }
+    for (int j = 0; j < live->n && best > 0; j++) {
+        if (live->col.live[j] && live->col.count[j] < best) {
+            best = live->col.count[j];
+            *line = j;
+            *is_row = 0;
+        }
+    }
+    return best;
+}
+
+// The m x m minor of the live lines as a dense block, rows and columns in
+// their original order
+static void gather_minor(const expand_t *e, const live_t *live, int m, matrix_t *dense) {
+    int row = 0;
+    dense->n = m;
+    dense->stride = m;
+    memset(dense->data, 0, m * m * sizeof(int));
+    for (int i = 0; i < live->n && row < m; i++) {
+        if (!live->row.live[i]) {
+            continue;
+        }
+        for (long k = e->rows->row_ptr[i]; k < e->rows->row_ptr[i + 1]; k++) {
+            int j = e->rows->col[k];
+            if (live->col.live[j]) {
+                MAT(dense, row, live_position(&live->col, j)) = e->rows->val[k];
+            }
+        }
+        row += 1;
+    }
+}
+
+static __int128 expand_small(const expand_t *e, live_t *live, int m) {
+    const csr_t *lines;
+    const csr_t *crossing;
+    lines_t *own;
+    lines_t *other;
+    int line;
+    int is_row;
+    int line_pos;
+    __int128 det = 0;
+
+    if (m == 0) {
+        return 1;
+    }
+    // Partial sums of the whole expansion fit, so do those of any minor
+    if (m <= SMALL_MAX_N) {
+        int data[SMALL_MAX_N * SMALL_MAX_N];
+        int rows[SMALL_MAX_N];
+        int cols[SMALL_MAX_N];
+        matrix_t dense = { .data = data };
+        view_t view;
+        gather_minor(e, live, m, &dense);
+        view_of_matrix(&view, &dense, rows, cols);
+        return small_det_wide(&view);
+    }
+    if (pick_line(live, &line, &is_row) == 0) {
+        return 0;
+    }
+    lines = is_row ? e->rows : e->cols;
+    crossing = is_row ? e->cols : e->rows;
+    own = is_row ? &live->row : &live->col;
+    other = is_row ? &live->col : &live->row;
+    line_pos = live_position(own, line);
+    update_line(lines, own, other, line, -1);
+    for (long k = lines->row_ptr[line]; k < lines->row_ptr[line + 1]; k++) {
+        int j = lines->col[k];
+        if (!other->live[j]) {
+            continue;
+        }
+        long long factor = (line_pos + live_position(other, j)) % 2 == 0 ? lines->val[k] : -(long long)lines->val[k];
+        update_line(crossing, other, own, j, -1);
+        det += factor * expand_small(e, live, m - 1);
+        update_line(crossing, other, own, j, 1);
+    }
+    update_line(lines, own, other, line, 1);
+    return det;
+}
+
+static void expand_big(const expand_t *e, live_t *live, int m, bigint_t *det) {
+    const csr_t *lines;
+    const csr_t *crossing;
+    lines_t *own;
+    lines_t *other;
+    int line;
+    int is_row;
+    int line_pos;
+    bigint_t term;
+
+    if (m == 0) {
+        bigint_set_i64(det, 1);
+        return;
+    }
+    // Only a minor whose own bound fits 128 bits goes to the kernel
+    if (m <= SMALL_MAX_N) {
+        int data[SMALL_MAX_N * SMALL_MAX_N];
+        int rows[SMALL_MAX_N];
+        int cols[SMALL_MAX_N];
+        matrix_t dense = { .data = data };
+        view_t view;
+        gather_minor(e, live, m, &dense);
+        if (width_for_bits(row_sum_bits(&dense, m)) != DET_BIG) {
+            view_of_matrix(&view, &dense, rows, cols);
+            bigint_set_i128(det, small_det_wide(&view));
+            return;
+        }
+    }
+    bigint_set_i64(det, 0);
+    if (pick_line(live, &line, &is_row) == 0) {
+        return;
+    }
+    lines = is_row ? e->rows : e->cols;
+    crossing = is_row ? e->cols : e->rows;
+    own = is_row ? &live->row : &live->col;
+    other = is_row ? &live->col : &live->row;
+    line_pos = live_position(own, line);
+    update_line(lines, own, other, line, -1);
+    bigint_init(&term);
+    for (long k = lines->row_ptr[line]; k < lines->row_ptr[line + 1]; k++) {
+        int j = lines->col[k];
+        if (!other->live[j]) {
+            continue;
+        }
+        long long factor = (line_pos + live_position(other, j)) % 2 == 0 ? lines->val[k] : -(long long)lines->val[k];
+        update_line(crossing, other, own, j, -1);
+        expand_big(e, live, m - 1, &term);
+        bigint_mul_i64(&term, &term, factor);
+        bigint_add(det, det, &term);
+        update_line(crossing, other, own, j, 1);
+    }
+    bigint_free(&term);
+    update_line(lines, own, other, line, 1);
+}
+
+// Children of the root line, each with a private copy of the live lines
+static void expand_children(long begin, long end, void *arg) {
+    root_t *root = (root_t *)arg;
+    const expand_t *e = root->e;
+    live_t live;
+
+    live_alloc(&live, root->live->n);
+    pool_count_minor_bytes(pool, (4 * (live.n + 1) + 1) * sizeof(int) + 2 * live.n);
+    for (long t = begin; t < end; t++) {
+        live_copy(&live, root->live);
+        if (root->is_row) {
+            update_line(e->rows, &live.row, &live.col, root->line, -1);
+            update_line(e->cols, &live.col, &live.row, root->other[t], -1);
+        }
+        else {
+            update_line(e->cols, &live.col, &live.row, root->line, -1);
+            update_line(e->rows, &live.row, &live.col, root->other[t], -1);
+        }
+        if (root->big != NULL) {
+            expand_big(e, &live, root->m - 1, &root->big[t]);
+        }
+        else {
+            root->small[t] = expand_small(e, &live, root->m - 1);
+        }
+    }
+    live_free(&live);
+}
+
+// Partial sums anywhere in the expansion are bounded by the permanent of
+// the absolute values, which both the row and the column sum products
+// bound, so the smaller of the two picks the width
+void sparse_laplace(const csr_t *csr, det_t *det) {
+    int n = csr->n;
+    expand_t e = { .rows = csr, .cols = csr_transpose(csr) };
+    double bits = fmin(csr_row_sum_bits(csr), csr_row_sum_bits(e.cols));
+    int width = width_for_bits(bits);
+    live_t live;
+    int *other = (int *)malloc((n + 1) * sizeof(int));
+    long long *factor = (long long *)malloc((n + 1) * sizeof(long long));
+    root_t root = { .e = &e, .live = &live, .m = n, .other = other };
+    int count = 0;
+
+    live_alloc(&live, n);
+    lines_init(&live.row, e.rows);
+    lines_init(&live.col, e.cols);
+    if (n > 0 && pick_line(&live, &root.line, &root.is_row) > 0) {
+        const csr_t *lines = root.is_row ? e.rows : e.cols;
+        for (long k = lines->row_ptr[root.line]; k < lines->row_ptr[root.line + 1]; k++) {
+            other[count] = lines->col[k];
+            factor[count] = (root.line + lines->col[k]) % 2 == 0 ? lines->val[k] : -(long long)lines->val[k];
+            count += 1;
+        }
+    }
+
+    // Only the root is split across the pool, below it every child is a
+    // plain depth first recursion
+    long grain = n - 1 > inline_cutoff ? 1 : count + 1;
+    if (n == 0) {
+        det_set_i128(det, 1, DET_INT64);
+    }
+    else if (width == DET_BIG) {
+        bigint_t sum;
+        root.big = (bigint_t *)malloc((count + 1) * sizeof(bigint_t));
+        for (int t = 0; t < count; t++) {
+            bigint_init(&root.big[t]);
+        }
+        pool_parallel_for(pool, 0, count, grain, expand_children, &root);
+        bigint_init(&sum);
+        for (int t = 0; t < count; t++) {
+            bigint_mul_i64(&root.big[t], &root.big[t], factor[t]);
+            bigint_add(&sum, &sum, &root.big[t]);
+            bigint_free(&root.big[t]);
+        }
+        det_set_big(det, &sum);
+        bigint_free(&sum);
+        free(root.big);
+    }
+    else {
+        __int128 sum = 0;
+        root.small = (__int128 *)malloc((count + 1) * sizeof(__int128));
+        pool_parallel_for(pool, 0, count, grain, expand_children, &root);
+        for (int t = 0; t < count; t++) {
+            sum += factor[t] * root.small[t];
+        }
+        det_set_i128(det, sum, width);
+        free(root.small);
+    }
+    live_free(&live);
+    free(other);
+    free(factor);
+    free(e.cols);
+}
+
+// Sparse Gaussian elimination modulo a prime. Rows are unordered lists of
+// (column, value), every column keeps the rows that may hold a nonzero in
+// it (stale entries are skipped) and its exact live count. Columns sit in
+// buckets by count so the next pivot column, the one with the fewest
+// nonzeros, is found in O(1) amortized; inside it the shortest row is the
+// pivot row. Both choices keep fill-in low in the Markowitz sense
+typedef struct srow_st {
+    int len;
+    int cap;
+    int *col;
+    uint64_t *val;
+} srow_t;
+
+typedef struct slist_st {
+    int len;
+    int cap;
+    int *item;
+} slist_t;
+
+typedef struct buckets_st {
+    int *head;
+    int *next;
+    int *prev;
+    int *count;
+    int min;
+} buckets_t;
+
+typedef struct sparse_mod_st {
+    const csr_t *csr;
+    const csr_t *cols;
+    const uint64_t *primes;
+    uint64_t *residues;
+} sparse_mod_t;
+
+static void srow_push(srow_t *row, int col, uint64_t val) {
+    if (row->len == row->cap) {
+        row->cap = row->cap * 2 + 4;
+        row->col = (int *)realloc(row->col, row->cap * sizeof(int));
+        row->val = (uint64_t *)realloc(row->val, row->cap * sizeof(uint64_t));
+    }
+    row->col[row->len] = col;
+    row->val[row->len] = val;
+    row->len += 1;
+}
+
+static void slist_push(slist_t *list, int item) {
+    if (list->len == list->cap) {
+        list->cap = list->cap * 2 + 4;
+        list->item = (int *)realloc(list->item, list->cap * sizeof(int));
+    }
+    list->item[list->len++] = item;
+}
+
+static void bucket_insert(buckets_t *b, int c) {
+    int k = b->count[c];
+    b->prev[c] = -1;
+    b->next[c] = b->head[k];
+    if (b->head[k] >= 0) {
+        b->prev[b->head[k]] = c;
+    }
+    b->head[k] = c;
+    if (k < b->min) {
+        b->min = k;
+    }
+}
+
+static void bucket_remove(buckets_t *b, int c) {
+    if (b->prev[c] >= 0) {
+        b->next[b->prev[c]] = b->next[c];
+    }
+    else {
+        b->head[b->count[c]] = b->next[c];
+    }
+    if (b->next[c] >= 0) {
+        b->prev[b->next[c]] = b->prev[c];
+    }
+}
+
+static void bucket_adjust(buckets_t *b, int c, int delta) {
+    bucket_remove(b, c);
+    b->count[c] += delta;
+    bucket_insert(b, c);
+}
+
+static int srow_find(const srow_t *row, int col) {
+    for (int k = 0; k < row->len; k++) {
+        if (row->col[k] == col) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static uint64_t sparse_det_mod(const csr_t *csr, const csr_t *cols, uint64_t p) {
+    int n = csr->n;
+    srow_t *rows = (srow_t *)calloc(n, sizeof(srow_t));
+    slist_t *col_rows = (slist_t *)calloc(n, sizeof(slist_t));
+    int *ints = (int *)malloc(7 * (n + 1) * sizeof(int));
+    char *row_live = (char *)malloc(n + 1);
+    buckets_t b = { .head = ints, .next = ints + (n + 1), .prev = ints + 2 * (n + 1),
+                    .count = ints + 3 * (n + 1), .min = 0 };
+    int *perm = ints + 4 * (n + 1);
+    int *mark = ints + 5 * (n + 1);
+    int *pos = ints + 6 * (n + 1);
+    uint64_t det = 1;
+    long bytes = 0;
+
+    if (n <= 0) {
+        return 1;
+    }
+    memset(b.head, -1, (n + 1) * sizeof(int));
+    memset(mark, -1, n * sizeof(int));
+    memset(row_live, 1, n);
+    for (int i = 0; i < n; i++) {
+        for (long k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++) {
+            srow_push(&rows[i], csr->col[k], residue(csr->val[k], p));
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        for (long k = cols->row_ptr[j]; k < cols->row_ptr[j + 1]; k++) {
+            slist_push(&col_rows[j], cols->col[k]);
+        }
+        b.count[j] = (int)(cols->row_ptr[j + 1] - cols->row_ptr[j]);
+        bucket_insert(&b, j);
+    }
+
+    for (int step = 0; step < n; step++) {
+        int c;
+        int r = -1;
+        int at = -1;
+        while (b.head[b.min] < 0) {
+            b.min += 1;
+        }
+        c = b.head[b.min];
+        if (b.count[c] == 0) {
+            det = 0;
+            break;
+        }
+
+        // Shortest live row with a nonzero in column c
+        for (int t = 0; t < col_rows[c].len; t++) {
+            int i = col_rows[c].item[t];
+            int k;
+            if (row_live[i] && (r < 0 || rows[i].len < rows[r].len) && (k = srow_find(&rows[i], c)) >= 0) {
+                r = i;
+                at = k;
+            }
+        }
+        srow_t *pivot = &rows[r];
+        uint64_t inv = inv_mod(pivot->val[at], p);
+        det = mul_mod(det, pivot->val[at], p);
+        perm[r] = c;
+        row_live[r] = 0;
+        bucket_remove(&b, c);
+        for (int k = 0; k < pivot->len; k++) {
+            if (pivot->col[k] != c) {
+                bucket_adjust(&b, pivot->col[k], -1);
+            }
+        }
+
+        for (int t = 0; t < col_rows[c].len; t++) {
+            int i = col_rows[c].item[t];
+            srow_t *row = &rows[i];
+            int q;
+            if (!row_live[i] || (q = srow_find(row, c)) < 0) {
+                continue;
+            }
+            uint64_t factor = mul_mod(row->val[q], inv, p);
+            for (int k = 0; k < row->len; k++) {
+                mark[row->col[k]] = i;
+                pos[row->col[k]] = k;
+            }
+            int old_len = row->len;
+            for (int k = 0; k < pivot->len; k++) {
+                int j = pivot->col[k];
+                uint64_t x = mul_mod(factor, pivot->val[k], p);
+                if (j == c) {
+                    continue;
+                }
+                if (mark[j] == i) {
+                    row->val[pos[j]] = sub_mod(row->val[pos[j]], x, p);
+                }
+                else {
+                    // Fill-in, a fresh nonzero in column j
+                    srow_push(row, j, p - x);
+                    bucket_adjust(&b, j, 1);
+                    slist_push(&col_rows[j], i);
+                    bytes += sizeof(int) + sizeof(uint64_t);
+                }
+            }
+            for (int k = 0; k < old_len; k++) {
+                mark[row->col[k]] = -1;
+            }
+            // Drop column c and anything that cancelled to zero
+            int len = 0;
+            for (int k = 0; k < row->len; k++) {
+                int j = row->col[k];
+                if (j == c) {
+                    continue;
+                }
+                if (row->val[k] == 0) {
+                    bucket_adjust(&b, j, -1);
+                    continue;
+                }
+                row->col[len] = j;
+                row->val[len] = row->val[k];
+                len += 1;
+            }
+            row->len = len;
+        }
+        free(col_rows[c].item);
+        col_rows[c].item = NULL;
+        col_rows[c].len = 0;
+    }
+
+    // Sign of the row to column pivot permutation from its cycle count
+    if (det != 0) {
+        int cycles = 0;
+        memset(row_live, 0, n);
+        for (int i = 0; i < n; i++) {
+            if (!row_live[i]) {
+                cycles += 1;
+                for (int k = i; !row_live[k]; k = perm[k]) {
+                    row_live[k] = 1;
+                }
+            }
+        }
+        if ((n - cycles) % 2 != 0) {
+            det = p - det;
+        }
+    }
+
+    pool_count_minor_bytes(pool, bytes);
+    for (int i = 0; i < n; i++) {
+        free(rows[i].col);
+        free(rows[i].val);
+        free(col_rows[i].item);
+    }
+    free(rows);
+    free(col_rows);
+    free(ints);
+    free(row_live);
+    return det;
+}
+
+static void sparse_primes(long begin, long end, void *arg) {
+    sparse_mod_t *mod = (sparse_mod_t *)arg;
+    for (long i = begin; i < end; i++) {
+        mod->residues[i] = sparse_det_mod(mod->csr, mod->cols, mod->primes[i]);
+    }
+}
+
+// Multi-modular determinant of a sparse matrix: the elimination above
+// once per prime on the pool, then the Chinese remainder theorem as in
+// modular_determinant
+void sparse_determinant(const csr_t *csr, det_t *det) {
+    int count = modular_prime_count(csr_hadamard_bits(csr));
+    uint64_t *primes = (uint64_t *)malloc(count * sizeof(uint64_t));
+    uint64_t *residues = (uint64_t *)malloc(count * sizeof(uint64_t));
+    csr_t *cols = csr_transpose(csr);
+    sparse_mod_t mod = { .csr = csr, .cols = cols, .primes = primes, .residues = residues };
+
+    modular_find_primes(primes, count);
+    pool_parallel_for(pool, 0, count, 1, sparse_primes, &mod);
+    modular_combine(primes, residues, count, det);
+    free(cols);
+    free(primes);
+    free(residues);
+}
@@ -0,0 +1,31 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stddef.h>
+
+#include <matrix.h>
+#include <result.h>
+
+typedef struct csr_st csr_t;
+
+// Square matrix in compressed sparse rows: the nonzeros of row i are
+// col[k], val[k] for row_ptr[i] <= k < row_ptr[i + 1], columns ascending
+struct csr_st {
+    int n;
+    long nnz;
+    long *row_ptr;
+    int *col;
+    int *val;
+};
+
+csr_t *csr_from_matrix(const matrix_t *matrix, arena_t *arena);
+matrix_t *csr_to_matrix(const csr_t *csr, arena_t *arena);
+csr_t *parse_text_sparse(const char *buf, size_t len, const char *name, arena_t *arena);
+csr_t *form_sparse_matrix(const char *filename, arena_t *arena);
+void print_sparse_matrix(const csr_t *csr);
+double csr_hadamard_bits(const csr_t *csr);
+double csr_row_sum_bits(const csr_t *csr);
+void sparse_laplace(const csr_t *csr, det_t *det);
+void sparse_determinant(const csr_t *csr, det_t *det);
+
+#endif
@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <determinant.h>
+
+#define SUBSET_GRAIN 256
+
+typedef struct layer_st {
+    int k;
+    int width;
+    long count;
+    long long *v64;
+    __int128 *v128;
+    bigint_t *big;
+} layer_t;
+
+typedef struct subset_step_st {
+    const matrix_t *matrix;
+    const layer_t *prev;
+    layer_t *cur;
+} subset_step_t;
+
+// Filled once by the first subset_determinant, concurrent jobs only read
+static long binom[SUBSET_MAX_N + 1][SUBSET_MAX_N + 1];
+static pthread_once_t binom_once = PTHREAD_ONCE_INIT;
+
+
+static void init_binomials() {
+    for (int n = 0; n <= SUBSET_MAX_N; n++) {
+        binom[n][0] = 1;
+        for (int k = 1; k <= n; k++) {
+            binom[n][k] = binom[n - 1][k - 1] + (k <= n - 1 ? binom[n - 1][k] : 0);
+        }
+    }
+}
+
+static long choose(int n, int k) {
+    return k > n ? 0 : binom[n][k];
+}
+
+// k element column set with the given rank in the combinatorial number
+// system, rank(c_0 < .. < c_k-1) = sum of C(c_i, i + 1). Ranks follow the
+// numeric order of the masks, so a range is walked with next_combination
+static unsigned int unrank(long rank, int k) {
+    unsigned int mask = 0;
+    int c = SUBSET_MAX_N;
+    for (int i = k; i >= 1; i--) {
+        while (choose(c, i) > rank) {
+            c--;
+        }
+        rank -= choose(c, i);
+        mask |= 1u << c;
+    }
+    return mask;
+}
+
+// Next mask with the same number of bits (Gosper's hack)
+static unsigned int next_combination(unsigned int x) {
+    unsigned int c = x & -x;
+    unsigned int r = x + c;
+    return (((r ^ x) >> 2) / c) | r;
+}
+
+static __int128 prev_value(const layer_t *prev, long index) {
+    return prev->width == DET_INT64 ? prev->v64[index] : prev->v128[index];
+}
+
+// Minors over rows 0 .. k - 1 for the column sets ranked [begin, end).
+// Each one expands along row k - 1 into minors of layer k - 1, the rank
+// of S without its p-th column is the rank prefix before p plus the
+// suffix after p with every index shifted down by one
+static void subset_layer(long begin, long end, void *arg) {
+    subset_step_t *step = (subset_step_t *)arg;
+    const layer_t *prev = step->prev;
+    layer_t *cur = step->cur;
+    int k = cur->k;
+    const int *row = &MAT(local_matrix(step->matrix), k - 1, 0);
+    int cols[k];
+    long prefix[k + 1];
+    long suffix[k + 1];
+    unsigned int mask = unrank(begin, k);
+    bigint_t sum;
+    bigint_t term;
+
+    if (cur->width == DET_BIG) {
+        bigint_init(&sum);
+        bigint_init(&term);
+    }
+    for (long rank = begin; rank < end; rank++) {
+        unsigned int bits = mask;
+        for (int p = 0; p < k; p++) {
+            cols[p] = __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+        prefix[0] = 0;
+        for (int p = 0; p < k; p++) {
+            prefix[p + 1] = prefix[p] + choose(cols[p], p + 1);
+        }
+        suffix[k] = 0;
+        for (int p = k - 1; p >= 0; p--) {
+            suffix[p] = suffix[p + 1] + choose(cols[p], p);
+        }
+
+        if (cur->width == DET_INT64) {
+            long long det = 0;
+            for (int p = 0; p < k; p++) {
+                if (row[cols[p]] != 0) {
+                    long long coef = (k - 1 + p) % 2 == 0 ? row[cols[p]] : -(long long)row[cols[p]];
+                    det += coef * prev->v64[prefix[p] + suffix[p + 1]];
+                }
+            }
+            cur->v64[rank] = det;
+        }
+        else if (cur->width == DET_INT128) {
+            __int128 det = 0;
+            for (int p = 0; p < k; p++) {
+                if (row[cols[p]] != 0) {
+                    long long coef = (k - 1 + p) % 2 == 0 ? row[cols[p]] : -(long long)row[cols[p]];
+                    det += coef * prev_value(prev, prefix[p] + suffix[p + 1]);
+                }
+            }
+            cur->v128[rank] = det;
+        }
+        else {
+            bigint_set_i64(&sum, 0);
+            for (int p = 0; p < k; p++) {
+                if (row[cols[p]] != 0) {
+                    long long coef = (k - 1 + p) % 2 == 0 ? row[cols[p]] : -(long long)row[cols[p]];
+                    long index = prefix[p] + suffix[p + 1];
+                    if (prev->width == DET_BIG) {
+                        bigint_mul_i64(&term, &prev->big[index], coef);
+                    }
+                    else {
+                        bigint_set_i128(&term, prev_value(prev, index));
+                        bigint_mul_i64(&term, &term, coef);
+                    }
+                    bigint_add(&sum, &sum, &term);
+                }
+            }
+            bigint_init(&cur->big[rank]);
+            bigint_copy(&cur->big[rank], &sum);
+        }
+        mask = next_combination(mask);
+    }
+    if (cur->width == DET_BIG) {
+        bigint_free(&sum);
+        bigint_free(&term);
+    }
+}
+
+static void layer_alloc(layer_t *layer, const int *width, int n, int k) {
+    void *values;
+    size_t size;
+    layer->k = k;
+    layer->width = width[k];
+    layer->count = choose(n, k);
+    layer->v64 = NULL;
+    layer->v128 = NULL;
+    layer->big = NULL;
+    size = layer->width == DET_INT64 ? sizeof(long long) :
+           layer->width == DET_INT128 ? sizeof(__int128) : sizeof(bigint_t);
+    if ((values = malloc(layer->count * size)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    pool_count_minor_bytes(pool, layer->count * size);
+    if (layer->width == DET_INT64) {
+        layer->v64 = (long long *)values;
+    }
+    else if (layer->width == DET_INT128) {
+        layer->v128 = (__int128 *)values;
+    }
+    else {
+        layer->big = (bigint_t *)values;
+    }
+}
+
+static void layer_free(layer_t *layer) {
+    if (layer->big != NULL) {
+        for (long i = 0; i < layer->count; i++) {
+            bigint_free(&layer->big[i]);
+        }
+    }
+    free(layer->v64);
+    free(layer->v128);
+    free(layer->big);
+}
+
+// Laplace expansion along the last row with memoized minors. A minor over
+// the leading k rows is fully described by its column set, so layer k
+// holds one value per k column subset and is built from layer k - 1 in
+// parallel: O(n * 2^n) work instead of O(n!). Layer widths come from
+// laplace_prepare, the same bound covers both expansions
+void subset_determinant(const matrix_t *matrix, const int *width, det_t *det) {
+    int n = matrix->n;
+    layer_t prev;
+    layer_t cur;
+    subset_step_t step = { .matrix = matrix };
+
+    if (n > SUBSET_MAX_N) {
+        fprintf(stderr, "Subset expansion supports matrices up to %ix%i\n", SUBSET_MAX_N, SUBSET_MAX_N);
+        exit(EXIT_FAILURE);
+    }
+    // Small enough for an unrolled kernel, no layer is needed
+    if (n <= SMALL_MAX_N && width[n] != DET_BIG) {
+        int rows[n];
+        int cols[n];
+        view_t view;
+        view_of_matrix(&view, matrix, rows, cols);
+        if (width[n] == DET_INT64) {
+            det_set_i128(det, small_det(&view), DET_INT64);
+        }
+        else {
+            det_set_i128(det, small_det_wide(&view), DET_INT128);
+        }
+        return;
+    }
+    pthread_once(&binom_once, init_binomials);
+    layer_alloc(&prev, width, n, 0);
+    prev.v64[0] = 1;
+    for (int k = 1; k <= n; k++) {
+        layer_alloc(&cur, width, n, k);
+        step.prev = &prev;
+        step.cur = &cur;
+        pool_parallel_for(pool, 0, cur.count, SUBSET_GRAIN, subset_layer, &step);
+        layer_free(&prev);
+        prev = cur;
+    }
+
+    if (prev.width == DET_BIG) {
+        det_set_big(det, &prev.big[0]);
+    }
+    else {
+        det_set_i128(det, prev_value(&prev, 0), prev.width);
+    }
+    layer_free(&prev);
+}
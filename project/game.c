@@ -5,10 +5,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
 #include <sys/shm.h>
 #include <sys/ipc.h>    
 #include <sys/sem.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include <game.h>
 
@@ -35,6 +37,9 @@
 #define FALSE 0
 
 #define MAX_PLAYERS 6
+// Seconds the host waits for players before starting anyway, can be
+// overridden by the first argument of the host
+#define LOBBY_TIMEOUT 10
 
 #define SEM_KEY 1123
 #define GAME_STATE_KEY 6667
@@ -78,6 +83,12 @@ typedef struct game_state_st {
     int player_turn;
     int active;
     int players_finished;
+    // Process shared, guards player_num and active while in the lobby.
+    // Joins are signalled to the host on lobby_joined, the start of the
+    // game to the clients on lobby_started
+    pthread_mutex_t lobby_lock;
+    pthread_cond_t lobby_joined;
+    pthread_cond_t lobby_started;
 } game_state_t;
 
 Display *display;
@@ -110,16 +121,23 @@ struct sembuf semopwait[2];
 int did_i_finished = FALSE;
 
 
-int main() {
+int lobby_timeout = LOBBY_TIMEOUT;
+
+
+int main(int argc, char **argv) {
+    if (argc > 1 && (lobby_timeout = atoi(argv[1])) <= 0) {
+        fprintf(stderr, "Usage: %s [lobby timeout in seconds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
     signal(SIGINT, cleanup);
     init_sem_operations();
     init_shared_state();
     init_display();
     if (player_id == 1) {
-        shm_game_state->active = TRUE;
+        wait_for_players();
     }
     else {
-        while (shm_game_state->active != TRUE) {};
+        wait_for_start();
     }
     init_game();
     game_loop();
@@ -135,6 +153,54 @@ void cleanup(int signal) {
   exit(0);
 }
 
+// Host: sleeps on the join condition until every player joined or the
+// timeout expired, then starts the game for everyone waiting
+void wait_for_players() {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += lobby_timeout;
+
+    pthread_mutex_lock(&shm_game_state->lobby_lock);
+    while (shm_game_state->player_num < MAX_PLAYERS) {
+        if (pthread_cond_timedwait(&shm_game_state->lobby_joined, &shm_game_state->lobby_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    shm_game_state->active = TRUE;
+    pthread_cond_broadcast(&shm_game_state->lobby_started);
+    pthread_mutex_unlock(&shm_game_state->lobby_lock);
+    printf("Starting with %i players\n", shm_game_state->player_num);
+}
+
+// Client: sleeps on the start condition until the host starts the game
+void wait_for_start() {
+    pthread_mutex_lock(&shm_game_state->lobby_lock);
+    while (shm_game_state->active != TRUE) {
+        pthread_cond_wait(&shm_game_state->lobby_started, &shm_game_state->lobby_lock);
+    }
+    pthread_mutex_unlock(&shm_game_state->lobby_lock);
+}
+
+// Lobby mutex and conditions live in the shared segment, so they have to
+// be shared between processes. The host times out on the monotonic clock,
+// a wall clock change can not stretch the lobby
+void init_lobby() {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shm_game_state->lobby_lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&shm_game_state->lobby_joined, &cond_attr);
+    pthread_cond_init(&shm_game_state->lobby_started, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+
 void init_sem_operations() {
     semopwait[0].sem_num = 0;
     semopwait[0].sem_op = 0;
@@ -147,6 +213,8 @@ void init_sem_operations() {
 int init_shared_state() {
 
     if((semaphore = semget(SEM_KEY, 1, 0666 | IPC_CREAT | IPC_EXCL)) > 0) {
+        // Held until the shared state and the lobby are set up
+        semop(semaphore, semopwait, 2);
         srand(time(NULL));
         int starty = rand() % (BOARD_HEIGHT - 1);
         int endy = rand() % (BOARD_HEIGHT - 1);
@@ -164,10 +232,10 @@ int init_shared_state() {
         shm_game_state->player_turn = 1;
         shm_game_state->players_finished = 0;
         shm_game_state->active = FALSE;
+        init_lobby();
 
-        printf("Waiting for %i players or 10 secs\n", MAX_PLAYERS);
-        sleep(1);
-        sleep(5);
+        semop(semaphore, &semopdec, 1);
+        printf("Waiting for %i players or %i secs\n", MAX_PLAYERS, lobby_timeout);
     }
     else {
         semaphore = semget(SEM_KEY, 1, 0666 | IPC_CREAT);
@@ -175,9 +243,11 @@ int init_shared_state() {
 
         shm_game_state_id = shmget(GAME_STATE_KEY, sizeof(game_state_t), 0666 | IPC_CREAT);
         shm_game_state = (game_state_t *)shmat(shm_game_state_id, 0, 0);
+        pthread_mutex_lock(&shm_game_state->lobby_lock);
         
         if (shm_game_state->player_num >= MAX_PLAYERS || shm_game_state->active == TRUE) {
             printf("Too many players!\n");
+            pthread_mutex_unlock(&shm_game_state->lobby_lock);
             semop(semaphore, &semopdec, 1);
             exit(EXIT_FAILURE);
         }        
@@ -185,10 +255,13 @@ int init_shared_state() {
         shm_game_state->player_num += 1;
         player_id = shm_game_state->player_num;
         printf("You are player %i\n", player_id);
+        // Wakes the host to count the players again
+        pthread_cond_signal(&shm_game_state->lobby_joined);
+        pthread_mutex_unlock(&shm_game_state->lobby_lock);
         
         semop(semaphore, &semopdec, 1);
 
-        printf("Waiting for %i players or 10 secs\n", MAX_PLAYERS);
+        printf("Waiting for the host to start the game\n");
     }
 }
 
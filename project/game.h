@@ -28,5 +28,8 @@ void init_game();
 void draw_who_won();
 void exit_loop();
 void init_sem_operations();
+void init_lobby();
+void wait_for_players();
+void wait_for_start();
 void cleanup(int signal);
 int init_shared_state();
\ No newline at end of file